@@ -11,9 +11,15 @@ HEADERS += \
         $$SOURCEDIR/CalibrationDialog.hpp \
         $$SOURCEDIR/CaptureDialog.hpp \
         $$SOURCEDIR/VideoInput.hpp \
+        $$SOURCEDIR/Turntable.hpp \
         $$SOURCEDIR/ImageLabel.hpp \
         $$SOURCEDIR/ProjectorWidget.hpp \
         $$SOURCEDIR/TreeModel.hpp \
+        $$SOURCEDIR/ImageCache.hpp \
+        $$SOURCEDIR/Job.hpp \
+        $$SOURCEDIR/instrument.hpp \
+        $$SOURCEDIR/homography.hpp \
+        $$SOURCEDIR/registration.hpp \
         $$SOURCEDIR/CalibrationData.hpp \
         $$SOURCEDIR/structured_light.hpp \
         $$SOURCEDIR/scan3d.hpp \
@@ -31,11 +37,17 @@ SOURCES += \
         $$SOURCEDIR/AboutDialog.cpp \
         $$SOURCEDIR/CaptureDialog.cpp \
         $$SOURCEDIR/VideoInput.cpp \
+        $$SOURCEDIR/Turntable.cpp \
         $$SOURCEDIR/ProcessingDialog.cpp \
         $$SOURCEDIR/CalibrationDialog.cpp \
         $$SOURCEDIR/ImageLabel.cpp \
         $$SOURCEDIR/ProjectorWidget.cpp \
         $$SOURCEDIR/TreeModel.cpp \
+        $$SOURCEDIR/ImageCache.cpp \
+        $$SOURCEDIR/Job.cpp \
+        $$SOURCEDIR/instrument.cpp \
+        $$SOURCEDIR/homography.cpp \
+        $$SOURCEDIR/registration.cpp \
         $$SOURCEDIR/CalibrationData.cpp \
         $$SOURCEDIR/structured_light.cpp \
         $$SOURCEDIR/scan3d.cpp \
@@ -31,17 +31,31 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QProgressDialog>
 #include <QMessageBox>
 #include <QFileDialog>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QAtomicInt>
 
 #include <cmath>
 #include <iostream>
 #include <ctime>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <limits>
 
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/calib3d/calib3d.hpp>
 
 #include "structured_light.hpp"
+#include "homography.hpp"
+#include "registration.hpp"
+#include "io_util.hpp"
+#include "instrument.hpp"
 
 
 Application::Application(int & argc, char ** argv) : 
@@ -52,6 +66,7 @@ Application::Application(int & argc, char ** argv) :
     config(QSettings::IniFormat, QSettings::UserScope, APP_NAME, APP_NAME, this),
 #endif
     model(this),
+    image_cache(),
     mainWin((QWidget*)(load_config(), NULL)),
     processingDialog(&mainWin, Qt::Window|Qt::CustomizeWindowHint|Qt::WindowTitleHint),
     calib(),
@@ -61,11 +76,18 @@ Application::Application(int & argc, char ** argv) :
     projector_corners(),
     pattern_list(),
     min_max_list(),
+    pattern_keys(),
     projector_view_list(),
-    pointcloud()
+    pointcloud(),
+    compact_pointcloud(),
+    scans(),
+    scan_transforms(),
+    set_cache()
 {
     connect(this, SIGNAL(aboutToQuit()), this, SLOT(deinit()));
 
+    image_cache.set_budget(static_cast<size_t>(config.value(IMAGE_CACHE_CONFIG, IMAGE_CACHE_DEFAULT).toUInt())<<20);
+
     //setup the main window state
     mainWin.show();
     mainWin.restoreGeometry(config.value("main/window_geometry").toByteArray());
@@ -98,12 +120,23 @@ void Application::clear(void)
     projector_corners.clear();
     pattern_list.clear();
     min_max_list.clear();
+    pattern_keys.clear();
     projector_view_list.clear();
     pointcloud.clear();
+    compact_pointcloud.clear();
+    scans.clear();
+    scan_transforms.clear();
+    //set_cache is kept: entries are validated against the files on use
 }
 
 void Application::load_config(void)
 {
+    //image cache
+    if (!config.value(IMAGE_CACHE_CONFIG).isValid())
+    {
+        config.setValue(IMAGE_CACHE_CONFIG, IMAGE_CACHE_DEFAULT);
+    }
+
     //decode
     if (!config.value(THRESHOLD_CONFIG).isValid())
     {
@@ -117,6 +150,30 @@ void Application::load_config(void)
     {
         config.setValue(ROBUST_M_CONFIG, ROBUST_M_DEFAULT);
     }
+    if (!config.value(MIN_CONFIDENCE_CONFIG).isValid())
+    {
+        config.setValue(MIN_CONFIDENCE_CONFIG, MIN_CONFIDENCE_DEFAULT);
+    }
+    if (!config.value(REPAIR_BITS_CONFIG).isValid())
+    {
+        config.setValue(REPAIR_BITS_CONFIG, REPAIR_BITS_DEFAULT);
+    }
+    if (!config.value(BAND_ROWS_CONFIG).isValid())
+    {
+        config.setValue(BAND_ROWS_CONFIG, BAND_ROWS_DEFAULT);
+    }
+    if (!config.value(SKIP_SHADOWS_CONFIG).isValid())
+    {
+        config.setValue(SKIP_SHADOWS_CONFIG, SKIP_SHADOWS_DEFAULT);
+    }
+    if (!config.value(ROI_MODE_CONFIG).isValid())
+    {
+        config.setValue(ROI_MODE_CONFIG, ROI_MODE_DEFAULT);
+    }
+    if (!config.value(ROI_CONFIG).isValid())
+    {
+        config.setValue(ROI_CONFIG, ROI_DEFAULT);
+    }
 
     //checkerboard size
     if (!config.value("main/corner_count_x").isValid())
@@ -136,6 +193,12 @@ void Application::load_config(void)
         config.setValue("main/corners_height", DEFAULT_CORNER_HEIGHT);
     }
 
+    //calibration
+    if (!config.value(HOMOGRAPHY_METHOD_CONFIG).isValid())
+    {
+        config.setValue(HOMOGRAPHY_METHOD_CONFIG, HOMOGRAPHY_METHOD_DEFAULT);
+    }
+
     //reconstruction
     if (!config.value(MAX_DIST_CONFIG).isValid())
     {
@@ -145,6 +208,10 @@ void Application::load_config(void)
     {
         config.setValue(SAVE_NORMALS_CONFIG, SAVE_NORMALS_DEFAULT);
     }
+    if (!config.value(NORMALS_WINDOW_CONFIG).isValid())
+    {
+        config.setValue(NORMALS_WINDOW_CONFIG, NORMALS_WINDOW_DEFAULT);
+    }
     if (!config.value(SAVE_COLORS_CONFIG).isValid())
     {
         config.setValue(SAVE_COLORS_CONFIG, SAVE_COLORS_DEFAULT);
@@ -153,8 +220,168 @@ void Application::load_config(void)
     {
         config.setValue(SAVE_BINARY_CONFIG, SAVE_BINARY_DEFAULT);
     }
+    if (!config.value(SAVE_MESH_CONFIG).isValid())
+    {
+        config.setValue(SAVE_MESH_CONFIG, SAVE_MESH_DEFAULT);
+    }
+    if (!config.value(MESH_MAX_EDGE_CONFIG).isValid())
+    {
+        config.setValue(MESH_MAX_EDGE_CONFIG, MESH_MAX_EDGE_DEFAULT);
+    }
+    if (!config.value(STREAM_PLY_CONFIG).isValid())
+    {
+        config.setValue(STREAM_PLY_CONFIG, STREAM_PLY_DEFAULT);
+    }
+    if (!config.value(RAY_PLANE_CONFIG).isValid())
+    {
+        config.setValue(RAY_PLANE_CONFIG, RAY_PLANE_DEFAULT);
+    }
+    if (!config.value(OUTLIER_METHOD_CONFIG).isValid())
+    {
+        config.setValue(OUTLIER_METHOD_CONFIG, OUTLIER_METHOD_DEFAULT);
+    }
+    if (!config.value(OUTLIER_WINDOW_CONFIG).isValid())
+    {
+        config.setValue(OUTLIER_WINDOW_CONFIG, OUTLIER_WINDOW_DEFAULT);
+    }
+    if (!config.value(OUTLIER_STD_RATIO_CONFIG).isValid())
+    {
+        config.setValue(OUTLIER_STD_RATIO_CONFIG, OUTLIER_STD_RATIO_DEFAULT);
+    }
+    if (!config.value(OUTLIER_RADIUS_CONFIG).isValid())
+    {
+        config.setValue(OUTLIER_RADIUS_CONFIG, OUTLIER_RADIUS_DEFAULT);
+    }
+    if (!config.value(OUTLIER_NEIGHBORS_CONFIG).isValid())
+    {
+        config.setValue(OUTLIER_NEIGHBORS_CONFIG, OUTLIER_NEIGHBORS_DEFAULT);
+    }
+    if (!config.value(DOWNSAMPLE_CONFIG).isValid())
+    {
+        config.setValue(DOWNSAMPLE_CONFIG, DOWNSAMPLE_DEFAULT);
+    }
+    if (!config.value(DOWNSAMPLE_LEAF_CONFIG).isValid())
+    {
+        config.setValue(DOWNSAMPLE_LEAF_CONFIG, DOWNSAMPLE_LEAF_DEFAULT);
+    }
+
+    //registration
+    if (!config.value(ICP_ITERATIONS_CONFIG).isValid())
+    {
+        config.setValue(ICP_ITERATIONS_CONFIG, ICP_ITERATIONS_DEFAULT);
+    }
+    if (!config.value(ICP_MAX_DIST_CONFIG).isValid())
+    {
+        config.setValue(ICP_MAX_DIST_CONFIG, ICP_MAX_DIST_DEFAULT);
+    }
+    if (!config.value(ICP_SAMPLE_STEP_CONFIG).isValid())
+    {
+        config.setValue(ICP_SAMPLE_STEP_CONFIG, ICP_SAMPLE_STEP_DEFAULT);
+    }
+    if (!config.value(MERGE_VOXEL_CONFIG).isValid())
+    {
+        config.setValue(MERGE_VOXEL_CONFIG, MERGE_VOXEL_DEFAULT);
+    }
+    if (!config.value(TURNTABLE_AXIS_POINT_CONFIG).isValid())
+    {
+        config.setValue(TURNTABLE_AXIS_POINT_CONFIG, TURNTABLE_AXIS_POINT_DEFAULT);
+    }
+    if (!config.value(TURNTABLE_AXIS_DIR_CONFIG).isValid())
+    {
+        config.setValue(TURNTABLE_AXIS_DIR_CONFIG, TURNTABLE_AXIS_DIR_DEFAULT);
+    }
+    if (!config.value(TURNTABLE_REFINE_CONFIG).isValid())
+    {
+        config.setValue(TURNTABLE_REFINE_CONFIG, TURNTABLE_REFINE_DEFAULT);
+    }
+
+    //instrumentation
+    if (!config.value(INSTRUMENT_CONFIG).isValid())
+    {
+        config.setValue(INSTRUMENT_CONFIG, INSTRUMENT_DEFAULT);
+    }
+    if (!config.value(INSTRUMENT_TRACE_CONFIG).isValid())
+    {
+        config.setValue(INSTRUMENT_TRACE_CONFIG, INSTRUMENT_TRACE_DEFAULT);
+    }
+}
+
+int InstrumentRun::_depth = 0;
+
+InstrumentRun::InstrumentRun(const char * name) :
+    _name(name),
+    _outermost(_depth++==0)
+{
+    if (!_outermost)
+    {   //part of the enclosing run
+        return;
+    }
+    unsigned flags = 0;
+    if (APP->config.value(INSTRUMENT_CONFIG, INSTRUMENT_DEFAULT).toBool())
+    {
+        flags = instrument::Enabled 
+                | (APP->config.value(INSTRUMENT_TRACE_CONFIG, INSTRUMENT_TRACE_DEFAULT).toBool() ? instrument::Trace : 0);
+    }
+    instrument::set_flags(flags);
+    instrument::reset();
+}
+
+InstrumentRun::~InstrumentRun()
+{
+    _depth--;
+    if (!_outermost || !instrument::enabled())
+    {
+        return;
+    }
+
+    QString path = APP->get_root_dir() + "/instrument";
+    if (!QDir().mkpath(path))
+    {
+        std::cerr << "[instrument] ERROR: cannot create " << path.toStdString() << std::endl;
+        return;
+    }
+    QString base = QString("%1/%2_%3").arg(path).arg(_name).arg(QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss"));
+    instrument::write_json((base + ".json").toStdString(), _name);
+    if (instrument::active_flags & instrument::Trace)
+    {
+        instrument::write_trace((base + ".trace.json").toStdString());
+    }
+    std::cout << "[instrument] " << _name << ": " << base.toStdString() << ".json" << std::endl;
 }
 
+namespace
+{
+    struct ImageHeader
+    {
+        QString filename;
+        cv::Size size;
+        int depth;
+        bool valid;
+    };
+
+    //reads image headers on the worker threads
+    class ImageHeaderReader : public cv::ParallelLoopBody
+    {
+    public:
+        ImageHeaderReader(ImageCache & cache, std::vector<ImageHeader> & headers) : _cache(cache), _headers(headers) {}
+
+        virtual void operator()(const cv::Range & range) const
+        {
+            for (int i=range.start; i<range.end; i++)
+            {
+                ImageHeader & header = _headers[i];
+                int channels = 0, bit_depth = 0;
+                header.valid = _cache.get_size(header.filename, header.size, &channels, &bit_depth);
+                header.depth = channels*bit_depth;
+            }
+        }
+
+    private:
+        ImageCache & _cache;
+        std::vector<ImageHeader> & _headers;
+    };
+};
+
 void Application::set_root_dir(const QString & dirname)
 {
     QDir root_dir(dirname);
@@ -163,6 +390,11 @@ void Application::set_root_dir(const QString & dirname)
     model.clear();
     clear();
 
+    //list the images of every set
+    QStringList setlist;
+    std::vector<int> set_offset;
+    std::vector<ImageHeader> headers;
+
     QStringList dirlist = root_dir.entryList(QDir::Dirs|QDir::NoDotAndDotDot, QDir::Name);
     foreach (const QString & item, dirlist)
     {
@@ -174,11 +406,66 @@ void Application::set_root_dir(const QString & dirname)
         QStringList filelist = dir.entryList(filters, QDir::Files, QDir::Name);
         QString path = dir.path();
 
+        if (filelist.count()<1)
+        {   //no images, skip
+            continue;
+        }
+
+        setlist.append(item);
+        set_offset.push_back(static_cast<int>(headers.size()));
+        foreach (const QString & filename, filelist)
+        {
+            ImageHeader header;
+            header.filename = path + "/" + filename;
+            header.depth = 0;
+            header.valid = false;
+            headers.push_back(header);
+        }
+    }
+    set_offset.push_back(static_cast<int>(headers.size()));
+
+    //read only the image headers, in parallel
+    cv::parallel_for_(cv::Range(0, static_cast<int>(headers.size())), ImageHeaderReader(image_cache, headers));
+
+    cv::Size camera_size(0, 0);
+    int camera_depth = 0;
+    for (int k=0; k<setlist.count(); k++)
+    {
+        const QString & item = setlist.at(k);
+
         //setup the model
-        int filecount = filelist.count();
+        int first = set_offset[k];
+        int filecount = set_offset[k+1] - first;
 
-        if (filecount<1)
-        {   //no images, skip
+        //all images in the set must match the first set
+        QString error;
+        for (int i=first; i<first+filecount && error.isEmpty(); i++)
+        {
+            const ImageHeader & header = headers[i];
+            if (!header.valid)
+            {
+                error = QString("cannot read %1").arg(header.filename);
+            }
+            else if (camera_size.width==0)
+            {
+                camera_size = header.size;
+                camera_depth = header.depth;
+            }
+            else if (header.size!=camera_size || header.depth!=camera_depth)
+            {
+                error = QString("%1 is %2x%3x%4, expected %5x%6x%7").arg(header.filename)
+                            .arg(header.size.width).arg(header.size.height).arg(header.depth)
+                            .arg(camera_size.width).arg(camera_size.height).arg(camera_depth);
+            }
+        }
+        if (!error.isEmpty())
+        {   //mismatched set, skip
+            std::cout << "Set " << item.toStdString() << " rejected: " << error.toStdString() << std::endl;
+            if (model.rowCount()==0)
+            {   //the first accepted set defines the expected size
+                camera_size = cv::Size(0, 0);
+                camera_depth = 0;
+            }
             continue;
         }
 
@@ -194,9 +481,15 @@ void Application::set_root_dir(const QString & dirname)
         model.setData(parent, item,  Qt::DisplayRole);
         model.setData(parent, item,  Qt::ToolTipRole);
         model.setData(parent, Qt::Checked, Qt::CheckStateRole);
+        model.setData(parent, camera_size.width, ImageWidthRole);
+        model.setData(parent, camera_size.height, ImageHeightRole);
+        model.setData(parent, camera_depth, ImageDepthRole);
 
         //read projector info
         int projector_width = 1024, projector_height = 768; //defaults compatible with old software 
+        int phase_steps = 0, phase_period = 0; //no phase shift images
+        int pattern_mode = 0; //sl::DecodeFlags of reduced sets
+        int exposure_count = 1; //HDR sets: additional exposures in subfolders
         QString projector_filename = dirname + "/" + item + "/projector_info.txt";
         FILE * fp = fopen(qPrintable(projector_filename), "r");
         if (fp)
@@ -207,6 +500,39 @@ void Application::set_root_dir(const QString & dirname)
                 projector_width = width;
                 projector_height = height;
                 std::cerr << "Projector info file loaded: " << projector_filename.toStdString() << std::endl;
+
+                //optional settings, one per line: keyword values
+                char key[32];
+                while (fscanf(fp, " %31s", key)==1)
+                {
+                    int value1, value2;
+                    if (key[0]=='#')
+                    {   //comment: skip the line
+                        char line[256];
+                        if (!fgets(line, sizeof(line), fp)) {break;}
+                    }
+                    else if (!strcmp(key, "phase") && fscanf(fp, "%u %u", &value1, &value2)==2 && value1>2 && value2>0)
+                    {   //phase shift images follow the gray code
+                        phase_steps = value1;
+                        phase_period = value2;
+                    }
+                    else if (!strcmp(key, "inverted") && fscanf(fp, "%u", &value1)==1)
+                    {   //no inverted images: decode against the white/black threshold
+                        if (!value1) {pattern_mode |= sl::ThresholdDecode;}
+                    }
+                    else if (!strcmp(key, "columns") && fscanf(fp, "%u", &value1)==1)
+                    {   //vertical patterns only
+                        if (value1) {pattern_mode |= sl::ColumnDecode;}
+                    }
+                    else if (!strcmp(key, "exposures") && fscanf(fp, "%u", &value1)==1 && value1>0)
+                    {   //exposure_1 ... exposure_N-1 subfolders
+                        exposure_count = value1;
+                    }
+                }
+                std::cerr << "Projector info file: phase steps=" << phase_steps << " period=" << phase_period 
+                          << " exposures=" << exposure_count
+                          << (pattern_mode & sl::ThresholdDecode ? " threshold" : "")
+                          << (pattern_mode & sl::ColumnDecode ? " columns" : "") << std::endl;
             }
             else
             {
@@ -221,10 +547,15 @@ void Application::set_root_dir(const QString & dirname)
         std::cerr << "Projector info file: using width=" << projector_width << " height=" << projector_height << std::endl;
         model.setData(parent, projector_width,  ProjectorWidthRole);
         model.setData(parent, projector_height,  ProjectorHeightRole);
+        model.setData(parent, phase_steps,  PhaseStepsRole);
+        model.setData(parent, phase_period,  PhasePeriodRole);
+        model.setData(parent, pattern_mode,  PatternModeRole);
+        model.setData(parent, exposure_count,  ExposureCountRole);
 
         for (int i=0; i<filecount; i++)
         {
-            const QString & filename = filelist.at(i);
+            const ImageHeader & header = headers[first+i];
+            QString filename = QFileInfo(header.filename).fileName();
             if (!model.insertRow(i, parent))
             {
                 std::cout << "Failed model insert " << filename.toStdString() << "("<< row << ")" << std::endl;
@@ -237,7 +568,10 @@ void Application::set_root_dir(const QString & dirname)
             model.setData(index, label, Qt::ToolTipRole);
 
             //additional data
-            model.setData(index, path + "/" + filename, ImageFilenameRole);
+            model.setData(index, header.filename, ImageFilenameRole);
+            model.setData(index, header.size.width, ImageWidthRole);
+            model.setData(index, header.size.height, ImageHeightRole);
+            model.setData(index, header.depth, ImageDepthRole);
         }
     }
 
@@ -289,38 +623,74 @@ const cv::Mat Application::get_image(unsigned level, unsigned n, Role role) cons
     }
 
     QString filename = model.data(index, ImageFilenameRole).toString();
-    std::cout << "[" << (role==GrayImageRole ? "gray" : "color") << "] Filename: " << filename.toStdString() << std::endl;
 
-    //load image
-    cv::Mat rgb_image = cv::imread(filename.toStdString());
-    if (rgb_image.rows>0 && rgb_image.cols>0)
+    //load image, decoded files are memoized
+    if (role==ColorImageRole)
     {
-        //color
-        if (role==ColorImageRole)
-        {
-            return rgb_image;
-        }
-        
-        //gray scale
-        if (role==GrayImageRole)
-        {
-            cv::Mat gray_image;
-            cvtColor(rgb_image, gray_image, CV_BGR2GRAY);
-            return gray_image;
-        }
+        return image_cache.get_color(filename);
     }
+    return image_cache.get_gray(filename);
+}
 
-    return cv::Mat();
+cv::Size Application::get_camera_size(unsigned level) const
+{
+    //image size is read from the headers in set_root_dir()
+    if (static_cast<int>(level)<model.rowCount())
+    {   //ok
+        QModelIndex parent = model.index(level, 0);
+        return cv::Size(model.data(parent, ImageWidthRole).toInt(), model.data(parent, ImageHeightRole).toInt());
+    }
+    return cv::Size(0, 0);
 }
 
 int Application::get_camera_width(unsigned level) const
 {
-  return get_image(level, 0, ColorImageRole).cols;
+  return get_camera_size(level).width;
 }
 
 int Application::get_camera_height(unsigned level) const
 {
-  return get_image(level, 0, ColorImageRole).rows;
+  return get_camera_size(level).height;
+}
+
+int Application::get_phase_steps(unsigned level) const
+{
+    if (static_cast<int>(level)<model.rowCount())
+    {   //ok
+        QModelIndex parent = model.index(level, 0);
+        return model.data(parent, PhaseStepsRole).toInt();
+    }
+    return 0;
+}
+
+int Application::get_phase_period(unsigned level) const
+{
+    if (static_cast<int>(level)<model.rowCount())
+    {   //ok
+        QModelIndex parent = model.index(level, 0);
+        return model.data(parent, PhasePeriodRole).toInt();
+    }
+    return 0;
+}
+
+unsigned Application::get_pattern_mode(unsigned level) const
+{
+    if (static_cast<int>(level)<model.rowCount())
+    {   //ok
+        QModelIndex parent = model.index(level, 0);
+        return model.data(parent, PatternModeRole).toUInt();
+    }
+    return 0;
+}
+
+int Application::get_exposure_count(unsigned level) const
+{
+    if (static_cast<int>(level)<model.rowCount())
+    {   //ok
+        QModelIndex parent = model.index(level, 0);
+        return model.data(parent, ExposureCountRole).toInt();
+    }
+    return 1;
 }
 
 int Application::get_projector_width(unsigned level) const
@@ -343,8 +713,92 @@ int Application::get_projector_height(unsigned level) const
     return 0;
 }
 
+namespace
+{
+    struct CornerResult
+    {
+        QString set_name;
+        cv::Size image_size;
+        bool loaded;
+        bool found;
+        bool cached;
+    };
+
+    //findChessboardCorners + cornerSubPix for one set, runs in the thread pool
+    class CornerTask : public QRunnable
+    {
+    public:
+        CornerTask(ImageCache & cache, QString const& filename, int image_scale, cv::Size const& chessboard_size,
+                   std::vector<cv::Point2f> & corners, CornerResult & result, volatile bool & cancel, QAtomicInt & done) :
+            _cache(cache), _filename(filename), _image_scale(image_scale), _chessboard_size(chessboard_size),
+            _corners(corners), _result(result), _cancel(cancel), _done(done) {}
+
+        virtual void run()
+        {
+            if (!_cancel)
+            {
+                extract();
+            }
+            _done.fetchAndAddOrdered(1);
+        }
+
+    private:
+        void extract(void)
+        {
+            cv::Mat gray_image = _cache.get_gray(_filename);
+            if (gray_image.rows<1)
+            {
+                return;
+            }
+            _result.loaded = true;
+            _result.image_size = gray_image.size();
+
+            cv::Mat small_img;
+
+            if (_image_scale>1)
+            {
+                cv::resize(gray_image, small_img, cv::Size(gray_image.cols/_image_scale, gray_image.rows/_image_scale));
+            }
+            else
+            {
+                small_img = gray_image;
+            }
+
+            if (_cancel)
+            {
+                return;
+            }
+
+            //this will be filled by the detected corners
+            _result.found = cv::findChessboardCorners(small_img, _chessboard_size, _corners, 
+                                            cv::CALIB_CB_ADAPTIVE_THRESH + cv::CALIB_CB_NORMALIZE_IMAGE /*+ cv::CALIB_CB_FILTER_QUADS*/);
+
+            for (std::vector<cv::Point2f>::iterator iter=_corners.begin(); iter!=_corners.end(); iter++)
+            {
+                *iter = _image_scale*(*iter);
+            }
+            if (_corners.size())
+            {
+                cv::cornerSubPix(gray_image, _corners, cv::Size(11, 11), cv::Size(-1, -1), 
+                                    cv::TermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 30, 0.1));
+            }
+        }
+
+    private:
+        ImageCache & _cache;
+        QString _filename;
+        int _image_scale;
+        cv::Size _chessboard_size;
+        std::vector<cv::Point2f> & _corners;
+        CornerResult & _result;
+        volatile bool & _cancel;
+        QAtomicInt & _done;
+    };
+};
+
 bool Application::extract_chessboard_corners(void)
 {
+    InstrumentRun run("corners");
     chessboard_size = cv::Size(config.value("main/corner_count_x").toUInt(), config.value("main/corner_count_y").toUInt()); //interior number of corners
     corner_size = cv::Size2f(config.value("main/corners_width").toDouble(), config.value("main/corners_height").toDouble());
 
@@ -357,87 +811,114 @@ bool Application::extract_chessboard_corners(void)
     chessboard_corners.clear();
     chessboard_corners.resize(count);
 
-    cv::Size imageSize(0,0);
+    //all sets have the same size (checked in set_root_dir), the pyramid scale is known in advance
+    cv::Size imageSize = get_camera_size(0);
     int image_scale = 1;
+    if (imageSize.width>1024)
+    {
+        image_scale = cvRound(imageSize.width/1024.0);
+    }
 
-    bool all_found = true;
+    //run every selected set in the thread pool
+    std::vector<CornerResult> results(count);
+    std::vector<QString> corners_keys(count);
+    volatile bool cancel = false;
+    QAtomicInt done(0);
+    QThreadPool pool;
+    pool.setMaxThreadCount(QThread::idealThreadCount());
+
+    unsigned skipped = 0;
     for (unsigned i=0; i<count; i++)
     {
         QModelIndex index = model.index(i, 0);
-        QString set_name = model.data(index, Qt::DisplayRole).toString();
+        CornerResult & result = results[i];
+        result.set_name = model.data(index, Qt::DisplayRole).toString();
+        result.loaded = false;
+        result.found = false;
+        result.cached = false;
+
         bool checked = (model.data(index, Qt::CheckStateRole).toInt()==Qt::Checked);
         if (!checked)
         {   //skip
-            processing_message(QString(" * %1: skip (not selected)").arg(set_name));
-            processing_set_progress_value(i+1);
+            processing_message(QString(" * %1: skip (not selected)").arg(result.set_name));
+            skipped++;
             continue;
         }
-        processing_set_current_message(QString("Extracting corners... %1").arg(set_name));
 
-        cv::Mat gray_image = get_image(i, 0, GrayImageRole);
-        if (gray_image.rows<1)
+        //reuse the previous result if the set and the chessboard did not change
+        corners_keys[i] = QString("%1|%2x%3").arg(get_set_signature(i)).arg(chessboard_size.width).arg(chessboard_size.height);
+        QHash<QString, SetCacheEntry>::const_iterator cached = set_cache.constFind(get_set_path(i));
+        if (cached!=set_cache.constEnd() && cached->corners_key==corners_keys[i])
         {
-            processing_set_progress_value(i+1);
+            chessboard_corners[i] = cached->corners;
+            result.image_size = imageSize;
+            result.loaded = true;
+            result.found = cached->corners_found;
+            result.cached = true;
+            skipped++;
             continue;
         }
 
-        if (imageSize.width==0)
-        {   //init image size
-            imageSize = gray_image.size();
-            if (imageSize.width>1024)
-            {
-                image_scale = cvRound(imageSize.width/1024.0);
-            }
-        }
-        else if (imageSize != gray_image.size())
-        {   //error
-            std::cout << "ERROR: image of different size: set " << i << std::endl;
-            return false;
+        //the model is only read here, workers get the filename
+        QString filename = model.data(model.index(0, 0, index), ImageFilenameRole).toString();
+        pool.start(new CornerTask(image_cache, filename, image_scale, chessboard_size, chessboard_corners[i], result, cancel, done));
+    }
+
+    //update progress while the workers run
+    while (!pool.waitForDone(100))
+    {
+        processing_set_progress_value(skipped + done.fetchAndAddOrdered(0));
+        if (!cancel && processing_canceled())
+        {   //let the running sets finish, drop the queued ones
+            cancel = true;
         }
+    }
 
-        cv::Mat small_img;
+    if (cancel)
+    {
+        processing_set_current_message("Extract corners canceled");
+        processing_message("Extract corners canceled");
+        return false;
+    }
 
-        if (image_scale>1)
-        {
-            cv::resize(gray_image, small_img, cv::Size(gray_image.cols/image_scale, gray_image.rows/image_scale));
-        }
-        else
-        {
-            gray_image.copyTo(small_img);
+    //report in set order
+    bool all_found = true;
+    for (unsigned i=0; i<count; i++)
+    {
+        CornerResult const& result = results[i];
+        std::vector<cv::Point2f> const& corners = chessboard_corners[i];
+        if (!result.loaded)
+        {   //skipped or failed to load
+            continue;
         }
-
-        if (processing_canceled())
-        {
-            processing_set_current_message("Extract corners canceled");
-            processing_message("Extract corners canceled");
+        if (imageSize != result.image_size)
+        {   //error
+            std::cout << "ERROR: image of different size: set " << i << std::endl;
             return false;
         }
-
-        //this will be filled by the detected corners
-        std::vector<cv::Point2f> & corners = chessboard_corners[i];
-        if (cv::findChessboardCorners(small_img, chessboard_size, corners, cv::CALIB_CB_ADAPTIVE_THRESH + cv::CALIB_CB_NORMALIZE_IMAGE /*+ cv::CALIB_CB_FILTER_QUADS*/))
+        if (!result.cached)
+        {   //remember for the next run
+            SetCacheEntry & entry = set_cache[get_set_path(i)];
+            if (entry.corners_key!=corners_keys[i])
+            {   //corners changed, projector corners are stale
+                entry.projector_key.clear();
+                entry.pcorners.clear();
+            }
+            entry.corners_key = corners_keys[i];
+            entry.corners_found = result.found;
+            entry.corners = corners;
+        }
+        if (result.found)
         {
-            processing_message(QString(" * %1: found %2 corners").arg(set_name).arg(corners.size()));
+            processing_message(QString(" * %1: found %2 corners%3").arg(result.set_name).arg(corners.size()).arg(result.cached?" (cached)":""));
             std::cout << " - corners: " << corners.size() << std::endl;
         }
         else
         {
             all_found = false;
-            processing_message(QString(" * %1: chessboard not found!").arg(set_name));
+            processing_message(QString(" * %1: chessboard not found!").arg(result.set_name));
             std::cout << " - chessboard not found!" << std::endl;
         }
-
-        for (std::vector<cv::Point2f>::iterator iter=corners.begin(); iter!=corners.end(); iter++)
-        {
-            *iter = image_scale*(*iter);
-        }
-        if (corners.size())
-        {
-            cv::cornerSubPix(gray_image, corners, cv::Size(11, 11), cv::Size(-1, -1), 
-                                cv::TermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 30, 0.1));
-        }
-
-        processing_set_progress_value(i+1);
     }
 
     processing_set_current_message("Extract corners finished");
@@ -447,6 +928,7 @@ bool Application::extract_chessboard_corners(void)
 
 void Application::decode_all(void)
 {
+    InstrumentRun run("decode");
     unsigned count = static_cast<unsigned>(model.rowCount());
     cv::Size imageSize(0,0);
 
@@ -456,6 +938,7 @@ void Application::decode_all(void)
 
     pattern_list.resize(count);
     min_max_list.resize(count);
+    pattern_keys.resize(count);
 
     QString path = config.value("main/root_dir").toString();
  
@@ -476,10 +959,16 @@ void Application::decode_all(void)
 
         cv::Mat & pattern_image = pattern_list[i];
         cv::Mat & min_max_image = min_max_list[i];
-        if (!decode_gray_set(i, pattern_image, min_max_image))
-        {   //error
-            std::cout << "ERROR: Decode image set " << i << " failed. " << std::endl;
-            return;
+        bool cached = is_decoded(i);
+        if (!cached)
+        {
+            pattern_keys[i].clear();
+            if (!decode_gray_set(i, pattern_image, min_max_image))
+            {   //error
+                std::cout << "ERROR: Decode image set " << i << " failed. " << std::endl;
+                return;
+            }
+            pattern_keys[i] = get_decode_signature(i);
         }
 
         if (processing_canceled())
@@ -512,7 +1001,7 @@ void Application::decode_all(void)
         //QString filename = path + "/" + set_name;
         //io_util::write_pgm(pattern_image, qPrintable(filename));
 
-        processing_message(QString(" * %1: decoded").arg(set_name));
+        processing_message(QString(" * %1: decoded%2").arg(set_name).arg(cached?" (cached)":""));
         processing_set_progress_value(i+1);
     }
 
@@ -534,27 +1023,76 @@ void Application::decode(int level, QWidget * parent_widget)
     {
         min_max_list.resize(model.rowCount());
     }
+    if (pattern_keys.size()<model.rowCount<size_t>())
+    {
+        pattern_keys.resize(model.rowCount());
+    }
+
+    if (is_decoded(level))
+    {   //images and parameters did not change
+        return;
+    }
 
     cv::Mat & pattern_image = pattern_list[level];
     cv::Mat & min_max_image = min_max_list[level];
 
+    pattern_keys[level].clear();
     if (!decode_gray_set(level, pattern_image, min_max_image, parent_widget))
     {   //error
         std::cout << "ERROR: Decode image set " << level << " failed. " << std::endl;
+        return;
     }
+    pattern_keys[level] = get_decode_signature(level);
 }
 
+namespace
+{
+    //projector corners of one set, runs in the thread pool
+    class HomographyJob : public Job
+    {
+    public:
+        HomographyJob(cv::Mat const& pattern_image, cv::Mat const& min_max_image, std::vector<cv::Point2f> const& corners, 
+                      std::vector<cv::Point2f> & pcorners, unsigned half_window, unsigned threshold, homography::Method method) :
+            _pattern_image(pattern_image), _min_max_image(min_max_image), _corners(corners), _pcorners(pcorners), 
+            _half_window(half_window), _threshold(threshold), _method(method) {}
+
+    protected:
+        virtual bool execute(JobProgress &)
+        {   //corners are processed in parallel inside, there is nothing to report between them
+            return homography::estimate_projector_corners(_pattern_image, _min_max_image, _corners, _pcorners, 
+                                                          _half_window, _threshold, _method);
+        }
+
+    private:
+        cv::Mat _pattern_image;
+        cv::Mat _min_max_image;
+        std::vector<cv::Point2f> const& _corners;
+        std::vector<cv::Point2f> & _pcorners;
+        unsigned _half_window;
+        unsigned _threshold;
+        homography::Method _method;
+    };
+};
+
 void Application::calibrate(void)
 {   //try to calibrate the camera, projector, and stereo system
+    InstrumentRun run("calibrate");
 
     unsigned count = static_cast<unsigned>(model.rowCount());
     const unsigned threshold = config.value("main/shadow_threshold", 0).toUInt();
 
+    //previous result is the initial guess of the solvers
+    CalibrationData previous = calib;
     calib.clear();
 
+    const unsigned homography_window = config.value(HOMOGRAPHY_WINDOW_CONFIG, HOMOGRAPHY_WINDOW_DEFAULT).toUInt();
+    const homography::Method homography_method = 
+        static_cast<homography::Method>(config.value(HOMOGRAPHY_METHOD_CONFIG, HOMOGRAPHY_METHOD_DEFAULT).toInt());
+
     std::cout << " shadow_threshold = " << threshold << std::endl;
 
-    cv::Size imageSize(0,0);
+    //all sets have the same size (checked in set_root_dir)
+    cv::Size imageSize = get_camera_size(0);
 
     //detect corners ////////////////////////////////////
     processing_message("Extracting corners:");
@@ -568,6 +1106,7 @@ void Application::calibrate(void)
     projector_corners.resize(count);
     pattern_list.resize(count);
     min_max_list.resize(count);
+    pattern_keys.resize(count);
 
     processing_set_progress_total(count);
     processing_set_progress_value(0);
@@ -591,22 +1130,40 @@ void Application::calibrate(void)
         //checked: use this set
         pcorners.clear(); //erase previous points
 
+        if (get_pattern_mode(i) & sl::ColumnDecode)
+        {   //homographies need both projector coordinates
+            processing_message(QString(" * %1: ERROR column-only sets cannot be used for calibration").arg(set_name));
+            return;
+        }
+
+        //reuse the projector corners if nothing they depend on changed
+        SetCacheEntry & entry = set_cache[get_set_path(i)];
+        QString projector_key = QString("%1|%2|%3|%4|%5").arg(get_decode_signature(i)).arg(entry.corners_key)
+                                    .arg(threshold).arg(homography_window).arg(homography_method);
+        if (entry.projector_key==projector_key && entry.pcorners.size()==corners.size())
+        {
+            pcorners = entry.pcorners;
+            processing_message(QString(" * %1: finished (cached)").arg(set_name));
+            processing_set_progress_value(i+1);
+            continue;
+        }
 
         processing_set_current_message(QString("Decoding... %1").arg(set_name));
 
         cv::Mat & pattern_image = pattern_list[i];
         cv::Mat & min_max_image = min_max_list[i];
-        if (!decode_gray_set(i, pattern_image, min_max_image))
-        {   //error
-            std::cout << "ERROR: Decode image set " << i << " failed. " << std::endl;
-            return;
-        }
-
-        if (imageSize.width==0)
+        if (!is_decoded(i))
         {
-            imageSize = pattern_image.size();
+            pattern_keys[i].clear();
+            if (!decode_gray_set(i, pattern_image, min_max_image))
+            {   //error
+                std::cout << "ERROR: Decode image set " << i << " failed. " << std::endl;
+                return;
+            }
+            pattern_keys[i] = get_decode_signature(i);
         }
-        else if (imageSize != pattern_image.size())
+
+        if (imageSize != pattern_image.size())
         {
             std::cout << "ERROR: pattern image of different size: set " << i << std::endl;
             return;
@@ -616,62 +1173,22 @@ void Application::calibrate(void)
 
         processing_set_current_message(QString("Computing homographies... %1").arg(set_name));
 
-        for (std::vector<cv::Point2f>::const_iterator iter=corners.begin(); iter!=corners.end(); iter++)
+        if (processing_canceled())
         {
-            const cv::Point2f & p = *iter;
-            cv::Point2f q;
-
-            if (processing_canceled())
-            {
-                processing_set_current_message("Calibration canceled");
-                processing_message("Calibration canceled");
-                return;
-            }
-            processEvents();
-
-            //find an homography around p
-            unsigned WINDOW_SIZE = config.value(HOMOGRAPHY_WINDOW_CONFIG, HOMOGRAPHY_WINDOW_DEFAULT).toUInt()/2;
-            std::vector<cv::Point2f> img_points, proj_points;
-            if (p.x>WINDOW_SIZE && p.y>WINDOW_SIZE && p.x+WINDOW_SIZE<pattern_image.cols && p.y+WINDOW_SIZE<pattern_image.rows)
-            {
-                for (unsigned h=p.y-WINDOW_SIZE; h<p.y+WINDOW_SIZE; h++)
-                {
-                    register const cv::Vec2f * row = pattern_image.ptr<cv::Vec2f>(h);
-                    register const cv::Vec2b * min_max_row = min_max_image.ptr<cv::Vec2b>(h);
-                    //cv::Vec2f * out_row = out_pattern_image.ptr<cv::Vec2f>(h);
-                    for (unsigned w=p.x-WINDOW_SIZE; w<p.x+WINDOW_SIZE; w++)
-                    {
-                        const cv::Vec2f & pattern = row[w];
-                        const cv::Vec2b & min_max = min_max_row[w];
-                        //cv::Vec2f & out_pattern = out_row[w];
-                        if (sl::INVALID(pattern))
-                        {
-                            continue;
-                        }
-                        if ((min_max[1]-min_max[0])<static_cast<int>(threshold))
-                        {   //apply threshold and skip
-                            continue;
-                        }
-
-                        img_points.push_back(cv::Point2f(w, h));
-                        proj_points.push_back(cv::Point2f(pattern));
-
-                        //out_pattern = pattern;
-                    }
-                }
-                cv::Mat H = cv::findHomography(img_points, proj_points, CV_RANSAC);
-                //std::cout << " H:\n" << H << std::endl;
-                cv::Point3d Q = cv::Point3d(cv::Mat(H*cv::Mat(cv::Point3d(p.x, p.y, 1.0))));
-                q = cv::Point2f(Q.x/Q.z, Q.y/Q.z);
-            }
-            else
-            {
-                return;
-            }
+            processing_set_current_message("Calibration canceled");
+            processing_message("Calibration canceled");
+            return;
+        }
 
-            //save
-            pcorners.push_back(q);
+        //find an homography around each corner
+        HomographyJob job(pattern_image, min_max_image, corners, pcorners, homography_window/2, threshold, homography_method);
+        if (!run_job(job))
+        {   //corner too close to the border or without enough decoded points
+            processing_message(QString(" * %1: ERROR computing homographies").arg(set_name));
+            return;
         }
+        entry.projector_key = projector_key;
+        entry.pcorners = pcorners;
 
         processing_message(QString(" * %1: finished").arg(set_name));
         processing_set_progress_value(i+1);
@@ -720,6 +1237,21 @@ void Application::calibrate(void)
                   + cv::CALIB_FIX_K3
                   ;
     
+    //warm start from the previous calibration of the same camera and projector
+    cv::Size projector_size(get_projector_width(), get_projector_height());
+    bool warm_start = previous.is_valid()
+                        && previous.cam_K.at<double>(0,2)<imageSize.width && previous.cam_K.at<double>(1,2)<imageSize.height
+                        && previous.proj_K.at<double>(0,2)<projector_size.width && previous.proj_K.at<double>(1,2)<projector_size.height;
+    if (warm_start)
+    {
+        processing_message(" * Using previous calibration as initial guess");
+        calib.cam_K = previous.cam_K.clone();
+        calib.cam_kc = previous.cam_kc.clone();
+        calib.proj_K = previous.proj_K.clone();
+        calib.proj_kc = previous.proj_kc.clone();
+        cal_flags += cv::CALIB_USE_INTRINSIC_GUESS;
+    }
+    
     //calibrate the camera ////////////////////////////////////
     processing_message(" * Calibrate camera");
     std::vector<cv::Mat> cam_rvecs, cam_tvecs;
@@ -731,7 +1263,6 @@ void Application::calibrate(void)
     processing_message(" * Calibrate projector");
     std::vector<cv::Mat> proj_rvecs, proj_tvecs;
     int proj_flags = cal_flags;
-    cv::Size projector_size(get_projector_width(), get_projector_height());
     calib.proj_error = cv::calibrateCamera(objectPoints, projector_corners_active, projector_size, calib.proj_K, calib.proj_kc, proj_rvecs, proj_tvecs, proj_flags, 
                                              cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 50, DBL_EPSILON));
 
@@ -831,6 +1362,246 @@ void Application::calibrate(void)
     processing_message("Calibration finished");
 }
 
+namespace
+{
+    //everything decode_gray_set reads from the model and the settings, taken in the UI thread
+    struct DecodeSetParams
+    {
+        std::vector<std::vector<std::string> > image_names;   //one list per exposure
+        std::vector<std::vector<std::string> > phase_names;
+        std::vector<size_t> direct_component_images;
+        std::string stack_filename;
+        cv::Size projector_size;
+        unsigned pattern_mode;
+        int phase_steps;
+        float phase_period;
+        float b;
+        unsigned m;
+        int band_rows;
+        float min_confidence;
+        unsigned repair;
+        unsigned shadow;
+        int roi_mode;
+        QString roi_text;
+        unsigned threshold;
+    };
+
+    //decodes one set from its image files, runs in the thread pool
+    class DecodeSetJob : public Job
+    {
+    public:
+        DecodeSetJob(DecodeSetParams const& params, cv::Mat & pattern_image, cv::Mat & min_max_image) :
+            _params(params), _pattern_image(pattern_image), _min_max_image(min_max_image) {}
+
+    protected:
+        virtual bool execute(JobProgress & progress);
+
+    private:
+        cv::Rect decode_roi(sl::FrameSource & frames, cv::Size & frame_size) const;
+        bool fail(JobProgress & progress, QString const& text) const;
+
+    private:
+        DecodeSetParams _params;
+        cv::Mat & _pattern_image;
+        cv::Mat & _min_max_image;
+    };
+
+    bool DecodeSetJob::fail(JobProgress & progress, QString const& text) const
+    {
+        progress.set_label(text);
+        progress.message(text);
+        return false;
+    }
+
+    cv::Rect DecodeSetJob::decode_roi(sl::FrameSource & frames, cv::Size & frame_size) const
+    {   //empty: decode the whole frame
+        cv::Rect roi;
+        if (_params.roi_mode==1)
+        {   //whatever the projector lights
+            cv::Mat white_image = frames.get_gray_image(0);
+            cv::Mat black_image = frames.get_gray_image(1);
+            frame_size = white_image.size();
+            roi = sl::auto_roi(white_image, black_image, _params.threshold, ROI_MARGIN);
+        }
+        else if (_params.roi_mode==2)
+        {
+            QStringList values = _params.roi_text.split(" ", QString::SkipEmptyParts);
+            if (values.size()==4)
+            {
+                frame_size = frames.frame_size();
+                roi = cv::Rect(values.at(0).toInt(), values.at(1).toInt(), values.at(2).toInt(), values.at(3).toInt())
+                        & cv::Rect(0, 0, frame_size.width, frame_size.height);
+            }
+        }
+        if (roi.area()>0 && roi.size()==frame_size)
+        {   //nothing to crop
+            roi = cv::Rect();
+        }
+        return roi;
+    }
+
+    bool DecodeSetJob::execute(JobProgress & progress)
+    {
+        cv::Mat & pattern_image = _pattern_image;
+        cv::Mat & min_max_image = _min_max_image;
+        std::vector<std::vector<std::string> > const& image_names = _params.image_names;
+        std::vector<std::vector<std::string> > const& phase_names = _params.phase_names;
+        std::vector<size_t> const& direct_component_images = _params.direct_component_images;
+        const bool single = (_params.pattern_mode & sl::ThresholdDecode)!=0;
+        const int band_rows = _params.band_rows;
+        const int exposure_count = static_cast<int>(image_names.size());
+
+        progress.set_total(100);
+        progress.set_value(0);
+        progress.set_label("Decoding...");
+
+        sl::FileFrameSource file_source(image_names[0]);
+        sl::FileFrameSource file_phase_source(phase_names[0]);
+        sl::HdrFrameSource hdr_source(image_names);
+        sl::HdrFrameSource hdr_phase_source(phase_names);
+        sl::FrameSource & source = (exposure_count>1 ? static_cast<sl::FrameSource &>(hdr_source) : file_source);
+        sl::FrameSource & phase_source = (exposure_count>1 ? static_cast<sl::FrameSource &>(hdr_phase_source) : file_phase_source);
+        if (exposure_count>1)
+        {   //every frame uses the exposures chosen from the white and black images
+            progress.set_label("Decoding: selecting exposures...");
+            if (!hdr_source.make_exposure_map())
+            {
+                return fail(progress, "ERROR: cannot read the exposure images");
+            }
+            hdr_phase_source.set_exposure_map(hdr_source.get_exposure_map());
+            progress.message(QString("HDR decode: %1 exposures").arg(exposure_count));
+        }
+
+        //tiled decode: the frames are read in bands from a single uncompressed stack, 
+        //written next to the images (HDR frames already fused) unless it is newer than all of them
+        const std::string & stack_filename = _params.stack_filename;
+        if (band_rows>0)
+        {
+            QFileInfo stack_info(QString::fromStdString(stack_filename));
+            bool stale = !stack_info.exists() || sl::RawStackFrameSource(stack_filename).size()!=source.size();
+            for (size_t e=0; e<image_names.size() && !stale; e++)
+            {   //every exposure goes into the fused frames
+                for (size_t i=0; i<image_names[e].size() && !stale; i++)
+                {
+                    stale = (QFileInfo(QString::fromStdString(image_names[e][i])).lastModified()>stack_info.lastModified());
+                }
+            }
+            if (stale)
+            {
+                progress.set_label("Decoding: writing the frame stack...");
+                if (!sl::RawStackFrameSource::write(source, stack_filename))
+                {
+                    return fail(progress, "ERROR: cannot write the frame stack");
+                }
+                progress.message(QString("Frame stack written: %1").arg(QString::fromStdString(stack_filename)));
+            }
+        }
+
+        if (progress.canceled())
+        {   //abort
+            return fail(progress, "Decode canceled");
+        }
+
+        //the direct light frames are loaded once, kept for the decoder after the direct light;
+        //so are white and black when they give the region of interest and the decoder needs them too
+        std::vector<size_t> retained_frames;
+        if (!single && band_rows<1)
+        {
+            retained_frames = direct_component_images;
+        }
+        if (band_rows<1 && _params.roi_mode==1 && (single || _params.shadow>0))
+        {
+            retained_frames.push_back(0);
+            retained_frames.push_back(1);
+        }
+        sl::RetainFrameSource retain_source(source, retained_frames);
+
+        //region of interest: every frame is cropped to it, with the frame stack only its rows are read
+        sl::RawStackFrameSource stack_source(band_rows>0 ? stack_filename : std::string());
+        cv::Size frame_size;
+        cv::Rect roi = decode_roi((band_rows>0 ? static_cast<sl::FrameSource &>(stack_source) : retain_source), frame_size);
+        sl::RoiFrameSource roi_source(retain_source, roi);
+        sl::RoiFrameSource roi_stack_source(stack_source, roi);
+        sl::RoiFrameSource roi_phase_source(phase_source, roi);
+        if (roi.area()>0)
+        {
+            progress.message(QString("Decode region: %1x%2 at (%3, %4)").arg(roi.width).arg(roi.height).arg(roi.x).arg(roi.y));
+        }
+        sl::FrameSource & decode_source = (roi.area()>0 ? static_cast<sl::FrameSource &>(roi_source) : retain_source);
+
+        cv::Mat direct_light;
+        if (!single && band_rows<1)
+        {   //needs normal and inverted pairs: single image sets use the white/black threshold instead
+            progress.set_label("Decoding: estimating direct and global light components...");
+
+            sl::DirectLightAccumulator accumulator(_params.b);
+            for (size_t i=0; i<direct_component_images.size() && !progress.canceled(); i++)
+            {
+                accumulator.add(decode_source.get_gray_image(direct_component_images[i]));
+                progress.set_value(static_cast<int>(50*(i+1)/direct_component_images.size()));
+            }
+            direct_light = accumulator.finish();
+            progress.message("Estimate direct and global light components... done.");
+        }
+
+        if (progress.canceled())
+        {   //abort
+            return fail(progress, "Decode canceled");
+        }
+
+        progress.set_value(50);
+        progress.set_label("Decoding: projector column and row values...");
+        progress.message("Decoding, please wait...");
+
+        const unsigned flags = sl::RobustDecode|sl::GrayPatternDecode|_params.pattern_mode|_params.repair;
+        sl::DecodeAux aux;
+        bool rv = false;
+        if (band_rows>0)
+        {   //every band estimates its own direct light
+            rv = sl::decode_pattern_tiled((roi.area()>0 ? static_cast<sl::FrameSource &>(roi_stack_source) : stack_source), pattern_image, min_max_image, 
+                                          _params.projector_size, flags, direct_component_images, _params.b, _params.m, 
+                                          band_rows, (_params.min_confidence>0.f ? &aux : NULL), _params.shadow);
+        }
+        else
+        {
+            rv = sl::decode_pattern(decode_source, pattern_image, min_max_image, _params.projector_size, flags, direct_light, _params.m, 
+                                    (_params.min_confidence>0.f ? &aux : NULL), _params.shadow);
+        }
+        if (rv && _params.min_confidence>0.f)
+        {   //confidence was accumulated during the decode
+            size_t rejected = sl::reject_low_confidence(pattern_image, aux.confidence, _params.min_confidence);
+            progress.message(QString("Low confidence pixels rejected: %1").arg(rejected));
+        }
+
+        if (rv && progress.canceled())
+        {   //abort
+            return fail(progress, "Decode canceled");
+        }
+
+        if (rv && _params.phase_steps>0)
+        {   //refine the gray code to sub-pixel projector coordinates
+            progress.set_value(75);
+            progress.set_label("Decoding: phase shift...");
+            rv = sl::decode_phase((roi.area()>0 ? static_cast<sl::FrameSource &>(roi_phase_source) : phase_source), pattern_image, 
+                                  _params.phase_steps, _params.phase_period, static_cast<float>(_params.m));
+        }
+
+        if (rv && roi.area()>0)
+        {   //back to the whole frame, invalid outside the region
+            cv::Mat region_pattern = pattern_image;
+            cv::Mat region_min_max = min_max_image;
+            pattern_image = cv::Mat(frame_size, CV_32FC2, cv::Scalar::all(std::numeric_limits<float>::quiet_NaN()));
+            min_max_image = cv::Mat::zeros(frame_size, CV_8UC2);
+            region_pattern.copyTo(pattern_image(roi));
+            region_min_max.copyTo(min_max_image(roi));
+        }
+
+        progress.set_value(100);
+        progress.set_label(QString("Decoding: %1").arg((rv?"finished":"failed")));
+        return rv;
+    }
+};
+
 bool Application::decode_gray_set(unsigned level, cv::Mat & pattern_image, cv::Mat & min_max_image, QWidget * parent_widget) const
 {
     if (model.rowCount()<static_cast<int>(level))
@@ -841,120 +1612,186 @@ bool Application::decode_gray_set(unsigned level, cv::Mat & pattern_image, cv::M
     pattern_image = cv::Mat();
     min_max_image = cv::Mat();
 
-    //progress
-    QProgressDialog * progress = NULL;
-    if (parent_widget)
-    {
-        progress = new QProgressDialog("Decoding...", "Abort", 0, 100, parent_widget, 
-                                        Qt::Dialog|Qt::CustomizeWindowHint|Qt::WindowCloseButtonHint);
-        progress->setWindowModality(Qt::WindowModal);
-        progress->setWindowTitle("Processing");
-        progress->setMinimumWidth(400);
-        progress->show();
-    }
-
-    if (processing_canceled() || (progress && progress->wasCanceled()))
+    if (processing_canceled())
     {   //abort
         processing_set_current_message("Decode canceled");
         processing_message("Decode canceled");
-        if (progress)
-        {
-            progress->close();
-            delete progress;
-            progress = NULL;
-        }
         return false;
     }
-    processEvents();
 
     //parameters
-    const float b = config.value(ROBUST_B_CONFIG, ROBUST_B_DEFAULT).toFloat();
-    const unsigned m = config.value(ROBUST_M_CONFIG, ROBUST_M_DEFAULT).toUInt();
+    DecodeSetParams params;
+    params.b = config.value(ROBUST_B_CONFIG, ROBUST_B_DEFAULT).toFloat();
+    params.m = config.value(ROBUST_M_CONFIG, ROBUST_M_DEFAULT).toUInt();
+    params.projector_size = cv::Size(get_projector_width(), get_projector_height());
+    params.band_rows = config.value(BAND_ROWS_CONFIG, BAND_ROWS_DEFAULT).toInt();
+    params.min_confidence = config.value(MIN_CONFIDENCE_CONFIG, MIN_CONFIDENCE_DEFAULT).toFloat();
+    params.repair = (config.value(REPAIR_BITS_CONFIG, REPAIR_BITS_DEFAULT).toBool() ? sl::RepairDecode : 0);
+    params.shadow = get_decode_shadow();
+    params.roi_mode = config.value(ROI_MODE_CONFIG, ROI_MODE_DEFAULT).toInt();
+    params.roi_text = config.value(ROI_CONFIG, ROI_DEFAULT).toString();
+    params.threshold = config.value(THRESHOLD_CONFIG, THRESHOLD_DEFAULT).toUInt();
 
     //estimate direct component
-    std::vector<cv::Mat> images;
-    int total_images = model.rowCount(model.index(level, 0));
-    int total_patterns = total_images/2 - 1;
-    const int direct_light_count = 4;
-    const int direct_light_offset = 4;
-    if (total_patterns<direct_light_count+direct_light_offset)
+    params.pattern_mode = get_pattern_mode(level);
+    bool single = (params.pattern_mode & sl::ThresholdDecode)!=0;
+    int directions = (params.pattern_mode & sl::ColumnDecode ? 1 : 2);
+    params.phase_steps = get_phase_steps(level);
+    params.phase_period = static_cast<float>(get_phase_period(level));
+    int total_images = model.rowCount(model.index(level, 0)) - directions*params.phase_steps; //gray code images only
+    int direction_images = (total_images - 2)/directions; //images of each direction
+    params.direct_component_images = sl::direct_light_frames(direction_images, directions);
+    if (direction_images<1 || (!single && params.direct_component_images.empty()))
     {   //too few images
         processing_set_current_message("ERROR: too few pattern images");
         processing_message("ERROR: too few pattern images");
         return false;
     }
-    if (progress)
-    {
-        progress->setLabelText("Decoding: estimating direct and global light components...");
-        processEvents();
-    }
 
-    QList<unsigned> direct_component_images;
-    for (unsigned i=0; i<direct_light_count; i++)
+    //image names: exposure 0 is the set itself, other exposures have the same names in subfolders
+    int exposure_count = std::max(1, get_exposure_count(level));
+    params.image_names.resize(exposure_count);
+    params.phase_names.resize(exposure_count);
+
+    QString set_path = get_set_path(level);
+    params.stack_filename = QString("%1/frames.slraw").arg(set_path).toStdString();
+    QModelIndex parent = model.index(level, 0);
+    unsigned level_count = static_cast<unsigned>(model.rowCount(parent));
+    for (unsigned i=0; i<level_count; i++)
     {
-        int index = total_images - total_patterns - direct_light_count - direct_light_offset + i + 1;
-        direct_component_images.append(index);
-        direct_component_images.append(index + total_patterns);
+        QModelIndex index = model.index(i, 0, parent);
+        QString filename = model.data(index, ImageFilenameRole).toString();
+        std::vector<std::vector<std::string> > & names = (static_cast<int>(i)<total_images ? params.image_names : params.phase_names);
+        names[0].push_back(filename.toStdString());
+        for (int e=1; e<exposure_count; e++)
+        {
+            QString exposure_filename = QString("%1/exposure_%2/%3").arg(set_path).arg(e).arg(QFileInfo(filename).fileName());
+            names[e].push_back(exposure_filename.toStdString());
+        }
     }
-    //QList<unsigned> direct_component_images(QList<unsigned>() << 15 << 16 << 17 << 18 << 35 << 36 << 37 << 38);
-    foreach (unsigned i, direct_component_images)
+
+    //the images are read and decoded in a worker, this thread only polls it
+    DecodeSetJob job(params, pattern_image, min_max_image);
+    bool rv = run_job(job, parent_widget);
+    if (!rv)
     {
-        images.push_back(get_image(level, i-1));
+        pattern_image = cv::Mat();
+        min_max_image = cv::Mat();
     }
-    cv::Mat direct_light = sl::estimate_direct_light(images, b);
-    processing_message("Estimate direct and global light components... done.");
+    return rv;
+}
 
-    if (progress)
+bool Application::run_job(Job & job, QWidget * parent_widget) const
+{
+    //progress
+    QProgressDialog * progress = NULL;
+    if (parent_widget)
     {
-        progress->setValue(50);
-        progress->setLabelText("Decoding: projector column and row values...");
-        processEvents();
+        progress = new QProgressDialog("Processing...", "Abort", 0, 100, parent_widget, 
+                                        Qt::Dialog|Qt::CustomizeWindowHint|Qt::WindowCloseButtonHint);
+        progress->setWindowModality(Qt::WindowModal);
+        progress->setWindowTitle("Processing");
+        progress->setMinimumWidth(400);
+        progress->show();
     }
 
-    std::vector<std::string> image_names;
-
-    QModelIndex parent = model.index(level, 0);
-    unsigned level_count = static_cast<unsigned>(model.rowCount(parent));
-    for (unsigned i=0; i<level_count; i++)
+    //the worker never touches the UI: its progress and messages are shown from here
+    JobProgress & state = job.progress();
+    job.start();
+    bool finished = false;
+    while (!finished)
     {
-        QModelIndex index = model.index(i, 0, parent);
-        std::string filename = model.data(index, ImageFilenameRole).toString().toStdString();
-        std::cout << "[decode_set " << level << "] Filename: " << filename << std::endl;
-
-        image_names.push_back(filename);
-    }
+        finished = job.wait(100);
 
-    if (processing_canceled() || (progress && progress->wasCanceled()))
-    {   //abort
-        processing_set_current_message("Decode canceled");
-        processing_message("Decode canceled");
+        QStringList messages = state.take_messages();
+        for (QStringList::const_iterator iter=messages.constBegin(); iter!=messages.constEnd(); iter++)
+        {
+            processing_message(*iter);
+        }
         if (progress)
         {
-            progress->close();
-            delete progress;
-            progress = NULL;
+            progress->setMaximum(std::max(1, state.total()));
+            progress->setValue(std::min(state.value(), progress->maximum()));
+            progress->setLabelText(state.label());
         }
-        return false;
-    }
-    processEvents();
+        processEvents();
 
-    processing_message("Decoding, please wait...");
-    cv::Size projector_size(get_projector_width(), get_projector_height());
-    bool rv = sl::decode_pattern(image_names, pattern_image, min_max_image, projector_size, sl::RobustDecode|sl::GrayPatternDecode, direct_light, m);
+        if (!state.canceled() && (processing_canceled() || (progress && progress->wasCanceled())))
+        {   //the worker stops at its next check
+            state.cancel();
+        }
+    }
 
     if (progress)
     {
-        progress->setValue(100);
-        progress->setLabelText(QString("Decoding: %1").arg((rv?"finished":"failed")));
-        processEvents();
-
         progress->close();
         delete progress;
         progress = NULL;
         processEvents();
     }
 
-    return rv;
+    return job.result();
+}
+
+QString Application::get_set_path(unsigned level) const
+{
+    QModelIndex parent = model.index(level, 0);
+    return config.value("main/root_dir").toString() + "/" + model.data(parent, Qt::DisplayRole).toString();
+}
+
+QString Application::get_set_signature(unsigned level) const
+{   //changes when an image of the set, or of its other exposures, is added, removed, or modified
+    QModelIndex parent = model.index(level, 0);
+    QString signature = QString("%1x%2").arg(get_projector_width(level)).arg(get_projector_height(level));
+    QString set_path = get_set_path(level);
+    int exposure_count = std::max(1, get_exposure_count(level));
+    int rows = model.rowCount(parent);
+    for (int i=0; i<rows; i++)
+    {
+        QString filename = model.data(model.index(i, 0, parent), ImageFilenameRole).toString();
+        for (int e=0; e<exposure_count; e++)
+        {
+            QString exposure_filename = (e==0 ? filename : QString("%1/exposure_%2/%3").arg(set_path).arg(e).arg(QFileInfo(filename).fileName()));
+            QFileInfo info(exposure_filename);
+            signature += QString("|%1:%2:%3").arg(exposure_filename).arg(info.size()).arg(info.lastModified().toMSecsSinceEpoch());
+        }
+    }
+    return signature;
+}
+
+QString Application::get_decode_signature(unsigned level) const
+{
+    const float b = config.value(ROBUST_B_CONFIG, ROBUST_B_DEFAULT).toFloat();
+    const unsigned m = config.value(ROBUST_M_CONFIG, ROBUST_M_DEFAULT).toUInt();
+    const float min_confidence = config.value(MIN_CONFIDENCE_CONFIG, MIN_CONFIDENCE_DEFAULT).toFloat();
+    const bool repair = config.value(REPAIR_BITS_CONFIG, REPAIR_BITS_DEFAULT).toBool();
+    const int band_rows = config.value(BAND_ROWS_CONFIG, BAND_ROWS_DEFAULT).toInt();
+    const unsigned shadow = get_decode_shadow();
+    const int roi_mode = config.value(ROI_MODE_CONFIG, ROI_MODE_DEFAULT).toInt();
+    const QString roi = (roi_mode==1 ? config.value(THRESHOLD_CONFIG, THRESHOLD_DEFAULT).toString() 
+                                     : (roi_mode==2 ? config.value(ROI_CONFIG, ROI_DEFAULT).toString() : QString()));
+    return QString("%1|%2|%3|%4|%5|%6|%7|%8:%9").arg(get_set_signature(level)).arg(b).arg(m).arg(min_confidence).arg(repair)
+                                                .arg(band_rows).arg(shadow).arg(roi_mode).arg(roi);
+}
+
+cv::Rect Application::get_reconstruct_roi(cv::Mat const& pattern_image) const
+{   //decoded pixels lie inside the decode region
+    return (config.value(ROI_MODE_CONFIG, ROI_MODE_DEFAULT).toInt()>0 ? sl::pattern_roi(pattern_image) : cv::Rect());
+}
+
+unsigned Application::get_decode_shadow(void) const
+{   //pixels the reconstruction would reject as shadows are not decoded
+    return (config.value(SKIP_SHADOWS_CONFIG, SKIP_SHADOWS_DEFAULT).toBool() ? config.value(THRESHOLD_CONFIG, THRESHOLD_DEFAULT).toUInt() : 0);
+}
+
+bool Application::is_decoded(unsigned level) const
+{
+    if (pattern_list.size()<=level || min_max_list.size()<=level || pattern_keys.size()<=level)
+    {
+        return false;
+    }
+    return (pattern_list[level].data && min_max_list[level].data 
+            && !pattern_keys[level].isEmpty() && pattern_keys[level]==get_decode_signature(level));
 }
 
 bool Application::load_calibration(QWidget * parent_widget)
@@ -998,6 +1835,58 @@ bool Application::save_calibration(QWidget * parent_widget)
     return false;
 }
 
+namespace
+{
+    //one set into a pointcloud or a row sink, runs in the thread pool: 
+    //ray-plane when tables are given, patch center triangulation otherwise
+    class ReconstructJob : public Job
+    {
+    public:
+        ReconstructJob(scan3d::Pointcloud * pointcloud, scan3d::RowSink * sink, scan3d::RayPlaneTables const* tables, 
+                       CalibrationData const& calib, cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image, 
+                       cv::Size const& projector_size, int threshold, double max_dist, cv::Rect const& roi) :
+            _pointcloud(pointcloud), _sink(sink), _tables(tables), _calib(calib), 
+            _pattern_image(pattern_image), _min_max_image(min_max_image), _color_image(color_image), 
+            _projector_size(projector_size), _threshold(threshold), _max_dist(max_dist), _roi(roi) {}
+
+    protected:
+        virtual bool execute(JobProgress & progress)
+        {
+            progress.set_label("Reconstruction in progress.");
+            if (_pointcloud && _tables)
+            {
+                scan3d::reconstruct_model_ray_plane(*_pointcloud, *_tables, _pattern_image, _min_max_image, _color_image, _threshold, &progress, _roi);
+                return (_pointcloud->points.data!=NULL);
+            }
+            if (_pointcloud)
+            {
+                scan3d::reconstruct_model(*_pointcloud, _calib, _pattern_image, _min_max_image, _color_image, _projector_size, 
+                                          _threshold, _max_dist, &progress, _roi);
+                return (_pointcloud->points.data!=NULL);
+            }
+            if (_tables)
+            {
+                return scan3d::reconstruct_model_ray_plane(*_sink, *_tables, _pattern_image, _min_max_image, _color_image, _threshold, &progress, _roi);
+            }
+            return scan3d::reconstruct_model_stream(*_sink, _calib, _pattern_image, _min_max_image, _color_image, _projector_size, 
+                                                    _threshold, _max_dist, &progress, _roi);
+        }
+
+    private:
+        scan3d::Pointcloud * _pointcloud;
+        scan3d::RowSink * _sink;
+        scan3d::RayPlaneTables const* _tables;
+        CalibrationData const& _calib;
+        cv::Mat _pattern_image;
+        cv::Mat _min_max_image;
+        cv::Mat _color_image;
+        cv::Size _projector_size;
+        int _threshold;
+        double _max_dist;
+        cv::Rect _roi;
+    };
+};
+
 void Application::reconstruct_model(int level, scan3d::Pointcloud & pointcloud, QWidget * parent_widget)
 {
     if (level<0 || level>=model.rowCount())
@@ -1030,7 +1919,23 @@ void Application::reconstruct_model(int level, scan3d::Pointcloud & pointcloud,
     int threshold = config.value(THRESHOLD_CONFIG, THRESHOLD_DEFAULT).toInt();;
     double max_dist = config.value(MAX_DIST_CONFIG, MAX_DIST_DEFAULT).toDouble();;
     
-    scan3d::reconstruct_model(pointcloud, calib, pattern_image, min_max_image, color_image, projector_size, threshold, max_dist, parent_widget);
+    if (use_ray_plane(level))
+    {   //camera organized pointcloud: there is no projector view to save
+        if (update_ray_plane_tables(level))
+        {
+            ReconstructJob job(&pointcloud, NULL, &ray_plane_tables, calib, pattern_image, min_max_image, color_image, 
+                               projector_size, threshold, max_dist, get_reconstruct_roi(pattern_image));
+            run_job(job, parent_widget);
+        }
+        return;
+    }
+
+    ReconstructJob job(&pointcloud, NULL, NULL, calib, pattern_image, min_max_image, color_image, 
+                       projector_size, threshold, max_dist, get_reconstruct_roi(pattern_image));
+    if (!run_job(job, parent_widget))
+    {   //failed or canceled: the previous projector view is kept
+        return;
+    }
 
     //save the projector view
     if (projector_view_list.size()<model.rowCount<size_t>())
@@ -1040,9 +1945,328 @@ void Application::reconstruct_model(int level, scan3d::Pointcloud & pointcloud,
     pointcloud.colors.copyTo(projector_view_list[level]);
 }
 
+bool Application::reconstruct_model_stream(int level, QString const& filename, unsigned ply_flags, QWidget * parent_widget)
+{
+    if (level<0 || level>=model.rowCount())
+    {   //invalid row
+        return false;
+    }
+    if (!calib.is_valid())
+    {   //invalid calibration
+        QMessageBox::critical(parent_widget, "Error", "No valid calibration found.");
+        return false;
+    }
+
+    //decode first
+    decode(level, parent_widget);
+    if (!is_decoded(level))
+    {   //error: decode failed
+        return false;
+    }
+
+    cv::Mat pattern_image = pattern_list.at(level);
+    cv::Mat min_max_image = min_max_list.at(level);
+    cv::Mat color_image = get_image(level, 0, ColorImageRole);
+
+    cv::Size projector_size(get_projector_width(), get_projector_height());
+    int threshold = config.value(THRESHOLD_CONFIG, THRESHOLD_DEFAULT).toInt();
+    double max_dist = config.value(MAX_DIST_CONFIG, MAX_DIST_DEFAULT).toDouble();
+
+    //the points go to the file as rows are completed, the pointcloud is not kept
+    io_util::PlyWriter writer(filename.toStdString(), ply_flags);
+    bool ray_plane = use_ray_plane(level);
+    bool rv = false;
+    if (!ray_plane || update_ray_plane_tables(level))
+    {
+        ReconstructJob job(NULL, &writer, (ray_plane ? &ray_plane_tables : NULL), calib, pattern_image, min_max_image, color_image, 
+                           projector_size, threshold, max_dist, get_reconstruct_roi(pattern_image));
+        rv = run_job(job, parent_widget);
+    }
+    rv = writer.close() && rv;
+    if (!rv)
+    {   //do not leave a partial file
+        QFile::remove(filename);
+    }
+    return rv;
+}
+
+bool Application::reconstruct_preview(std::vector<cv::Mat> const& frames, int levels, int projector_width, scan3d::Pointcloud & pointcloud)
+{   //frames: white, black, and one column image per bit, gray and downsampled 'levels' times with pyrDown
+    pointcloud.clear();
+    if (!calib.is_valid() || frames.size()<3 || projector_width<1 || model.rowCount()<1)
+    {
+        return false;
+    }
+
+    const unsigned m = config.value(ROBUST_M_CONFIG, ROBUST_M_DEFAULT).toUInt();
+    const int threshold = config.value(THRESHOLD_CONFIG, THRESHOLD_DEFAULT).toInt();
+
+    //decode
+    cv::Mat pattern_image, min_max_image;
+    sl::MemoryFrameSource source(frames);
+    if (!sl::decode_pattern(source, pattern_image, min_max_image, cv::Size(projector_width, 1), 
+                            sl::GrayPatternDecode|sl::RobustDecode|sl::ThresholdDecode|sl::ColumnDecode, cv::Mat(), m))
+    {
+        return false;
+    }
+
+    //coarse codes to the calibrated projector columns: center of each coarse column
+    cv::Size projector_size(get_projector_width(0), get_projector_height(0));
+    double scale = static_cast<double>(projector_size.width)/projector_width;
+    cv::Mat channels[2];
+    cv::split(pattern_image, channels);
+    channels[0].convertTo(channels[0], CV_32F, scale, 0.5*scale);
+    cv::merge(channels, 2, pattern_image);
+
+    //camera intrinsics of the pyramid level: pixel centers scale as (x+0.5)/2-0.5 per level
+    CalibrationData preview_calib = calib;
+    preview_calib.cam_K = calib.cam_K.clone();
+    double s = 1.0/(1<<levels);
+    preview_calib.cam_K.at<double>(0,0) *= s;
+    preview_calib.cam_K.at<double>(1,1) *= s;
+    preview_calib.cam_K.at<double>(0,2) = (calib.cam_K.at<double>(0,2) + 0.5)*s - 0.5;
+    preview_calib.cam_K.at<double>(1,2) = (calib.cam_K.at<double>(1,2) + 0.5)*s - 0.5;
+    if (!preview_tables.matches(preview_calib, pattern_image.size(), projector_size)
+        && !preview_tables.init(preview_calib, pattern_image.size(), projector_size))
+    {
+        return false;
+    }
+
+    cv::Mat color_image;
+    cv::cvtColor(frames[0], color_image, CV_GRAY2BGR);
+    scan3d::reconstruct_model_ray_plane(pointcloud, preview_tables, pattern_image, min_max_image, color_image, threshold);
+    compact_pointcloud.from_pointcloud(pointcloud);
+    return (pointcloud.points.data!=NULL);
+}
+
+bool Application::use_ray_plane(int level) const
+{   //column-only sets have no projector row for stereo triangulation
+    return ((get_pattern_mode(level) & sl::ColumnDecode)!=0 || config.value(RAY_PLANE_CONFIG, RAY_PLANE_DEFAULT).toBool());
+}
+
+bool Application::update_ray_plane_tables(int level)
+{
+    cv::Size camera_size = get_camera_size(level);
+    cv::Size projector_size(get_projector_width(level), get_projector_height(level));
+    if (ray_plane_tables.matches(calib, camera_size, projector_size))
+    {   //up to date
+        return true;
+    }
+
+    processing_message("Building camera ray and projector plane tables...");
+    if (!ray_plane_tables.init(calib, camera_size, projector_size))
+    {
+        processing_message("ERROR: ray-plane tables failed");
+        return false;
+    }
+    return true;
+}
+
 void Application::compute_normals(scan3d::Pointcloud & pointcloud)
 {
-    scan3d::compute_normals(pointcloud);
+    int window = config.value(NORMALS_WINDOW_CONFIG, NORMALS_WINDOW_DEFAULT).toInt();
+    scan3d::compute_normals(pointcloud, window);
+}
+
+size_t Application::remove_outliers(scan3d::Pointcloud & pointcloud)
+{
+    int method = config.value(OUTLIER_METHOD_CONFIG, OUTLIER_METHOD_DEFAULT).toInt();
+    int window = config.value(OUTLIER_WINDOW_CONFIG, OUTLIER_WINDOW_DEFAULT).toInt();
+    if (method==scan3d::StatisticalOutliers)
+    {
+        double std_ratio = config.value(OUTLIER_STD_RATIO_CONFIG, OUTLIER_STD_RATIO_DEFAULT).toDouble();
+        return scan3d::remove_statistical_outliers(pointcloud, window, std_ratio);
+    }
+    if (method==scan3d::RadiusOutliers)
+    {
+        double radius = config.value(OUTLIER_RADIUS_CONFIG, OUTLIER_RADIUS_DEFAULT).toDouble();
+        int min_neighbors = config.value(OUTLIER_NEIGHBORS_CONFIG, OUTLIER_NEIGHBORS_DEFAULT).toInt();
+        return scan3d::remove_radius_outliers(pointcloud, window, radius, min_neighbors);
+    }
+    return 0;
+}
+
+size_t Application::downsample(scan3d::Pointcloud & pointcloud)
+{
+    double leaf_size = config.value(DOWNSAMPLE_LEAF_CONFIG, DOWNSAMPLE_LEAF_DEFAULT).toDouble();
+    return scan3d::voxel_downsample(pointcloud, leaf_size);
+}
+
+void Application::compute_mesh(scan3d::Pointcloud & pointcloud)
+{
+    double max_edge = config.value(MESH_MAX_EDGE_CONFIG, MESH_MAX_EDGE_DEFAULT).toDouble();
+    scan3d::make_mesh(pointcloud, max_edge);
+}
+
+bool Application::merge_scans(void)
+{
+    InstrumentRun run("merge");
+    if (!calib.is_valid())
+    {   //invalid calibration
+        processing_message("ERROR: No valid calibration found.");
+        return false;
+    }
+
+    registration::IcpParams params;
+    params.max_iterations = config.value(ICP_ITERATIONS_CONFIG, ICP_ITERATIONS_DEFAULT).toInt();
+    params.max_distance = config.value(ICP_MAX_DIST_CONFIG, ICP_MAX_DIST_DEFAULT).toDouble();
+    params.sample_step = config.value(ICP_SAMPLE_STEP_CONFIG, ICP_SAMPLE_STEP_DEFAULT).toInt();
+    double voxel_size = config.value(MERGE_VOXEL_CONFIG, MERGE_VOXEL_DEFAULT).toDouble();
+
+    unsigned count = static_cast<unsigned>(model.rowCount());
+    processing_set_progress_total(count+1);
+    processing_set_progress_value(0);
+
+    scans.clear();
+    scan_transforms.clear();
+    pointcloud.clear();
+    compact_pointcloud.clear();
+
+    //each scan is aligned to the previous one; a turntable repeats the same motion, 
+    //so the last relative pose is the initial guess of the next one
+    cv::Matx44d relative = cv::Matx44d::eye();
+    registration::KdTree tree;
+    for (unsigned i=0; i<count; i++)
+    {
+        QModelIndex index = model.index(i, 0);
+        QString set_name = model.data(index, Qt::DisplayRole).toString();
+        bool checked = (model.data(index, Qt::CheckStateRole).toInt()==Qt::Checked);
+        if (!checked)
+        {   //skip
+            processing_message(QString(" * %1: skipped [not selected]").arg(set_name));
+            processing_set_progress_value(i+1);
+            continue;
+        }
+
+        processing_set_current_message(QString("Reconstructing... %1").arg(set_name));
+        scan3d::Pointcloud scan;
+        reconstruct_model(i, scan);
+        if (!scan.points.data)
+        {
+            processing_message(QString(" * %1: ERROR reconstruction failed").arg(set_name));
+            processing_set_progress_value(i+1);
+            continue;
+        }
+
+        //point-to-plane needs the normals of the target
+        remove_outliers(scan);
+        compute_normals(scan);
+        scans.push_back(scan3d::CompactPointcloud());
+        scans.back().from_pointcloud(scan);
+        scan.clear();
+
+        if (scans.size()==1)
+        {   //reference frame
+            scan_transforms.push_back(cv::Matx44d::eye());
+            processing_message(QString(" * %1: reference, %2 points").arg(set_name).arg(scans.back().size()));
+        }
+        else
+        {
+            processing_set_current_message(QString("Registering... %1").arg(set_name));
+            scan3d::CompactPointcloud const& target = scans[scans.size()-2];
+            tree.build(target.points);
+
+            cv::Matx44d guess = relative;
+            registration::IcpResult result;
+            if (registration::icp_point_to_plane(scans.back(), target, tree, relative, params, &result))
+            {
+                processing_message(QString(" * %1: registered, %2 iterations, %3 correspondences, rms %4")
+                                        .arg(set_name).arg(result.iterations).arg(result.correspondences).arg(result.rms));
+            }
+            else
+            {
+                relative = guess;
+                processing_message(QString(" * %1: WARNING registration failed, previous motion used").arg(set_name));
+            }
+            scan_transforms.push_back(scan_transforms.back()*relative);
+        }
+
+        if (processing_canceled())
+        {
+            processing_set_current_message("Merge canceled");
+            processing_message("Merge canceled");
+            return false;
+        }
+        processing_set_progress_value(i+1);
+    }
+
+    if (scans.empty())
+    {
+        processing_message("ERROR: no scans to merge");
+        return false;
+    }
+
+    processing_set_current_message("Merging...");
+    registration::merge_voxel(scans, scan_transforms, voxel_size, compact_pointcloud);
+
+    processing_message(QString("Merged %1 scans: %2 points").arg(scans.size()).arg(compact_pointcloud.size()));
+    processing_set_current_message("Merge finished");
+    processing_set_progress_value(count+1);
+    return true;
+}
+
+namespace
+{
+    //"x y z"
+    cv::Vec3d to_vec3d(QString const& text)
+    {
+        QStringList values = text.split(" ", QString::SkipEmptyParts);
+        cv::Vec3d v(0.0, 0.0, 0.0);
+        for (int k=0; k<3 && k<values.size(); k++)
+        {
+            v[k] = values.at(k).toDouble();
+        }
+        return v;
+    }
+}
+
+bool Application::merge_turntable(std::vector<scan3d::CompactPointcloud> const& clouds, std::vector<double> const& angles)
+{
+    if (clouds.empty() || clouds.size()!=angles.size())
+    {
+        return false;
+    }
+
+    cv::Vec3d axis_point = to_vec3d(config.value(TURNTABLE_AXIS_POINT_CONFIG, TURNTABLE_AXIS_POINT_DEFAULT).toString());
+    cv::Vec3d axis_direction = to_vec3d(config.value(TURNTABLE_AXIS_DIR_CONFIG, TURNTABLE_AXIS_DIR_DEFAULT).toString());
+    bool refine = config.value(TURNTABLE_REFINE_CONFIG, TURNTABLE_REFINE_DEFAULT).toBool();
+    double voxel_size = config.value(MERGE_VOXEL_CONFIG, MERGE_VOXEL_DEFAULT).toDouble();
+
+    registration::IcpParams params;
+    params.max_iterations = config.value(ICP_ITERATIONS_CONFIG, ICP_ITERATIONS_DEFAULT).toInt();
+    params.max_distance = config.value(ICP_MAX_DIST_CONFIG, ICP_MAX_DIST_DEFAULT).toDouble();
+    params.sample_step = config.value(ICP_SAMPLE_STEP_CONFIG, ICP_SAMPLE_STEP_DEFAULT).toInt();
+
+    //a scan at angle a is brought back to the first one by turning -a about the axis
+    scans = clouds;
+    scan_transforms.resize(scans.size());
+    registration::KdTree tree;
+    for (size_t i=0; i<scans.size(); i++)
+    {
+        scan_transforms[i] = registration::axis_rotation(axis_point, axis_direction, angles[0]-angles[i]);
+        if (!refine || i==0)
+        {
+            continue;
+        }
+
+        //the known rotation is the initial guess of the alignment to the previous scan
+        cv::Matx44d relative = scan_transforms[i-1].inv()*scan_transforms[i];
+        tree.build(scans[i-1].points);
+        registration::IcpResult result;
+        if (registration::icp_point_to_plane(scans[i], scans[i-1], tree, relative, params, &result))
+        {
+            scan_transforms[i] = scan_transforms[i-1]*relative;
+            processing_message(QString(" * scan %1: refined, rms %2").arg(i).arg(result.rms));
+        }
+        else
+        {
+            processing_message(QString(" * scan %1: WARNING refinement failed, the axis rotation is used").arg(i));
+        }
+    }
+
+    registration::merge_voxel(scans, scan_transforms, voxel_size, compact_pointcloud);
+    pointcloud.clear();
+    return !compact_pointcloud.empty();
 }
 
 void Application::make_pattern_images(int level, cv::Mat & col_image, cv::Mat & row_image)
@@ -1081,13 +2305,14 @@ void Application::make_pattern_images(int level, cv::Mat & col_image, cv::Mat &
             cv::Vec2b const& min_max = min_max_row[w];
             cv::Vec2f & pattern_new = pattern_new_row[w];
 
-            if (sl::INVALID(pattern) || (min_max[1]-min_max[0])<static_cast<int>(threshold))
+            if ((min_max[1]-min_max[0])<static_cast<int>(threshold))
             {   //invalid
                 pattern_new = cv::Vec2f(sl::PIXEL_UNCERTAIN, sl::PIXEL_UNCERTAIN);
             }
             else
-            {   //ok
-                pattern_new = pattern;
+            {   //each direction on its own: column sets have no row code
+                pattern_new[0] = (sl::INVALID(pattern[0]) ? sl::PIXEL_UNCERTAIN : pattern[0]);
+                pattern_new[1] = (sl::INVALID(pattern[1]) ? sl::PIXEL_UNCERTAIN : pattern[1]);
             }
         }   //for each column
     }   //for each row
@@ -1122,7 +2347,8 @@ cv::Mat Application::get_projector_view(int level, bool force_update)
         cv::Mat color_image = get_image(level, 0, ColorImageRole);
         cv::Size projector_size(get_projector_width(), get_projector_height());
     
-        projector_image = scan3d::make_projector_view(pattern_image, min_max_image, color_image, projector_size, threshold);
+        bool columns = (get_pattern_mode(level) & sl::ColumnDecode)!=0;
+        projector_image = scan3d::make_projector_view(pattern_image, min_max_image, color_image, projector_size, threshold, columns);
     }
 
     return projector_image;
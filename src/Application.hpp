@@ -38,25 +38,33 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QList>
 #include <QFileSystemModel>
 #include <QMap>
+#include <QHash>
 
 #include <opencv2/core/core.hpp>
 
 #include "TreeModel.hpp"
+#include "ImageCache.hpp"
 #include "MainWindow.hpp"
 #include "ProcessingDialog.hpp"
 #include "CalibrationData.hpp"
 #include "scan3d.hpp"
+#include "structured_light.hpp"
+#include "Job.hpp"
 
 #if defined(_MSC_VER) && !defined(isnan)
 #define isnan _isnan
 #endif
 
 enum Role {ImageFilenameRole = Qt::UserRole, GrayImageRole, ColorImageRole, 
-           ProjectorWidthRole, ProjectorHeightRole};
+           ProjectorWidthRole, ProjectorHeightRole, PhaseStepsRole, PhasePeriodRole, PatternModeRole, ExposureCountRole,
+           ImageWidthRole, ImageHeightRole, ImageDepthRole};
 
 #define WINDOW_TITLE "Calibrator"
 #define APP_NAME "Calibrator"
 
+//image cache
+#define IMAGE_CACHE_CONFIG  "main/image_cache_mb"
+#define IMAGE_CACHE_DEFAULT 512
 
 //decode
 #define THRESHOLD_CONFIG    "decode/threshold"
@@ -65,6 +73,19 @@ enum Role {ImageFilenameRole = Qt::UserRole, GrayImageRole, ColorImageRole,
 #define ROBUST_B_DEFAULT    0.5
 #define ROBUST_M_CONFIG     "decode/m"
 #define ROBUST_M_DEFAULT    5
+#define MIN_CONFIDENCE_CONFIG   "decode/min_confidence"
+#define MIN_CONFIDENCE_DEFAULT  0.0
+#define REPAIR_BITS_CONFIG      "decode/repair_bits"
+#define REPAIR_BITS_DEFAULT     false
+#define BAND_ROWS_CONFIG        "decode/band_rows"
+#define BAND_ROWS_DEFAULT       0
+#define SKIP_SHADOWS_CONFIG     "decode/skip_shadows"
+#define SKIP_SHADOWS_DEFAULT    false
+#define ROI_MODE_CONFIG         "decode/roi_mode"
+#define ROI_MODE_DEFAULT        0           //0: whole frame, 1: automatic from the white/black contrast, 2: ROI_CONFIG
+#define ROI_CONFIG              "decode/roi"
+#define ROI_DEFAULT             "0 0 0 0"   //x y width height
+#define ROI_MARGIN              8           //pixels around the automatic region
 
 //checkerboard size
 #define DEFAULT_CORNER_X        7
@@ -75,16 +96,73 @@ enum Role {ImageFilenameRole = Qt::UserRole, GrayImageRole, ColorImageRole,
 //calibration
 #define HOMOGRAPHY_WINDOW_CONFIG         "calibration/homography_window"
 #define HOMOGRAPHY_WINDOW_DEFAULT        60
+#define HOMOGRAPHY_METHOD_CONFIG         "calibration/homography_method"
+#define HOMOGRAPHY_METHOD_DEFAULT        0
 
 //reconstruction
 #define MAX_DIST_CONFIG         "reconstruction/max_dist"
 #define MAX_DIST_DEFAULT        100.0
 #define SAVE_NORMALS_CONFIG     "reconstruction/save_normals"
 #define SAVE_NORMALS_DEFAULT    true
+#define NORMALS_WINDOW_CONFIG   "reconstruction/normals_window"
+#define NORMALS_WINDOW_DEFAULT  0
 #define SAVE_COLORS_CONFIG      "reconstruction/save_colors"
 #define SAVE_COLORS_DEFAULT     true
 #define SAVE_BINARY_CONFIG      "reconstruction/save_binary"
 #define SAVE_BINARY_DEFAULT     true
+#define SAVE_MESH_CONFIG        "reconstruction/save_mesh"
+#define SAVE_MESH_DEFAULT       false
+#define MESH_MAX_EDGE_CONFIG    "reconstruction/mesh_max_edge"
+#define MESH_MAX_EDGE_DEFAULT   5.0
+#define STREAM_PLY_CONFIG       "reconstruction/stream_ply"
+#define STREAM_PLY_DEFAULT      false
+#define RAY_PLANE_CONFIG        "reconstruction/ray_plane"
+#define RAY_PLANE_DEFAULT       false
+#define OUTLIER_METHOD_CONFIG   "reconstruction/outlier_method"
+#define OUTLIER_METHOD_DEFAULT  0
+#define OUTLIER_WINDOW_CONFIG   "reconstruction/outlier_window"
+#define OUTLIER_WINDOW_DEFAULT  2
+#define OUTLIER_STD_RATIO_CONFIG    "reconstruction/outlier_std_ratio"
+#define OUTLIER_STD_RATIO_DEFAULT   2.0
+#define OUTLIER_RADIUS_CONFIG   "reconstruction/outlier_radius"
+#define OUTLIER_RADIUS_DEFAULT  1.0
+#define OUTLIER_NEIGHBORS_CONFIG    "reconstruction/outlier_min_neighbors"
+#define OUTLIER_NEIGHBORS_DEFAULT   4
+#define DOWNSAMPLE_CONFIG       "reconstruction/downsample"
+#define DOWNSAMPLE_DEFAULT      false
+#define DOWNSAMPLE_LEAF_CONFIG  "reconstruction/downsample_leaf"
+#define DOWNSAMPLE_LEAF_DEFAULT 1.0
+
+#define ICP_ITERATIONS_CONFIG   "registration/icp_iterations"
+#define ICP_ITERATIONS_DEFAULT  30
+#define ICP_MAX_DIST_CONFIG     "registration/icp_max_distance"
+#define ICP_MAX_DIST_DEFAULT    5.0
+#define ICP_SAMPLE_STEP_CONFIG  "registration/icp_sample_step"
+#define ICP_SAMPLE_STEP_DEFAULT 4
+#define MERGE_VOXEL_CONFIG      "registration/voxel_size"
+#define MERGE_VOXEL_DEFAULT     0.5
+#define TURNTABLE_AXIS_POINT_CONFIG     "registration/turntable_axis_point"
+#define TURNTABLE_AXIS_POINT_DEFAULT    "0 0 500"
+#define TURNTABLE_AXIS_DIR_CONFIG       "registration/turntable_axis_direction"
+#define TURNTABLE_AXIS_DIR_DEFAULT      "0 -1 0"
+#define TURNTABLE_REFINE_CONFIG         "registration/turntable_icp_refine"
+#define TURNTABLE_REFINE_DEFAULT        true
+
+//instrumentation
+#define INSTRUMENT_CONFIG           "instrument/enabled"
+#define INSTRUMENT_DEFAULT          false
+#define INSTRUMENT_TRACE_CONFIG     "instrument/trace"      //also write a Chrome trace
+#define INSTRUMENT_TRACE_DEFAULT    false
+
+//per-set results kept between calibrations, keyed by set directory
+struct SetCacheEntry
+{
+    QString corners_key;                    //set signature + chessboard size
+    bool corners_found;
+    std::vector<cv::Point2f> corners;
+    QString projector_key;                  //decode signature + corners key + homography parameters
+    std::vector<cv::Point2f> pcorners;
+};
 
 class Application : public QApplication
 {
@@ -101,8 +179,13 @@ public:
     void clear(void);
 
     const cv::Mat get_image(unsigned level, unsigned n, Role role = GrayImageRole) const;
+    cv::Size get_camera_size(unsigned level = 0) const;
     int get_camera_width(unsigned level = 0) const;
     int get_camera_height(unsigned level = 0) const;
+    int get_phase_steps(unsigned level) const;
+    int get_phase_period(unsigned level) const;
+    unsigned get_pattern_mode(unsigned level) const;
+    int get_exposure_count(unsigned level) const;
     int get_projector_width(unsigned level = 0) const;
     int get_projector_height(unsigned level = 0) const;
 
@@ -113,6 +196,14 @@ public:
 
     bool decode_gray_set(unsigned level, cv::Mat & pattern_image, cv::Mat & min_max_image, QWidget * parent_widget = NULL) const;
 
+    //incremental processing
+    QString get_set_path(unsigned level) const;
+    QString get_set_signature(unsigned level) const;
+    QString get_decode_signature(unsigned level) const;
+    unsigned get_decode_shadow(void) const;
+    cv::Rect get_reconstruct_roi(cv::Mat const& pattern_image) const;
+    bool is_decoded(unsigned level) const;
+
     void load_config(void);
 
     //Detection/Decoding/Calibration processing
@@ -123,13 +214,28 @@ public:
     inline void processing_message(const QString & text) const {processingDialog.message(text); processEvents();}
     inline bool processing_canceled(void) const {return processingDialog.canceled();}
 
+    //starts the job and polls it until it finishes, shows its progress over parent_widget 
+    //and its messages in the processing dialog; returns the job result
+    bool run_job(Job & job, QWidget * parent_widget = NULL) const;
+
     //calibration
     bool load_calibration(QWidget * parent_widget = NULL);
     bool save_calibration(QWidget * parent_widget = NULL);
 
     //reconstruction
     void reconstruct_model(int level, scan3d::Pointcloud & pointcloud, QWidget * parent_widget = NULL);
+    bool reconstruct_model_stream(int level, QString const& filename, unsigned ply_flags, QWidget * parent_widget = NULL);
     void compute_normals(scan3d::Pointcloud & pointcloud);
+    size_t remove_outliers(scan3d::Pointcloud & pointcloud);
+    size_t downsample(scan3d::Pointcloud & pointcloud);
+    bool reconstruct_preview(std::vector<cv::Mat> const& frames, int levels, int projector_width, scan3d::Pointcloud & pointcloud);
+    bool use_ray_plane(int level) const;
+    bool update_ray_plane_tables(int level);
+
+    //registration
+    bool merge_scans(void);
+    bool merge_turntable(std::vector<scan3d::CompactPointcloud> const& clouds, std::vector<double> const& angles);
+    void compute_mesh(scan3d::Pointcloud & pointcloud);
 
     void make_pattern_images(int level, cv::Mat & col_image, cv::Mat & row_image);
     cv::Mat get_projector_view(int level, bool force_update = false);
@@ -147,6 +253,7 @@ Q_SIGNALS:
 public:
     QSettings  config;
     TreeModel  model;
+    mutable ImageCache image_cache;
     MainWindow mainWin;
     mutable ProcessingDialog processingDialog;
 
@@ -158,10 +265,33 @@ public:
     std::vector<std::vector<cv::Point2f> > projector_corners;
     std::vector<cv::Mat> pattern_list;
     std::vector<cv::Mat> min_max_list;
+    std::vector<QString> pattern_keys;
     std::vector<cv::Mat> projector_view_list;
     scan3d::Pointcloud pointcloud;
+    scan3d::Pointcloud preview_pointcloud;          //live preview, kept apart from the last reconstruction
+    scan3d::CompactPointcloud compact_pointcloud;   //valid points of pointcloud, for display and export
+    scan3d::RayPlaneTables ray_plane_tables;        //rebuilt when the calibration or the image sizes change
+    scan3d::RayPlaneTables preview_tables;          //same for the downsampled preview camera
+    std::vector<scan3d::CompactPointcloud> scans;   //checked sets of the last merge, with normals
+    std::vector<cv::Matx44d> scan_transforms;       //scan to first scan coordinates
+    QHash<QString, SetCacheEntry> set_cache;
 };
 
 #define APP dynamic_cast<Application *>(Application::instance())
 
+//One instrumented user action, see instrument.hpp: the outermost run reads the settings, 
+//starts from zero, and writes <root dir>/instrument/<name>_<time>.json when it ends.
+//UI thread only.
+class InstrumentRun
+{
+public:
+    explicit InstrumentRun(const char * name);
+    ~InstrumentRun();
+
+private:
+    const char * _name;
+    bool _outermost;
+    static int _depth;
+};
+
 #endif  /* __APPLICATION_HPP__ */
@@ -30,11 +30,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <QDesktopWidget>
 #include <QMessageBox>
+#include <QFile>
 #include <QTime>
 
 #include <iostream>
 
+#include <opencv2/imgproc/imgproc.hpp>
+
 #include "Application.hpp"
+#include "structured_light.hpp"
+#include "Turntable.hpp"
 
 #include "EDSDKcpp.h"
 using namespace EDSDK;
@@ -46,7 +51,13 @@ CaptureDialog::CaptureDialog(QWidget * parent, Qt::WindowFlags flags):
     _projector(),
     _video_input(this),
     _capture(false),
+    _live(false),
+    _live_frames(),
+    _live_levels(0),
+    _turntable(false),
+    _turntable_frames(),
     _session(),
+    _capture_dir(),
     _wait_time(0),
     _total(0),
     _cancel(false)
@@ -70,8 +81,21 @@ CaptureDialog::CaptureDialog(QWidget * parent, Qt::WindowFlags flags):
     update_camera_combo();
 
     projector_patterns_spin->setValue(APP->config.value("capture/pattern_count", 11).toInt());
+    phase_steps_spin->setMaximum(16);
+    phase_steps_spin->setValue(APP->config.value("capture/phase_steps", 0).toInt());
+    phase_period_spin->setRange(4, 256);
+    phase_period_spin->setValue(APP->config.value("capture/phase_period", 16).toInt());
+    inverted_check->setChecked(APP->config.value("capture/inverted_patterns", true).toBool());
+    columns_check->setChecked(APP->config.value("capture/columns_only", false).toBool());
     camera_exposure_spin->setMaximum(10000);
     camera_exposure_spin->setValue(APP->config.value("capture/exposure_time", 500).toInt());
+    hdr_exposures_line->setText(APP->config.value("capture/hdr_exposures", "").toString());
+    live_bits_spin->setRange(3, 10);
+    live_bits_spin->setValue(APP->config.value("capture/live_bits", 6).toInt());
+    turntable_check->setChecked(APP->config.value("capture/turntable", false).toBool());
+    turntable_steps_spin->setRange(2, 360);
+    turntable_steps_spin->setValue(APP->config.value("capture/turntable_steps", 8).toInt());
+    turntable_device_line->setText(APP->config.value("capture/turntable_device", "").toString());
     output_dir_line->setText(APP->get_root_dir());
 
     //test buttons
@@ -102,7 +126,16 @@ CaptureDialog::~CaptureDialog()
         config.setValue("capture/camera_name", camera_name);
     }
     config.setValue("capture/pattern_count", projector_patterns_spin->value());
+    config.setValue("capture/phase_steps", phase_steps_spin->value());
+    config.setValue("capture/phase_period", phase_period_spin->value());
+    config.setValue("capture/inverted_patterns", inverted_check->isChecked());
+    config.setValue("capture/columns_only", columns_check->isChecked());
     config.setValue("capture/exposure_time", camera_exposure_spin->value());
+    config.setValue("capture/hdr_exposures", hdr_exposures_line->text());
+    config.setValue("capture/live_bits", live_bits_spin->value());
+    config.setValue("capture/turntable", turntable_check->isChecked());
+    config.setValue("capture/turntable_steps", turntable_steps_spin->value());
+    config.setValue("capture/turntable_device", turntable_device_line->text());
     
 }
 
@@ -165,7 +198,7 @@ void CaptureDialog::didRemoveCamera(CameraRef camera) {
 
 void CaptureDialog::didAddFile(CameraRef camera, CameraFileRef file)
 {
-    QDir destinationFolderPath(_session);
+    QDir destinationFolderPath(_capture_dir);
     camera->requestDownloadFile(file, destinationFolderPath, [&](EdsError error, QString outputFilePath) {
         if (error == EDS_ERR_OK) {
             std::cout << "image downloaded to '" << outputFilePath.toStdString() << "'" << std::endl;
@@ -343,7 +376,20 @@ void CaptureDialog::_on_new_camera_image(cv::Mat image)
     }
     
     
-    if (_capture)
+    if (_capture && _live)
+    {   //live sequence: keep a small gray copy, nothing is saved
+        cv::Mat gray_image;
+        cv::cvtColor(image, gray_image, CV_BGR2GRAY);
+        for (int i=0; i<_live_levels; i++)
+        {
+            cv::pyrDown(gray_image, gray_image);
+        }
+        _live_frames.push_back(gray_image);
+        camera_image->setImage(image);
+        _capture = false;
+        _projector.clear_updated();
+    }
+    else if (_capture)
     {
         // take picture using DSLR if there is one
         if (mCamera)
@@ -356,7 +402,11 @@ void CaptureDialog::_on_new_camera_image(cv::Mat image)
         else
         {
             camera_image->setImage(image);
-            cv::imwrite(QString("%1/cam_%2.png").arg(_session).arg(_projector.get_current_pattern() + 1, 2, 10, QLatin1Char('0')).toStdString(), image);
+            if (_turntable)
+            {   //reconstructed in the background from memory
+                _turntable_frames.push_back(image.clone());
+            }
+            cv::imwrite(QString("%1/cam_%2.png").arg(_capture_dir).arg(_projector.get_current_pattern() + 1, 2, 10, QLatin1Char('0')).toStdString(), image);
         }
         _capture = false;
         _projector.clear_updated();
@@ -424,6 +474,22 @@ void CaptureDialog::wait(int msecs)
     }
 }
 
+QList<double> CaptureDialog::get_hdr_exposures(void) const
+{
+    QList<double> exposures;
+    QStringList values = hdr_exposures_line->text().split(",", QString::SkipEmptyParts);
+    foreach (const QString & value, values)
+    {
+        bool ok = false;
+        double exposure = value.trimmed().toDouble(&ok);
+        if (ok)
+        {
+            exposures.append(exposure);
+        }
+    }
+    return exposures;
+}
+
 void CaptureDialog::on_capture_button_clicked(bool checked)
 {
     //check camera
@@ -433,16 +499,21 @@ void CaptureDialog::on_capture_button_clicked(bool checked)
         return;
     }
 
-    //make output dir
-    _session = APP->get_root_dir()+"/"+QDateTime::currentDateTime().toString("yyyy-MMM-dd_hh.mm.ss.zzz");
-    QDir session_dir;
-    if (!session_dir.mkpath(_session))
-    {
-        QMessageBox::critical(this, "Error", "Cannot create output directory:\n"+_session);
-        std::cout << "Failed to create directory: " << _session.toStdString() << std::endl;
+    bool turntable = turntable_check->isChecked();
+    if (turntable && (mCamera || !APP->calib.is_valid()))
+    {   //frames are reconstructed from memory during the capture
+        QMessageBox::critical(this, "Error", "Turntable scanning requires a video camera and a calibration");
         return;
     }
 
+    //HDR: the first exposure goes to the session, the others to exposure_N subfolders
+    QList<double> exposures = get_hdr_exposures();
+    if (exposures.size()>1 && (mCamera || turntable))
+    {   //exposure is only controlled on video cameras
+        QMessageBox::warning(this, "Warning", "HDR exposures are not supported with this camera or turntable scanning, using a single exposure.");
+        exposures.clear();
+    }
+
     //disable GUI interaction
     projector_group->setEnabled(false);
     camera_group->setEnabled(false);
@@ -453,15 +524,76 @@ void CaptureDialog::on_capture_button_clicked(bool checked)
     _capture = false;
     _wait_time = camera_exposure_spin->value();
 
+    QString session = APP->get_root_dir()+"/"+QDateTime::currentDateTime().toString("yyyy-MMM-dd_hh.mm.ss.zzz");
+    if (turntable)
+    {   //the sets are re-read before merging
+        if (capture_turntable(session))
+        {
+            APP->mainWin.show_3dview();
+        }
+    }
+    else
+    {
+        capture_set(session, exposures);
+
+        //re-read images
+        APP->set_root_dir(APP->get_root_dir());
+    }
+
+    //enable GUI interaction
+    projector_group->setEnabled(true);
+    camera_group->setEnabled(true);
+    other_group->setEnabled(true);
+    capture_button->setEnabled(true);
+    close_cancel_button->setEnabled(true);
+
+    //TODO: override window close button or allow to close/cancel while capturing
+}
+
+bool CaptureDialog::capture_set(QString const& session, QList<double> const& exposures)
+{
+    //make output dir
+    _session = session;
+    QDir session_dir;
+    if (!session_dir.mkpath(_session))
+    {
+        QMessageBox::critical(this, "Error", "Cannot create output directory:\n"+_session);
+        std::cout << "Failed to create directory: " << _session.toStdString() << std::endl;
+        return false;
+    }
+    _capture_dir = _session;
+
+    for (int e=1; e<exposures.size(); e++)
+    {
+        QString exposure_dir = QString("%1/exposure_%2").arg(_session).arg(e);
+        if (!session_dir.mkpath(exposure_dir))
+        {
+            QMessageBox::critical(this, "Error", "Cannot create output directory:\n"+exposure_dir);
+            return false;
+        }
+    }
+
     //connect projector display signal
     connect(&_projector, SIGNAL(new_image(QPixmap)), this, SLOT(_on_new_projector_image(QPixmap)));
 
     //open projector
     _projector.set_pattern_count(projector_patterns_spin->value());
+    _projector.set_phase_shift(phase_steps_spin->value(), phase_period_spin->value());
+    _projector.set_inverted_patterns(inverted_check->isChecked());
+    _projector.set_columns_only(columns_check->isChecked());
     _projector.start();
 
     //save projector resolution and settings
-    _projector.save_info(QString("%1/projector_info.txt").arg(_session));
+    QString info_filename = QString("%1/projector_info.txt").arg(_session);
+    _projector.save_info(info_filename);
+    if (exposures.size()>1)
+    {   //decode fuses the exposures
+        QFile info(info_filename);
+        if (info.open(QIODevice::Append|QIODevice::Text))
+        {
+            info.write(QString("exposures %1\n").arg(exposures.size()).toLatin1());
+        }
+    }
 
     //init time
     wait(_wait_time);
@@ -477,37 +609,145 @@ void CaptureDialog::on_capture_button_clicked(bool checked)
             QApplication::processEvents();
         }
 
-        //capture
-        _capture = true;
-
-        //wait for camera
-        while (_capture)
+        //capture, once per exposure
+        int exposure_count = (exposures.size()>1 ? exposures.size() : 1);
+        for (int e=0; e<exposure_count; e++)
         {
-            QApplication::processEvents();
+            if (exposure_count>1)
+            {   //let the camera settle with the new exposure
+                _video_input.set_exposure(exposures.at(e));
+                wait(_wait_time);
+            }
+            _capture_dir = (e==0 ? _session : QString("%1/exposure_%2").arg(_session).arg(e));
+            _capture = true;
+
+            //wait for camera
+            while (_capture)
+            {
+                QApplication::processEvents();
+            }
         }
         
         //pause so the screen gets updated
         wait(_wait_time);
     }
 
+    if (exposures.size()>1)
+    {   //live view and the next capture use the regular exposure again
+        _video_input.set_exposure(camera_exposure_spin->value());
+    }
+
     //close projector
     _projector.stop();
 
     //disconnect projector display signal
     disconnect(&_projector, SIGNAL(new_image(QPixmap)), this, SLOT(_on_new_projector_image(QPixmap)));
-   
+    return true;
+}
 
-    //re-read images
-    APP->set_root_dir(APP->get_root_dir());
+bool CaptureDialog::capture_turntable(QString const& session)
+{
+    int steps = turntable_steps_spin->value();
+    Turntable * stage = Turntable::create(turntable_device_line->text().trimmed());
+    if (!stage->open())
+    {
+        QMessageBox::critical(this, "Error", "Cannot open the turntable:\n"+turntable_device_line->text());
+        delete stage;
+        return false;
+    }
 
-    //enable GUI interaction
-    projector_group->setEnabled(true);
-    camera_group->setEnabled(true);
-    other_group->setEnabled(true);
-    capture_button->setEnabled(true);
-    close_cancel_button->setEnabled(true);
+    //same settings as the decode of the saved sets
+    _projector.set_pattern_count(projector_patterns_spin->value());
+    _projector.set_phase_shift(phase_steps_spin->value(), phase_period_spin->value());
+    _projector.set_inverted_patterns(inverted_check->isChecked());
+    _projector.set_columns_only(columns_check->isChecked());
 
-    //TODO: override window close button or allow to close/cancel while capturing
+    QSettings & config = APP->config;
+    TurntablePipeline::Settings settings;
+    settings.calib = APP->calib;
+    settings.pattern_mode = (inverted_check->isChecked() ? 0 : sl::ThresholdDecode) | (columns_check->isChecked() ? sl::ColumnDecode : 0)
+                          | (config.value(REPAIR_BITS_CONFIG, REPAIR_BITS_DEFAULT).toBool() ? sl::RepairDecode : 0);
+    settings.phase_steps = (phase_steps_spin->value()>2 ? phase_steps_spin->value() : 0);
+    settings.phase_period = static_cast<float>(phase_period_spin->value());
+    settings.b = config.value(ROBUST_B_CONFIG, ROBUST_B_DEFAULT).toFloat();
+    settings.m = config.value(ROBUST_M_CONFIG, ROBUST_M_DEFAULT).toUInt();
+    settings.min_confidence = config.value(MIN_CONFIDENCE_CONFIG, MIN_CONFIDENCE_DEFAULT).toFloat();
+    settings.threshold = config.value(THRESHOLD_CONFIG, THRESHOLD_DEFAULT).toInt();
+    settings.skip_shadows = config.value(SKIP_SHADOWS_CONFIG, SKIP_SHADOWS_DEFAULT).toBool();
+    settings.max_dist = config.value(MAX_DIST_CONFIG, MAX_DIST_DEFAULT).toDouble();
+    settings.ray_plane = config.value(RAY_PLANE_CONFIG, RAY_PLANE_DEFAULT).toBool();
+    settings.normals_window = config.value(NORMALS_WINDOW_CONFIG, NORMALS_WINDOW_DEFAULT).toInt();
+
+    //set k is decoded while set k+1 is captured
+    TurntablePipeline pipeline(settings);
+    connect(&pipeline, SIGNAL(set_finished(int, unsigned)), this, SLOT(_on_turntable_set_finished(int, unsigned)));
+
+    current_message_label->setVisible(true);
+    bool rv = true;
+    _turntable = true;
+    for (int k=0; k<steps && rv; k++)
+    {
+        double angle = 360.0*k/steps;
+        set_current_message(QString("Turntable: rotating to %1 degrees").arg(angle));
+        rv = stage->rotate_to(angle);
+        while (rv && stage->is_moving())
+        {
+            QApplication::processEvents();
+        }
+        if (rv && stage->failed())
+        {
+            set_current_message(QString("Turntable: the stage did not reach %1 degrees").arg(angle));
+            rv = false;
+        }
+        wait(_wait_time);
+
+        _turntable_frames.clear();
+        QString set_session = QString("%1_%2").arg(session).arg(k, 2, 10, QLatin1Char('0'));
+        rv = rv && capture_set(set_session, QList<double>());
+        if (rv)
+        {   //keep the angle with the set
+            QFile info(QString("%1/projector_info.txt").arg(set_session));
+            if (info.open(QIODevice::Append|QIODevice::Text))
+            {
+                info.write(QString("# turntable angle %1\n").arg(angle).toLatin1());
+            }
+            if (!pipeline.isRunning())
+            {   //the projector resolution is known once it has been shown
+                pipeline.set_projector_size(cv::Size(_projector.get_effective_width(), _projector.get_effective_height()));
+                pipeline.start();
+            }
+            pipeline.enqueue(_turntable_frames, angle);
+        }
+        _turntable_frames.clear();
+    }
+    _turntable = false;
+    stage->close();
+    delete stage;
+
+    //wait for the last sets
+    set_current_message("Turntable: reconstructing...");
+    pipeline.finish();
+    while (!pipeline.wait(20))
+    {
+        QApplication::processEvents();
+    }
+
+    //sets are re-read before the merge: it would clear the merged cloud
+    APP->set_root_dir(APP->get_root_dir());
+    if (!APP->merge_turntable(pipeline.clouds, pipeline.angles))
+    {
+        set_current_message("Turntable: merge failed");
+        return false;
+    }
+    set_current_message(QString("Turntable: %1 sets merged, %2 points").arg(pipeline.clouds.size()).arg(APP->compact_pointcloud.size()));
+    return rv;
+}
+
+void CaptureDialog::_on_turntable_set_finished(int index, unsigned points)
+{
+    QString message = QString("Turntable: set %1 reconstructed, %2 points").arg(index).arg(points);
+    std::cout << message.toStdString() << std::endl;
+    current_message_label->setText(message);
 }
 
 void CaptureDialog::on_test_check_stateChanged(int state)
@@ -528,6 +768,9 @@ void CaptureDialog::on_test_check_stateChanged(int state)
 
         //open projector
         _projector.set_pattern_count(projector_patterns_spin->value());
+        _projector.set_phase_shift(phase_steps_spin->value(), phase_period_spin->value());
+        _projector.set_inverted_patterns(inverted_check->isChecked());
+        _projector.set_columns_only(columns_check->isChecked());
         _projector.start();
         _projector.next();
     }
@@ -542,6 +785,104 @@ void CaptureDialog::on_test_check_stateChanged(int state)
     }
 }
 
+void CaptureDialog::on_live_check_stateChanged(int state)
+{
+    if (state!=Qt::Checked)
+    {   //the running loop stops after the current sequence
+        return;
+    }
+    if (!_video_input.isRunning() || mCamera)
+    {
+        QMessageBox::critical(this, "Error", "Live 3D requires a video camera");
+        live_check->setChecked(false);
+        return;
+    }
+    if (!APP->calib.is_valid() || APP->model.rowCount()<1)
+    {   //the calibrated projector resolution comes from the current sets
+        QMessageBox::critical(this, "Error", "Live 3D requires a calibration and the calibration sets");
+        live_check->setChecked(false);
+        return;
+    }
+
+    //disable GUI interaction, except the live checkbox
+    test_check->setEnabled(false);
+    capture_button->setEnabled(false);
+    close_cancel_button->setEnabled(false);
+    screen_combo->setEnabled(false);
+    camera_combo->setEnabled(false);
+
+    _wait_time = camera_exposure_spin->value();
+    connect(&_projector, SIGNAL(new_image(QPixmap)), this, SLOT(_on_new_projector_image(QPixmap)));
+
+    //short sequence: white, black, and one image per column bit
+    _projector.set_pattern_count(live_bits_spin->value());
+    _projector.set_phase_shift(0, 0);
+    _projector.set_inverted_patterns(false);
+    _projector.set_columns_only(true);
+    _projector.start();
+    int projector_width = _projector.get_effective_width();
+
+    //downsample the camera to about VGA
+    _live_levels = 0;
+    for (int width=APP->get_camera_width(0); width>800; width/=2)
+    {
+        _live_levels++;
+    }
+
+    APP->mainWin.show_3dview();
+    _live = true;
+    while (live_check->isChecked())
+    {
+        QTime timer;
+        timer.start();
+
+        _live_frames.clear();
+        _projector.reset();
+        while (!_projector.finished() && live_check->isChecked())
+        {
+            _projector.next();
+
+            //wait for projector
+            while (!_projector.is_updated())
+            {   
+                QApplication::processEvents();
+            }
+
+            //capture
+            _capture = true;
+            while (_capture)
+            {
+                QApplication::processEvents();
+            }
+
+            //pause so the screen gets updated
+            wait(_wait_time);
+        }
+
+        if (static_cast<int>(_live_frames.size())==_projector.get_pattern_total())
+        {
+            int capture_time = timer.elapsed();
+            bool ok = APP->reconstruct_preview(_live_frames, _live_levels, projector_width, APP->preview_pointcloud);
+            APP->mainWin.glwidget->update();
+            set_current_message(QString("Live 3D: %1 points, capture %2 ms, reconstruction %3 ms")
+                                    .arg(ok ? APP->compact_pointcloud.size() : 0).arg(capture_time).arg(timer.elapsed()-capture_time));
+        }
+    }
+    _live = false;
+    _live_frames.clear();
+
+    //close projector
+    _projector.stop();
+    disconnect(&_projector, SIGNAL(new_image(QPixmap)), this, SLOT(_on_new_projector_image(QPixmap)));
+
+    //enable GUI interaction
+    test_check->setEnabled(true);
+    capture_button->setEnabled(true);
+    close_cancel_button->setEnabled(true);
+    screen_combo->setEnabled(true);
+    camera_combo->setEnabled(true);
+}
+
 void CaptureDialog::on_test_prev_button_clicked(bool checked)
 {
     _projector.clear_updated();
@@ -64,6 +64,11 @@ public:
     void stop_camera(void);
 
     static void wait(int msecs);
+    QList<double> get_hdr_exposures(void) const;
+
+    //one set in session, the turntable captures one set per angle as session_NN
+    bool capture_set(QString const& session, QList<double> const& exposures);
+    bool capture_turntable(QString const& session);
     
     void browserDidAddCamera(CameraRef camera);
     void browserDidRemoveCamera(CameraRef camera);
@@ -86,12 +91,20 @@ public slots:
     void on_test_check_stateChanged(int state);
     void on_test_prev_button_clicked(bool checked = false);
     void on_test_next_button_clicked(bool checked = false);
+    void on_live_check_stateChanged(int state);
+    void _on_turntable_set_finished(int index, unsigned points);
 
 private:
     ProjectorWidget _projector;
     VideoInput _video_input;
     volatile bool _capture;
+    volatile bool _live;
+    std::vector<cv::Mat> _live_frames;
+    int _live_levels;
+    volatile bool _turntable;
+    std::vector<cv::Mat> _turntable_frames;
     QString _session;
+    QString _capture_dir;
     int _wait_time;
     unsigned _total;
     bool _cancel;
@@ -102,31 +102,30 @@ void GLWidget::paintGL()
   // draw the scene:
   glClear(GL_COLOR_BUFFER_BIT);
 
-  scan3d::Pointcloud const& pointcloud = APP->pointcloud;
+  scan3d::CompactPointcloud const& pointcloud = APP->compact_pointcloud;
 
-  if (!pointcloud.points.data || !pointcloud.colors.data)
+  if (pointcloud.empty())
   {   //empty pointcloud
       return;
   }
 
-  //draw
-  glBegin(GL_POINTS);
-  for (int h=0; h<pointcloud.points.rows; ++h)
+  //draw the valid points straight from the arrays
+  bool colors = (pointcloud.colors.size()==pointcloud.size());
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glVertexPointer(3, GL_FLOAT, 0, &pointcloud.points[0]);
+  if (colors)
   {
-    const cv::Vec3f * point_row = pointcloud.points.ptr<cv::Vec3f>(h);
-    const cv::Vec3b * color_row = pointcloud.colors.ptr<cv::Vec3b>(h);
-    for (int w=0; w<pointcloud.points.cols; ++w)
-    {
-      cv::Vec3f const& pt = point_row[w];
-      cv::Vec3b const& color = color_row[w];
-      if (sl::INVALID(pt))
-      {
-          continue;
-      }
-
-      glColor3f(color[2]/255.f, color[1]/255.f, color[0]/255.f);
-      glVertex3f(pt[0], pt[1], pt[2]);
-    }
+    glEnableClientState(GL_COLOR_ARRAY);
+    glColorPointer(3, GL_UNSIGNED_BYTE, 0, &pointcloud.colors[0]);
   }
-  glEnd();
+  else
+  {
+    glColor3f(1.f, 1.f, 1.f);
+  }
+  glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(pointcloud.size()));
+  if (colors)
+  {
+    glDisableClientState(GL_COLOR_ARRAY);
+  }
+  glDisableClientState(GL_VERTEX_ARRAY);
 }
@@ -0,0 +1,271 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+#include "ImageCache.hpp"
+
+#include <QFileInfo>
+#include <QMutexLocker>
+
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "io_util.hpp"
+#include "instrument.hpp"
+
+ImageCache::ImageCache(size_t budget) :
+    _budget(budget),
+    _used(0),
+    _entries(),
+    _index(),
+    _sizes(),
+    _mutex()
+{
+}
+
+ImageCache::~ImageCache()
+{
+}
+
+void ImageCache::set_budget(size_t bytes)
+{
+    QMutexLocker locker(&_mutex);
+    _budget = bytes;
+    shrink();
+}
+
+size_t ImageCache::used(void) const
+{
+    QMutexLocker locker(&_mutex);
+    return _used;
+}
+
+cv::Mat ImageCache::get_color(const QString & filename)
+{
+    QFileInfo info(filename);
+    if (!info.exists())
+    {
+        return cv::Mat();
+    }
+    QString key = filename + "|color";
+
+    cv::Mat image;
+    if (lookup(key, info.lastModified(), info.size(), image))
+    {   //hit
+        instrument::count("image_cache_hits", 1);
+        return image;
+    }
+
+    //decode without holding the lock
+    {
+        instrument::ScopedTimer timer("image_load");
+        image = cv::imread(filename.toStdString());
+    }
+    if (image.rows>0 && image.cols>0)
+    {
+        instrument::count("bytes_read", info.size());
+        instrument::count("images_loaded", 1);
+        insert(key, info.lastModified(), info.size(), image);
+        return image;
+    }
+    return cv::Mat();
+}
+
+cv::Mat ImageCache::get_gray(const QString & filename)
+{
+    QFileInfo info(filename);
+    if (!info.exists())
+    {
+        return cv::Mat();
+    }
+    QString key = filename + "|gray";
+
+    cv::Mat gray_image;
+    if (lookup(key, info.lastModified(), info.size(), gray_image))
+    {   //hit
+        instrument::count("image_cache_hits", 1);
+        return gray_image;
+    }
+
+    //convert the cached color image if any, decode otherwise
+    cv::Mat rgb_image;
+    if (!lookup(filename + "|color", info.lastModified(), info.size(), rgb_image))
+    {
+        instrument::ScopedTimer timer("image_load");
+        rgb_image = cv::imread(filename.toStdString());
+        instrument::count("bytes_read", info.size());
+        instrument::count("images_loaded", 1);
+    }
+    if (rgb_image.rows>0 && rgb_image.cols>0)
+    {
+        instrument::ScopedTimer timer("gray_image");
+        cvtColor(rgb_image, gray_image, CV_BGR2GRAY);
+        insert(key, info.lastModified(), info.size(), gray_image);
+        return gray_image;
+    }
+    return cv::Mat();
+}
+
+bool ImageCache::get_size(const QString & filename, cv::Size & size, int * channels, int * bit_depth)
+{
+    QFileInfo info(filename);
+    if (!info.exists())
+    {
+        return false;
+    }
+
+    SizeEntry entry;
+    bool found = false;
+    {
+        QMutexLocker locker(&_mutex);
+        QHash<QString, SizeEntry>::const_iterator iter = _sizes.constFind(filename);
+        if (iter!=_sizes.constEnd() && iter->modified==info.lastModified() && iter->file_size==info.size())
+        {
+            entry = *iter;
+            found = true;
+        }
+    }
+
+    if (!found)
+    {
+        if (!io_util::read_image_size(filename.toStdString(), entry.size, &entry.channels, &entry.bit_depth))
+        {   //unknown header: decode it
+            cv::Mat image = get_color(filename);
+            if (!image.data)
+            {
+                return false;
+            }
+            entry.size = image.size();
+            entry.channels = image.channels();
+            entry.bit_depth = 8;
+        }
+        entry.modified = info.lastModified();
+        entry.file_size = info.size();
+
+        QMutexLocker locker(&_mutex);
+        _sizes.insert(filename, entry);
+    }
+
+    size = entry.size;
+    if (channels)
+    {
+        *channels = entry.channels;
+    }
+    if (bit_depth)
+    {
+        *bit_depth = entry.bit_depth;
+    }
+    return true;
+}
+
+void ImageCache::remove(const QString & filename)
+{
+    QMutexLocker locker(&_mutex);
+    erase(filename + "|color");
+    erase(filename + "|gray");
+    _sizes.remove(filename);
+}
+
+void ImageCache::clear(void)
+{
+    QMutexLocker locker(&_mutex);
+    _entries.clear();
+    _index.clear();
+    _sizes.clear();
+    _used = 0;
+}
+
+bool ImageCache::lookup(const QString & key, const QDateTime & modified, qint64 file_size, cv::Mat & image)
+{
+    QMutexLocker locker(&_mutex);
+
+    QHash<QString, EntryList::iterator>::iterator iter = _index.find(key);
+    if (iter==_index.end())
+    {   //miss
+        return false;
+    }
+
+    EntryList::iterator entry = iter.value();
+    if (entry->modified!=modified || entry->file_size!=file_size)
+    {   //file changed on disk
+        erase(key);
+        return false;
+    }
+
+    //move to front
+    _entries.splice(_entries.begin(), _entries, entry);
+    image = entry->image;
+    return true;
+}
+
+void ImageCache::insert(const QString & key, const QDateTime & modified, qint64 file_size, const cv::Mat & image)
+{
+    size_t bytes = image.total()*image.elemSize();
+
+    QMutexLocker locker(&_mutex);
+    erase(key);
+
+    if (bytes>_budget)
+    {   //does not fit
+        return;
+    }
+
+    Entry entry;
+    entry.key = key;
+    entry.image = image;
+    entry.bytes = bytes;
+    entry.modified = modified;
+    entry.file_size = file_size;
+    _entries.push_front(entry);
+    _index.insert(key, _entries.begin());
+    _used += bytes;
+
+    shrink();
+}
+
+void ImageCache::erase(const QString & key)
+{   //mutex must be locked
+    QHash<QString, EntryList::iterator>::iterator iter = _index.find(key);
+    if (iter!=_index.end())
+    {
+        _used -= iter.value()->bytes;
+        _entries.erase(iter.value());
+        _index.erase(iter);
+    }
+}
+
+void ImageCache::shrink(void)
+{   //mutex must be locked
+    while (_used>_budget && !_entries.empty())
+    {
+        const Entry & entry = _entries.back();
+        _used -= entry.bytes;
+        _index.remove(entry.key);
+        _entries.pop_back();
+    }
+}
@@ -0,0 +1,97 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __IMAGECACHE_HPP__
+#define __IMAGECACHE_HPP__
+
+#include <QString>
+#include <QHash>
+#include <QDateTime>
+#include <QMutex>
+
+#include <list>
+
+#include <opencv2/core/core.hpp>
+
+//Memoizes decoded images with a least-recently-used byte budget.
+//Entries are keyed by filename and variant, and dropped when the file changes on disk.
+//All members are safe to call from worker threads.
+class ImageCache
+{
+public:
+    ImageCache(size_t budget = 0);
+    ~ImageCache();
+
+    void set_budget(size_t bytes);
+    inline size_t budget(void) const {return _budget;}
+    size_t used(void) const;
+
+    //returned images are shared with the cache: clone before modifying them
+    cv::Mat get_color(const QString & filename);
+    cv::Mat get_gray(const QString & filename);
+
+    //image size from the file header, without decoding
+    bool get_size(const QString & filename, cv::Size & size, int * channels = NULL, int * bit_depth = NULL);
+
+    void remove(const QString & filename);
+    void clear(void);
+
+private:
+    struct Entry
+    {
+        QString   key;
+        cv::Mat   image;
+        size_t    bytes;
+        QDateTime modified;
+        qint64    file_size;
+    };
+    struct SizeEntry
+    {
+        cv::Size  size;
+        int       channels;
+        int       bit_depth;
+        QDateTime modified;
+        qint64    file_size;
+    };
+    typedef std::list<Entry> EntryList;
+
+    bool lookup(const QString & key, const QDateTime & modified, qint64 file_size, cv::Mat & image);
+    void insert(const QString & key, const QDateTime & modified, qint64 file_size, const cv::Mat & image);
+    void erase(const QString & key);
+    void shrink(void);
+
+private:
+    size_t _budget;
+    size_t _used;
+    EntryList _entries;                         //most recently used first
+    QHash<QString, EntryList::iterator> _index;
+    QHash<QString, SizeEntry> _sizes;
+    mutable QMutex _mutex;
+};
+
+#endif //__IMAGECACHE_HPP__
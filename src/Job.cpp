@@ -0,0 +1,143 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+#include "Job.hpp"
+
+#include <QThreadPool>
+#include <QMutexLocker>
+
+JobProgress::JobProgress() :
+    _total(0),
+    _value(0),
+    _canceled(0),
+    _label(),
+    _messages(),
+    _mutex()
+{
+}
+
+void JobProgress::set_total(int total)
+{
+    _total.fetchAndStoreOrdered(total);
+}
+
+void JobProgress::set_value(int value)
+{
+    _value.fetchAndStoreOrdered(value);
+}
+
+int JobProgress::total(void) const
+{
+    return _total.fetchAndAddOrdered(0);
+}
+
+int JobProgress::value(void) const
+{
+    return _value.fetchAndAddOrdered(0);
+}
+
+void JobProgress::set_label(const QString & text)
+{
+    QMutexLocker locker(&_mutex);
+    _label = text;
+}
+
+QString JobProgress::label(void) const
+{
+    QMutexLocker locker(&_mutex);
+    return _label;
+}
+
+void JobProgress::message(const QString & text)
+{
+    QMutexLocker locker(&_mutex);
+    _messages.append(text);
+}
+
+QStringList JobProgress::take_messages(void)
+{
+    QMutexLocker locker(&_mutex);
+    QStringList messages = _messages;
+    _messages.clear();
+    return messages;
+}
+
+void JobProgress::cancel(void)
+{
+    _canceled.fetchAndStoreOrdered(1);
+}
+
+bool JobProgress::canceled(void) const
+{
+    return (_canceled.fetchAndAddOrdered(0)!=0);
+}
+
+Job::Job() :
+    _progress(),
+    _finished(0),
+    _result(false),
+    _mutex(),
+    _done()
+{
+    setAutoDelete(false);
+}
+
+Job::~Job()
+{
+}
+
+void Job::start(void)
+{
+    QThreadPool::globalInstance()->start(this);
+}
+
+bool Job::wait(unsigned long msecs)
+{
+    QMutexLocker locker(&_mutex);
+    if (!finished())
+    {
+        _done.wait(&_mutex, msecs);
+    }
+    return finished();
+}
+
+bool Job::finished(void) const
+{
+    return (_finished.fetchAndAddOrdered(0)!=0);
+}
+
+void Job::run()
+{
+    bool rv = execute(_progress);
+
+    QMutexLocker locker(&_mutex);
+    _result = rv;
+    _finished.fetchAndStoreOrdered(1);
+    _done.wakeAll();
+}
@@ -0,0 +1,99 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __JOB_HPP__
+#define __JOB_HPP__
+
+#include <QRunnable>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QString>
+#include <QStringList>
+
+//Progress and cancellation shared by a worker and the thread polling it.
+//Counters are atomic, the label and messages are locked: all members are safe to call from any thread.
+class JobProgress
+{
+public:
+    JobProgress();
+
+    void set_total(int total);
+    void set_value(int value);
+    int total(void) const;
+    int value(void) const;
+
+    void set_label(const QString & text);
+    QString label(void) const;
+
+    //queued until the polling thread takes them
+    void message(const QString & text);
+    QStringList take_messages(void);
+
+    //cooperative: the worker checks canceled() between steps and returns early
+    void cancel(void);
+    bool canceled(void) const;
+
+private:
+    mutable QAtomicInt _total;
+    mutable QAtomicInt _value;
+    mutable QAtomicInt _canceled;
+    QString _label;
+    QStringList _messages;
+    mutable QMutex _mutex;
+};
+
+//Runs execute() in the global thread pool without touching the UI: the owner 
+//starts it, polls progress() until wait() returns true, then reads result().
+//The job is not deleted by the pool and must outlive its run.
+class Job : public QRunnable
+{
+public:
+    Job();
+    virtual ~Job();
+
+    void start(void);
+    bool wait(unsigned long msecs);     //true when finished
+    bool finished(void) const;
+    inline bool result(void) const {return _result;}
+    inline JobProgress & progress(void) {return _progress;}
+
+protected:
+    virtual bool execute(JobProgress & progress) = 0;
+
+private:
+    virtual void run();
+
+    JobProgress _progress;
+    mutable QAtomicInt _finished;
+    bool _result;
+    QMutex _mutex;
+    QWaitCondition _done;
+};
+
+#endif //__JOB_HPP__
@@ -46,6 +46,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "Application.hpp"
 #include "io_util.hpp"
+#include "homography.hpp"
 
 #include "AboutDialog.hpp"
 #include "CaptureDialog.hpp"
@@ -81,6 +82,33 @@ MainWindow::MainWindow(QWidget * parent, Qt::WindowFlags flags):
     m_spin->blockSignals(false);
     m_spin->setValue(config.value(ROBUST_M_CONFIG, ROBUST_M_DEFAULT).toUInt());
 
+    min_confidence_line->blockSignals(true);
+    min_confidence_line->setValidator(new QDoubleValidator(0.0, 1.0, 3, this));
+    min_confidence_line->setText(config.value(MIN_CONFIDENCE_CONFIG, MIN_CONFIDENCE_DEFAULT).toString());
+    min_confidence_line->blockSignals(false);
+
+    repair_check->blockSignals(true);
+    repair_check->setChecked(config.value(REPAIR_BITS_CONFIG, REPAIR_BITS_DEFAULT).toBool());
+    repair_check->blockSignals(false);
+
+    band_rows_spin->blockSignals(true);
+    band_rows_spin->setRange(0, 65535);
+    band_rows_spin->setValue(config.value(BAND_ROWS_CONFIG, BAND_ROWS_DEFAULT).toInt());
+    band_rows_spin->blockSignals(false);
+
+    skip_shadows_check->blockSignals(true);
+    skip_shadows_check->setChecked(config.value(SKIP_SHADOWS_CONFIG, SKIP_SHADOWS_DEFAULT).toBool());
+    skip_shadows_check->blockSignals(false);
+
+    roi_combo->blockSignals(true);
+    roi_combo->setCurrentIndex(config.value(ROI_MODE_CONFIG, ROI_MODE_DEFAULT).toInt());
+    roi_combo->blockSignals(false);
+
+    roi_line->blockSignals(true);
+    roi_line->setText(config.value(ROI_CONFIG, ROI_DEFAULT).toString());
+    roi_line->setEnabled(roi_combo->currentIndex()==2);
+    roi_line->blockSignals(false);
+
     corner_count_x_spin->blockSignals(true);
     corner_count_x_spin->setRange(1, 255);
     corner_count_x_spin->blockSignals(false);
@@ -106,6 +134,10 @@ MainWindow::MainWindow(QWidget * parent, Qt::WindowFlags flags):
     homography_window_spin->setValue(config.value(HOMOGRAPHY_WINDOW_CONFIG, HOMOGRAPHY_WINDOW_DEFAULT).toUInt());
     homography_window_spin->blockSignals(false);
 
+    homography_lsq_check->blockSignals(true);
+    homography_lsq_check->setChecked(config.value(HOMOGRAPHY_METHOD_CONFIG, HOMOGRAPHY_METHOD_DEFAULT).toInt()==homography::LeastSquaresMethod);
+    homography_lsq_check->blockSignals(false);
+
     display_original_radio->blockSignals(true);
     display_original_radio->setChecked(true);
     display_original_radio->blockSignals(false);
@@ -119,6 +151,11 @@ MainWindow::MainWindow(QWidget * parent, Qt::WindowFlags flags):
     normals_check->setChecked(config.value(SAVE_NORMALS_CONFIG, SAVE_NORMALS_DEFAULT).toBool());
     normals_check->blockSignals(false);
 
+    normals_window_spin->blockSignals(true);
+    normals_window_spin->setRange(0, 64);
+    normals_window_spin->setValue(config.value(NORMALS_WINDOW_CONFIG, NORMALS_WINDOW_DEFAULT).toInt());
+    normals_window_spin->blockSignals(false);
+
     colors_check->blockSignals(true);
     colors_check->setChecked(config.value(SAVE_COLORS_CONFIG, SAVE_COLORS_DEFAULT).toBool());
     colors_check->blockSignals(false);
@@ -127,6 +164,50 @@ MainWindow::MainWindow(QWidget * parent, Qt::WindowFlags flags):
     binary_file_check->setChecked(config.value(SAVE_BINARY_CONFIG, SAVE_BINARY_DEFAULT).toBool());
     binary_file_check->blockSignals(false);
 
+    mesh_check->blockSignals(true);
+    mesh_check->setChecked(config.value(SAVE_MESH_CONFIG, SAVE_MESH_DEFAULT).toBool());
+    mesh_check->blockSignals(false);
+
+    mesh_max_edge_line->blockSignals(true);
+    mesh_max_edge_line->setValidator(new QDoubleValidator(this));
+    mesh_max_edge_line->setText(config.value(MESH_MAX_EDGE_CONFIG, MESH_MAX_EDGE_DEFAULT).toString());
+    mesh_max_edge_line->blockSignals(false);
+
+    stream_check->blockSignals(true);
+    stream_check->setChecked(config.value(STREAM_PLY_CONFIG, STREAM_PLY_DEFAULT).toBool());
+    stream_check->blockSignals(false);
+    ray_plane_check->blockSignals(true);
+    ray_plane_check->setChecked(config.value(RAY_PLANE_CONFIG, RAY_PLANE_DEFAULT).toBool());
+    ray_plane_check->blockSignals(false);
+
+    outlier_combo->blockSignals(true);
+    outlier_combo->setCurrentIndex(config.value(OUTLIER_METHOD_CONFIG, OUTLIER_METHOD_DEFAULT).toInt());
+    outlier_combo->blockSignals(false);
+
+    outlier_param_line->blockSignals(true);
+    outlier_param_line->setValidator(new QDoubleValidator(this));
+    outlier_param_line->blockSignals(false);
+    update_outlier_param();
+
+    downsample_check->blockSignals(true);
+    downsample_check->setChecked(config.value(DOWNSAMPLE_CONFIG, DOWNSAMPLE_DEFAULT).toBool());
+    downsample_check->blockSignals(false);
+
+    downsample_leaf_line->blockSignals(true);
+    downsample_leaf_line->setValidator(new QDoubleValidator(this));
+    downsample_leaf_line->setText(config.value(DOWNSAMPLE_LEAF_CONFIG, DOWNSAMPLE_LEAF_DEFAULT).toString());
+    downsample_leaf_line->blockSignals(false);
+
+    icp_max_dist_line->blockSignals(true);
+    icp_max_dist_line->setValidator(new QDoubleValidator(this));
+    icp_max_dist_line->setText(config.value(ICP_MAX_DIST_CONFIG, ICP_MAX_DIST_DEFAULT).toString());
+    icp_max_dist_line->blockSignals(false);
+
+    merge_voxel_line->blockSignals(true);
+    merge_voxel_line->setValidator(new QDoubleValidator(this));
+    merge_voxel_line->setText(config.value(MERGE_VOXEL_CONFIG, MERGE_VOXEL_DEFAULT).toString());
+    merge_voxel_line->blockSignals(false);
+
     image2_label->setVisible(false);
     glwidget->setVisible(false);
     display_3dview_radio->setEnabled(false);
@@ -324,11 +405,47 @@ void MainWindow::on_m_spin_valueChanged(int i)
     APP->config.setValue(ROBUST_M_CONFIG, i);
 }
 
+void MainWindow::on_min_confidence_line_editingFinished()
+{
+    APP->config.setValue(MIN_CONFIDENCE_CONFIG, min_confidence_line->text().toDouble());
+}
+
+void MainWindow::on_repair_check_stateChanged(int state)
+{
+    APP->config.setValue(REPAIR_BITS_CONFIG, (state==Qt::Checked));
+}
+
+void MainWindow::on_band_rows_spin_valueChanged(int i)
+{
+    APP->config.setValue(BAND_ROWS_CONFIG, i);
+}
+
+void MainWindow::on_skip_shadows_check_stateChanged(int state)
+{
+    APP->config.setValue(SKIP_SHADOWS_CONFIG, (state==Qt::Checked));
+}
+
+void MainWindow::on_roi_combo_currentIndexChanged(int index)
+{
+    APP->config.setValue(ROI_MODE_CONFIG, index);
+    roi_line->setEnabled(index==2);
+}
+
+void MainWindow::on_roi_line_editingFinished()
+{
+    APP->config.setValue(ROI_CONFIG, roi_line->text().simplified());
+}
+
 void MainWindow::on_homography_window_spin_valueChanged(int i)
 {
   APP->config.setValue(HOMOGRAPHY_WINDOW_CONFIG, i);
 }
 
+void MainWindow::on_homography_lsq_check_stateChanged(int state)
+{
+    APP->config.setValue(HOMOGRAPHY_METHOD_CONFIG, (state==Qt::Checked ? homography::LeastSquaresMethod : homography::RansacMethod));
+}
+
 void  MainWindow::on_max_dist_line_editingFinished()
 {
     APP->config.setValue(MAX_DIST_CONFIG, max_dist_line->text().toDouble());
@@ -339,6 +456,11 @@ void MainWindow::on_normals_check_stateChanged(int state)
     APP->config.setValue(SAVE_NORMALS_CONFIG, (state==Qt::Checked));
 }
 
+void MainWindow::on_normals_window_spin_valueChanged(int i)
+{
+    APP->config.setValue(NORMALS_WINDOW_CONFIG, i);
+}
+
 void MainWindow::on_colors_check_stateChanged(int state)
 {
     APP->config.setValue(SAVE_COLORS_CONFIG, (state==Qt::Checked));
@@ -349,6 +471,83 @@ void MainWindow::on_binary_file_check_stateChanged(int state)
     APP->config.setValue(SAVE_BINARY_CONFIG, (state==Qt::Checked));
 }
 
+void MainWindow::on_mesh_check_stateChanged(int state)
+{
+    APP->config.setValue(SAVE_MESH_CONFIG, (state==Qt::Checked));
+}
+
+void MainWindow::on_mesh_max_edge_line_editingFinished()
+{
+    APP->config.setValue(MESH_MAX_EDGE_CONFIG, mesh_max_edge_line->text().toDouble());
+}
+
+void MainWindow::on_stream_check_stateChanged(int state)
+{
+    APP->config.setValue(STREAM_PLY_CONFIG, (state==Qt::Checked));
+}
+
+void MainWindow::on_ray_plane_check_stateChanged(int state)
+{
+    APP->config.setValue(RAY_PLANE_CONFIG, (state==Qt::Checked));
+}
+
+void MainWindow::on_outlier_combo_currentIndexChanged(int index)
+{
+    APP->config.setValue(OUTLIER_METHOD_CONFIG, index);
+    update_outlier_param();
+}
+
+void MainWindow::on_outlier_param_line_editingFinished()
+{
+    int method = outlier_combo->currentIndex();
+    if (method==scan3d::StatisticalOutliers)
+    {
+        APP->config.setValue(OUTLIER_STD_RATIO_CONFIG, outlier_param_line->text().toDouble());
+    }
+    else if (method==scan3d::RadiusOutliers)
+    {
+        APP->config.setValue(OUTLIER_RADIUS_CONFIG, outlier_param_line->text().toDouble());
+    }
+}
+
+void MainWindow::update_outlier_param(void)
+{   //the line edits the parameter of the selected method
+    QSettings & config = APP->config;
+    int method = outlier_combo->currentIndex();
+
+    outlier_param_line->blockSignals(true);
+    if (method==scan3d::StatisticalOutliers)
+    {
+        outlier_param_line->setText(config.value(OUTLIER_STD_RATIO_CONFIG, OUTLIER_STD_RATIO_DEFAULT).toString());
+    }
+    else if (method==scan3d::RadiusOutliers)
+    {
+        outlier_param_line->setText(config.value(OUTLIER_RADIUS_CONFIG, OUTLIER_RADIUS_DEFAULT).toString());
+    }
+    outlier_param_line->setEnabled(method!=scan3d::NoOutliers);
+    outlier_param_line->blockSignals(false);
+}
+
+void MainWindow::on_downsample_check_stateChanged(int state)
+{
+    APP->config.setValue(DOWNSAMPLE_CONFIG, (state==Qt::Checked));
+}
+
+void MainWindow::on_downsample_leaf_line_editingFinished()
+{
+    APP->config.setValue(DOWNSAMPLE_LEAF_CONFIG, downsample_leaf_line->text().toDouble());
+}
+
+void MainWindow::on_icp_max_dist_line_editingFinished()
+{
+    APP->config.setValue(ICP_MAX_DIST_CONFIG, icp_max_dist_line->text().toDouble());
+}
+
+void MainWindow::on_merge_voxel_line_editingFinished()
+{
+    APP->config.setValue(MERGE_VOXEL_CONFIG, merge_voxel_line->text().toDouble());
+}
+
 void MainWindow::on_quit_action_triggered(bool checked)
 {
     close();
@@ -456,6 +655,13 @@ void MainWindow::on_display_3dview_radio_clicked(bool checked)
     }
 }
 
+void MainWindow::show_3dview(void)
+{
+    display_3dview_radio->setChecked(true);
+    on_display_3dview_radio_clicked(true);
+    glwidget->update();
+}
+
 void MainWindow::on_about_action_triggered(bool checked)
 {
     AboutDialog dialog(this, Qt::WindowCloseButtonHint);
@@ -581,11 +787,45 @@ void MainWindow::on_reconstruct_button_clicked(bool checked)
     }
 
     show_message("Reconstruction...");
+    InstrumentRun run("reconstruct");
 
     //parameters
     bool normals = APP->config.value(SAVE_NORMALS_CONFIG, SAVE_NORMALS_DEFAULT).toBool();
     bool colors = APP->config.value(SAVE_COLORS_CONFIG, SAVE_COLORS_DEFAULT).toBool();
     bool binary = APP->config.value(SAVE_BINARY_CONFIG, SAVE_BINARY_DEFAULT).toBool();
+    bool mesh = APP->config.value(SAVE_MESH_CONFIG, SAVE_MESH_DEFAULT).toBool();
+    bool stream = APP->config.value(STREAM_PLY_CONFIG, STREAM_PLY_DEFAULT).toBool();
+    bool outliers = (APP->config.value(OUTLIER_METHOD_CONFIG, OUTLIER_METHOD_DEFAULT).toInt()!=scan3d::NoOutliers);
+    bool downsample = APP->config.value(DOWNSAMPLE_CONFIG, DOWNSAMPLE_DEFAULT).toBool();
+
+    if (stream)
+    {   //the file is written during the reconstruction
+        QString name = APP->get_root_dir()+"/"+APP->model.data(APP->model.index(row, 0), Qt::DisplayRole).toString();
+        QString filename = QFileDialog::getSaveFileName(this, "Save pointcloud", name+".ply", "Pointclouds (*.ply)");
+        if (filename.isEmpty())
+        {
+            show_message("Reconstruction canceled");
+            return;
+        }
+
+        unsigned ply_flags = io_util::PlyPoints
+                            | (colors?io_util::PlyColors:0)
+                            | (normals?io_util::PlyNormals:0)
+                            | (binary?io_util::PlyBinary:0);
+
+        APP->pointcloud.clear();
+        APP->compact_pointcloud.clear();
+        if (APP->reconstruct_model_stream(row, filename, ply_flags, this))
+        {
+            show_message(QString("Pointcloud saved: %1").arg(filename));
+            std::cout << QString("Pointcloud saved: %1").arg(filename).toStdString() << std::endl;
+        }
+        else
+        {
+            show_message("Reconstruction failed");
+        }
+        return;
+    }
 
     scan3d::Pointcloud & pointcloud = APP->pointcloud;
     APP->reconstruct_model(row, pointcloud, this);
@@ -595,6 +835,20 @@ void MainWindow::on_reconstruct_button_clicked(bool checked)
         return;
     }
 
+    //filter the grid before normals and mesh see it
+    if (outliers)
+    {
+        show_message("Removing outliers...");
+        QApplication::setOverrideCursor(QCursor(Qt::WaitCursor));
+        QApplication::processEvents();
+
+        size_t removed = APP->remove_outliers(pointcloud);
+        show_message(QString("Outliers removed: %1").arg(removed));
+
+        QApplication::restoreOverrideCursor();
+        QApplication::processEvents();
+    }
+
     //compute normals
     if (normals)
     {
@@ -610,6 +864,37 @@ void MainWindow::on_reconstruct_button_clicked(bool checked)
         QApplication::processEvents();
     }
 
+    //triangulate the full resolution grid, downsampling moves the faces to the kept points
+    if (mesh)
+    {
+        show_message("Computing mesh...");
+        QApplication::setOverrideCursor(QCursor(Qt::WaitCursor));
+        QApplication::processEvents();
+
+        APP->compute_mesh(pointcloud);
+
+        QApplication::restoreOverrideCursor();
+        QApplication::processEvents();
+    }
+
+    //after the normals and the mesh, so that they come from the full resolution grid
+    if (downsample)
+    {
+        show_message("Downsampling...");
+        QApplication::setOverrideCursor(QCursor(Qt::WaitCursor));
+        QApplication::processEvents();
+
+        size_t remaining = APP->downsample(pointcloud);
+        show_message(QString("Downsampled points: %1").arg(remaining));
+
+        QApplication::restoreOverrideCursor();
+        QApplication::processEvents();
+    }
+
+    //valid points only, for display and export
+    APP->compact_pointcloud.from_pointcloud(pointcloud);
+    glwidget->update();
+
     //save the points
     QString name = APP->get_root_dir()+"/"+APP->model.data(APP->model.index(row, 0), Qt::DisplayRole).toString();
     QString filename = QFileDialog::getSaveFileName(this, "Save pointcloud", name+".ply", "Pointclouds (*.ply)");
@@ -623,9 +908,17 @@ void MainWindow::on_reconstruct_button_clicked(bool checked)
         unsigned ply_flags = io_util::PlyPoints
                             | (colors?io_util::PlyColors:0)
                             | (normals?io_util::PlyNormals:0)
-                            | (binary?io_util::PlyBinary:0);
+                            | (binary?io_util::PlyBinary:0)
+                            | (mesh?io_util::PlyFaces:0);
 
-        io_util::write_ply(filename.toStdString(), pointcloud, ply_flags);
+        if (mesh)
+        {   //faces are indexed on the grid
+            io_util::write_ply(filename.toStdString(), pointcloud, ply_flags);
+        }
+        else
+        {
+            io_util::write_ply(filename.toStdString(), APP->compact_pointcloud, ply_flags);
+        }
 
         //restore regular cursor
         QApplication::restoreOverrideCursor();
@@ -635,6 +928,56 @@ void MainWindow::on_reconstruct_button_clicked(bool checked)
     }
 }
 
+void MainWindow::on_merge_button_clicked(bool checked)
+{
+    show_message("Merging scans...");
+
+    APP->processing_reset();
+    APP->processingDialog.setWindowTitle("Merge Scans");
+    APP->processingDialog.show();
+    QApplication::processEvents();
+
+    bool merged = APP->merge_scans();
+
+    APP->processingDialog.finish();
+    APP->processingDialog.exec();
+    APP->processingDialog.hide();
+    QApplication::processEvents();
+
+    if (!merged)
+    {
+        show_message("Merge failed");
+        return;
+    }
+    glwidget->update();
+
+    //save the merged points
+    QString filename = QFileDialog::getSaveFileName(this, "Save pointcloud", APP->get_root_dir()+"/merged.ply", "Pointclouds (*.ply)");
+    if (filename.isEmpty())
+    {
+        show_message("Ready");
+        return;
+    }
+
+    show_message(QString("Saving to %1...").arg(filename));
+    QApplication::setOverrideCursor(QCursor(Qt::WaitCursor));
+    QApplication::processEvents();
+
+    bool normals = APP->config.value(SAVE_NORMALS_CONFIG, SAVE_NORMALS_DEFAULT).toBool();
+    bool colors = APP->config.value(SAVE_COLORS_CONFIG, SAVE_COLORS_DEFAULT).toBool();
+    bool binary = APP->config.value(SAVE_BINARY_CONFIG, SAVE_BINARY_DEFAULT).toBool();
+    unsigned ply_flags = io_util::PlyPoints
+                        | (colors?io_util::PlyColors:0)
+                        | (normals?io_util::PlyNormals:0)
+                        | (binary?io_util::PlyBinary:0);
+    io_util::write_ply(filename.toStdString(), APP->compact_pointcloud, ply_flags);
+
+    QApplication::restoreOverrideCursor();
+    QApplication::processEvents();
+    show_message(QString("Pointcloud saved: %1").arg(filename));
+    std::cout << QString("Pointcloud saved: %1").arg(filename).toStdString() << std::endl;
+}
+
 int MainWindow::get_current_set(void)
 {
     QModelIndex index = image_tree->selectionModel()->currentIndex();
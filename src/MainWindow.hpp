@@ -41,6 +41,7 @@ public:
     ~MainWindow();
 
     void update_current_image(QModelIndex current = QModelIndex());
+    void show_3dview(void);
 
 public slots:
     //menu actions
@@ -62,6 +63,7 @@ public slots:
     void on_calibrate_button_clicked(bool checked = false);
     void on_capture_button_clicked(bool checked = false);
     void on_reconstruct_button_clicked(bool checked = false);
+    void on_merge_button_clicked(bool checked = false);
 
     //other
     void _on_image_tree_currentChanged(const QModelIndex & current, const QModelIndex & previous);
@@ -84,15 +86,33 @@ public slots:
     void on_threshold_spin_valueChanged(int i);
     void on_b_line_editingFinished();
     void on_m_spin_valueChanged(int i);
+    void on_min_confidence_line_editingFinished();
+    void on_repair_check_stateChanged(int state);
+    void on_band_rows_spin_valueChanged(int i);
+    void on_skip_shadows_check_stateChanged(int state);
+    void on_roi_combo_currentIndexChanged(int index);
+    void on_roi_line_editingFinished();
 
     //calibration group
     void on_homography_window_spin_valueChanged(int i);
+    void on_homography_lsq_check_stateChanged(int state);
 
     //reconstruction group
     void on_max_dist_line_editingFinished();
     void on_normals_check_stateChanged(int state);
+    void on_normals_window_spin_valueChanged(int i);
     void on_colors_check_stateChanged(int state);
     void on_binary_file_check_stateChanged(int state);
+    void on_mesh_check_stateChanged(int state);
+    void on_mesh_max_edge_line_editingFinished();
+    void on_stream_check_stateChanged(int state);
+    void on_ray_plane_check_stateChanged(int state);
+    void on_outlier_combo_currentIndexChanged(int index);
+    void on_outlier_param_line_editingFinished();
+    void on_downsample_check_stateChanged(int state);
+    void on_downsample_leaf_line_editingFinished();
+    void on_icp_max_dist_line_editingFinished();
+    void on_merge_voxel_line_editingFinished();
 
     //switch horizontal/vertical image display
     void _on_horizontal_layout_action_triggered(bool checked);
@@ -102,6 +122,7 @@ public slots:
 
 private:
     int get_current_set(void);
+    void update_outlier_param(void);
 };
 
 #endif  /* __MAINWINDOW_HPP__ */
\ No newline at end of file
@@ -35,6 +35,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <iostream>
 #include <assert.h>
+#include <math.h>
+#include <vector>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
 
 #include "structured_light.hpp"
 
@@ -45,6 +51,10 @@ ProjectorWidget::ProjectorWidget(QWidget * parent, Qt::WindowFlags flags) :
     _pattern_count(4),
     _vbits(1),
     _hbits(1),
+    _phase_steps(0),
+    _phase_period(16),
+    _inverted_patterns(true),
+    _columns_only(false),
     _updated(false)
 {
 }
@@ -128,7 +138,15 @@ void ProjectorWidget::next(void)
 
 bool ProjectorWidget::finished(void)
 {
-    return (_current_pattern+2 > 2+4*_pattern_count);
+    return (_current_pattern+2 > get_pattern_total());
+}
+
+int ProjectorWidget::get_pattern_total(void) const
+{
+    int per_bit = (_inverted_patterns ? 2 : 1);
+    int directions = (_columns_only ? 1 : 2);
+    int phase_count = (_phase_steps>2 ? directions*_phase_steps : 0);
+    return 2 + per_bit*directions*_pattern_count + phase_count;
 }
 
 void ProjectorWidget::paintEvent(QPaintEvent *)
@@ -216,24 +234,53 @@ void ProjectorWidget::make_pattern(void)
     // ..
     // YY =  (4*_pattern_count + 2) - 2 horizontal, bit N, normal
     // YY =  (4*_pattern_count + 2) - 1 horizontal, bit N, inverted
+    // -----------
+    // (optional) _phase_steps vertical sinusoidal fringes, shifted 2*pi/_phase_steps each
+    // (optional) _phase_steps horizontal sinusoidal fringes
+    //
+    // without inverted patterns each bit is a single 'normal' image (decoded against the mean 
+    // of white and black), with _columns_only the horizontal patterns and fringes are skipped
+
+    int per_bit = (_inverted_patterns ? 2 : 1);
+    int directions = (_columns_only ? 1 : 2);
+    int gray_count = 2 + per_bit*directions*_pattern_count;
 
     if (_current_pattern<2)
     {   //white or black
         _pixmap = make_pattern(rows, cols, vmask, voffset, hmask, hoffset, inverted);
     }
-    else if (_current_pattern<2*_pattern_count+2)
-    {   //vertical
-        int bit = _vbits - _current_pattern/2;
-        vmask = 1<<bit;
-        //std::cerr << "v# cp: " << _current_pattern << " bit:" << bit << " mask:" << vmask << std::endl;
-        _pixmap = make_pattern(rows, cols, vmask, voffset, hmask, hoffset, !inverted);
+    else if (_current_pattern<gray_count)
+    {   //gray code
+        int k = (_current_pattern-2)/per_bit;
+        bool normal = ((_current_pattern-2)%per_bit)==0;
+        if (k<_pattern_count)
+        {   //vertical
+            int bit = _vbits - 1 - k;
+            vmask = 1<<bit;
+        }
+        else
+        {   //horizontal
+            int bit = _hbits - 1 - (k - _pattern_count);
+            hmask = 1<<bit;
+        }
+        //std::cerr << "# cp: " << _current_pattern << " vmask:" << vmask << " hmask:" << hmask << std::endl;
+        _pixmap = make_pattern(rows, cols, vmask, voffset, hmask, hoffset, !normal);
     }
-    else if (_current_pattern<4*_pattern_count+2)
-    {   //horizontal
-        int bit = _hbits + _pattern_count - _current_pattern/2;
-        hmask = 1<<bit;
-        //std::cerr << "h# cp: " << _current_pattern << " bit:" << bit << " mask:" << hmask << std::endl;
-        _pixmap = make_pattern(rows, cols, vmask, voffset, hmask, hoffset, !inverted);
+    else if (_phase_steps>2 && _current_pattern<gray_count+directions*_phase_steps)
+    {   //phase shift
+        int k = _current_pattern - gray_count;
+        bool vertical = (k<_phase_steps);
+        int bits = (vertical ? _vbits : _hbits);
+        int size = (vertical ? cols : rows);
+        int offset = (vertical ? voffset : hoffset);
+
+        //fringes are laid in the decoded coordinates: the low bits not projected
+        // as gray code are dropped and the decoder offset is removed
+        int count = std::min(bits, _pattern_count);
+        double scale = 1.0/(1<<(bits-count));
+        double shift = offset*scale - ((1<<count) - effective_size(size, bits, _pattern_count))/2;
+        double delta = 2.0*M_PI*(k%_phase_steps)/_phase_steps;
+        _pixmap = make_phase_pattern(rows, cols, vertical, scale, shift, _phase_period, delta);
     }
     else
     {   //error
@@ -271,6 +318,47 @@ QPixmap ProjectorWidget::make_pattern(int rows, int cols, int vmask, int voffset
     return QPixmap::fromImage(image);
 }
 
+QPixmap ProjectorWidget::make_phase_pattern(int rows, int cols, bool vertical, double scale, double shift, double period, double delta)
+{
+    QImage image(cols, rows, QImage::Format_ARGB32);
+
+    //one period of intensity values along the fringe direction
+    int length = (vertical ? cols : rows);
+    std::vector<uchar> values(length);
+    for (int i=0; i<length; i++)
+    {
+        double x = i*scale + shift;
+        values[i] = static_cast<uchar>(127.5 + 127.5*cos(2.0*M_PI*x/period + delta) + 0.5);
+    }
+
+    for (int h=0; h<rows; h++)
+    {
+        uchar * row = image.scanLine(h);
+        for (int w=0; w<cols; w++)
+        {
+            uchar * px = row + (4*w);
+            int value = values[vertical ? w : h];
+
+            px[0] = value; //B
+            px[1] = value; //G
+            px[2] = value; //R
+            px[3] = 0xff;  //A
+        }
+    }
+
+    return QPixmap::fromImage(image);
+}
+
+int ProjectorWidget::effective_size(int size, int bits, int pattern_count)
+{
+    int max_value = (1<<std::min(bits, pattern_count));
+    while (size>max_value)
+    {
+        size >>= 1;
+    }
+    return size;
+}
+
 bool ProjectorWidget::save_info(QString const& filename) const
 {
     FILE * fp = fopen(qPrintable(filename), "w");
@@ -283,23 +371,27 @@ bool ProjectorWidget::save_info(QString const& filename) const
     int cols = width();
     int rows = height();
 
-    int effective_width = cols;
-    int effective_height = rows;
+    int effective_width = effective_size(cols, _vbits, _pattern_count);
+    int effective_height = effective_size(rows, _hbits, _pattern_count);
 
-    int max_vert_value = (1<<std::min(_vbits,_pattern_count));
-    while (effective_width>max_vert_value )
+    fprintf(fp, "%u %u\n", effective_width, effective_height);
+    if (_phase_steps>2)
     {
-        effective_width >>= 1;
+        fprintf(fp, "phase %u %u\n", _phase_steps, _phase_period);
     }
-    int max_horz_value = (1<<std::min(_hbits,_pattern_count));
-    while (effective_height>max_horz_value)
+    if (!_inverted_patterns)
     {
-        effective_height >>= 1;
+        fprintf(fp, "inverted 0\n");
+    }
+    if (_columns_only)
+    {
+        fprintf(fp, "columns 1\n");
     }
-
-    fprintf(fp, "%u %u\n", effective_width, effective_height);
 
     fprintf(fp, "\n# width height\n"); //help
+    fprintf(fp, "# phase steps period (optional)\n"); //help
+    fprintf(fp, "# inverted 0|1 (optional, default 1)\n"); //help
+    fprintf(fp, "# columns 0|1 (optional, default 0)\n"); //help
 
     std::cerr << "Saved projetor info: " << qPrintable(filename) << std::endl
               << " - Effective resolution: " << effective_width << "x" << effective_height << std::endl;
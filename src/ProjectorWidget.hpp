@@ -41,6 +41,12 @@ public:
     void reset(void);
     inline void set_screen(int screen) {_screen = screen;}
     inline void set_pattern_count(int count) {_pattern_count = count;}
+    inline void set_phase_shift(int steps, int period) {_phase_steps = steps; _phase_period = period;}
+    inline void set_inverted_patterns(bool enabled) {_inverted_patterns = enabled;}
+    inline void set_columns_only(bool enabled) {_columns_only = enabled;}
+    int get_pattern_total(void) const;
+    inline int get_effective_width(void) const {return effective_size(width(), _vbits, _pattern_count);}
+    inline int get_effective_height(void) const {return effective_size(height(), _hbits, _pattern_count);}
     inline int get_current_pattern(void) const {return _current_pattern;}
 
     //projection cycle
@@ -68,6 +74,8 @@ protected:
     void make_pattern(void);
     void update_pattern_bit_count(void);
     static QPixmap make_pattern(int rows, int cols, int vmask, int voffset, int hmask, int hoffset, int inverted);
+    static QPixmap make_phase_pattern(int rows, int cols, bool vertical, double scale, double shift, double period, double delta);
+    static int effective_size(int size, int bits, int pattern_count);
 
 private:
     int _screen;
@@ -76,6 +84,10 @@ private:
     int _pattern_count;
     int _vbits;
     int _hbits;
+    int _phase_steps;
+    int _phase_period;
+    bool _inverted_patterns;
+    bool _columns_only;
     volatile bool _updated;
 
 };
@@ -0,0 +1,328 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+#include "Turntable.hpp"
+
+#include <QMutexLocker>
+
+#include <iostream>
+#include <cmath>
+#ifndef _WIN32
+#   include <poll.h>
+#endif
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "structured_light.hpp"
+
+Turntable * Turntable::create(QString const& device)
+{
+    if (device.isEmpty())
+    {
+        return new SimulatedTurntable();
+    }
+    return new SerialTurntable(device);
+}
+
+SimulatedTurntable::SimulatedTurntable(double degrees_per_second) :
+    _angle(0.0),
+    _speed(degrees_per_second),
+    _duration(0),
+    _timer()
+{
+    _timer.start();
+}
+
+bool SimulatedTurntable::rotate_to(double angle)
+{
+    _duration = (_speed>0.0 ? static_cast<int>(1000.0*std::fabs(angle - _angle)/_speed) : 0);
+    _angle = angle;
+    _timer.restart();
+    return true;
+}
+
+bool SimulatedTurntable::is_moving(void)
+{
+    return (_timer.elapsed()<_duration);
+}
+
+SerialTurntable::SerialTurntable(QString const& device, int timeout) :
+    _port(device),
+    _moving(false),
+    _failed(false),
+    _timeout(timeout),
+    _timer()
+{
+}
+
+bool SerialTurntable::open(void)
+{
+    if (!_port.open(QIODevice::ReadWrite|QIODevice::Text|QIODevice::Unbuffered))
+    {
+        std::cerr << "Turntable: cannot open " << _port.fileName().toStdString() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void SerialTurntable::close(void)
+{
+    _port.close();
+    _moving = false;
+}
+
+bool SerialTurntable::reply_pending(void)
+{
+    if (_port.canReadLine() || _port.bytesAvailable()>0)
+    {
+        return true;
+    }
+#ifndef _WIN32
+    //QFile does not see the bytes waiting in a terminal device
+    struct pollfd fd;
+    fd.fd = _port.handle();
+    fd.events = POLLIN;
+    fd.revents = 0;
+    return (::poll(&fd, 1, 0)>0);
+#else
+    return false;
+#endif
+}
+
+bool SerialTurntable::rotate_to(double angle)
+{
+    QByteArray command = QString("ROTATE %1\n").arg(angle, 0, 'f', 3).toLatin1();
+    if (_port.write(command)!=command.size())
+    {
+        std::cerr << "Turntable: write failed" << std::endl;
+        return false;
+    }
+    _port.flush();
+    _moving = true;
+    _failed = false;
+    _timer.start();
+    return true;
+}
+
+bool SerialTurntable::is_moving(void)
+{
+    if (!_moving)
+    {
+        return false;
+    }
+
+    //the line is read only once the stage answered: the caller keeps polling meanwhile
+    if (!reply_pending())
+    {
+        if (_timer.elapsed()>_timeout)
+        {
+            std::cerr << "Turntable: no answer after " << _timeout << " ms" << std::endl;
+            _moving = false;
+            _failed = true;
+        }
+        return _moving;
+    }
+
+    QByteArray reply = _port.readLine().trimmed();
+    if (reply.isEmpty())
+    {   //closed or failed
+        std::cerr << "Turntable: no answer" << std::endl;
+        _moving = false;
+        _failed = true;
+    }
+    else if (reply.startsWith("OK"))
+    {
+        _moving = false;
+    }
+    else
+    {   //status lines while moving
+        std::cout << "Turntable: " << reply.constData() << std::endl;
+    }
+    return _moving;
+}
+
+TurntablePipeline::TurntablePipeline(Settings const& settings, QObject * parent) :
+    QThread(parent),
+    clouds(),
+    angles(),
+    _settings(settings),
+    _tables(),
+    _mutex(),
+    _condition(),
+    _queue(),
+    _count(0),
+    _finished(false)
+{
+}
+
+TurntablePipeline::~TurntablePipeline()
+{
+    finish();
+    wait();
+}
+
+void TurntablePipeline::enqueue(std::vector<cv::Mat> const& frames, double angle)
+{
+    QMutexLocker locker(&_mutex);
+    Job job;
+    job.frames = frames;
+    job.angle = angle;
+    job.index = _count++;
+    _queue.push_back(job);
+    _condition.wakeOne();
+}
+
+void TurntablePipeline::finish(void)
+{
+    QMutexLocker locker(&_mutex);
+    _finished = true;
+    _condition.wakeAll();
+}
+
+void TurntablePipeline::run()
+{
+    for (;;)
+    {
+        Job job;
+        {
+            QMutexLocker locker(&_mutex);
+            while (_queue.empty() && !_finished)
+            {
+                _condition.wait(&_mutex);
+            }
+            if (_queue.empty())
+            {   //finished
+                return;
+            }
+            job = _queue.front();
+            _queue.pop_front();
+        }
+
+        scan3d::CompactPointcloud cloud;
+        bool ok = process(job.frames, cloud) && !cloud.empty();
+        job.frames.clear();
+        if (ok)
+        {   //only this thread writes the results
+            clouds.push_back(cloud);
+            angles.push_back(job.angle);
+        }
+        emit set_finished(job.index, static_cast<unsigned>(ok ? cloud.size() : 0));
+    }
+}
+
+bool TurntablePipeline::process(std::vector<cv::Mat> const& frames, scan3d::CompactPointcloud & cloud)
+{
+    cloud.clear();
+
+    //decode: same image layout as the sets decoded from files
+    std::vector<cv::Mat> gray_frames(frames.size());
+    for (size_t i=0; i<frames.size(); i++)
+    {
+        if (frames[i].channels()==3)
+        {
+            cv::cvtColor(frames[i], gray_frames[i], CV_BGR2GRAY);
+        }
+        else
+        {
+            gray_frames[i] = frames[i];
+        }
+    }
+
+    bool single = (_settings.pattern_mode & sl::ThresholdDecode)!=0;
+    int directions = (_settings.pattern_mode & sl::ColumnDecode ? 1 : 2);
+    int total_images = static_cast<int>(frames.size()) - directions*_settings.phase_steps;
+    int direction_images = (total_images - 2)/directions;
+    std::vector<size_t> direct_component_images = sl::direct_light_frames(direction_images, directions);
+    if (direction_images<1 || (!single && direct_component_images.empty()))
+    {
+        std::cerr << "[turntable] ERROR too few pattern images" << std::endl;
+        return false;
+    }
+
+    std::vector<cv::Mat> pattern_frames(gray_frames.begin(), gray_frames.begin()+total_images);
+    std::vector<cv::Mat> phase_frames(gray_frames.begin()+total_images, gray_frames.end());
+    sl::MemoryFrameSource source(pattern_frames);
+    sl::MemoryFrameSource phase_source(phase_frames);
+
+    cv::Mat direct_light;
+    if (!single)
+    {
+        std::vector<cv::Mat> images;
+        for (size_t i=0; i<direct_component_images.size(); i++)
+        {
+            images.push_back(pattern_frames[direct_component_images[i]]);
+        }
+        direct_light = sl::estimate_direct_light(images, _settings.b);
+    }
+
+    cv::Mat pattern_image, min_max_image;
+    sl::DecodeAux aux;
+    if (!sl::decode_pattern(source, pattern_image, min_max_image, _settings.projector_size, 
+                            sl::RobustDecode|sl::GrayPatternDecode|_settings.pattern_mode, direct_light, _settings.m,
+                            (_settings.min_confidence>0.f ? &aux : NULL), (_settings.skip_shadows ? _settings.threshold : 0)))
+    {
+        return false;
+    }
+    if (_settings.min_confidence>0.f)
+    {
+        sl::reject_low_confidence(pattern_image, aux.confidence, _settings.min_confidence);
+    }
+    if (_settings.phase_steps>0 
+        && !sl::decode_phase(phase_source, pattern_image, _settings.phase_steps, _settings.phase_period, static_cast<float>(_settings.m)))
+    {
+        return false;
+    }
+
+    //reconstruct, no progress dialog
+    scan3d::Pointcloud pointcloud;
+    cv::Mat const& color_image = frames.front();
+    if (_settings.ray_plane || (_settings.pattern_mode & sl::ColumnDecode))
+    {
+        cv::Size camera_size = pattern_image.size();
+        if (!_tables.matches(_settings.calib, camera_size, _settings.projector_size) 
+            && !_tables.init(_settings.calib, camera_size, _settings.projector_size))
+        {
+            return false;
+        }
+        scan3d::reconstruct_model_ray_plane(pointcloud, _tables, pattern_image, min_max_image, color_image, _settings.threshold);
+    }
+    else
+    {
+        scan3d::reconstruct_model(pointcloud, _settings.calib, pattern_image, min_max_image, color_image, 
+                                  _settings.projector_size, _settings.threshold, _settings.max_dist);
+    }
+    if (!pointcloud.points.data)
+    {
+        return false;
+    }
+
+    //registration needs the normals
+    scan3d::compute_normals(pointcloud, _settings.normals_window);
+    cloud.from_pointcloud(pointcloud);
+    return true;
+}
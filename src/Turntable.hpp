@@ -0,0 +1,171 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __TURNTABLE_HPP__
+#define __TURNTABLE_HPP__
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QFile>
+#include <QTime>
+#include <QString>
+
+#include <deque>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+#include "CalibrationData.hpp"
+#include "scan3d.hpp"
+
+//rotation stage, angles in degrees
+class Turntable
+{
+public:
+    virtual ~Turntable() {}
+
+    virtual bool open(void) = 0;
+    virtual void close(void) = 0;
+
+    //starts the motion, is_moving() is false once the stage stopped or failed()
+    virtual bool rotate_to(double angle) = 0;
+    virtual bool is_moving(void) = 0;
+    virtual bool failed(void) const = 0;
+
+    //empty device: simulated stage
+    static Turntable * create(QString const& device);
+};
+
+//no hardware: takes as long as a stage turning at degrees_per_second
+class SimulatedTurntable : public Turntable
+{
+public:
+    SimulatedTurntable(double degrees_per_second = 30.0);
+
+    virtual bool open(void) {return true;}
+    virtual void close(void) {}
+    virtual bool rotate_to(double angle);
+    virtual bool is_moving(void);
+    virtual bool failed(void) const {return false;}
+
+private:
+    double _angle;
+    double _speed;
+    int _duration;
+    QTime _timer;
+};
+
+//line protocol on a serial device already configured by the system (baud rate, parity):
+//sends "ROTATE <angle>" and the stage answers "OK" once stopped, within timeout milliseconds
+class SerialTurntable : public Turntable
+{
+public:
+    SerialTurntable(QString const& device, int timeout = 60000);
+
+    virtual bool open(void);
+    virtual void close(void);
+    virtual bool rotate_to(double angle);
+    virtual bool is_moving(void);
+    virtual bool failed(void) const {return _failed;}
+
+private:
+    bool reply_pending(void);
+
+private:
+    QFile _port;
+    bool _moving;
+    bool _failed;
+    int _timeout;
+    QTime _timer;
+};
+
+//decodes and reconstructs the captured sets in a background thread while the next ones are captured
+class TurntablePipeline : public QThread
+{
+    Q_OBJECT
+
+public:
+    struct Settings
+    {
+        CalibrationData calib;
+        cv::Size projector_size;
+        unsigned pattern_mode;      //sl::DecodeFlags of reduced sets
+        int phase_steps;
+        float phase_period;
+        float b;
+        unsigned m;
+        float min_confidence;       //0 keeps every decoded pixel
+        int threshold;
+        bool skip_shadows;          //pixels below threshold are not decoded
+        double max_dist;
+        bool ray_plane;
+        int normals_window;
+    };
+
+    TurntablePipeline(Settings const& settings, QObject * parent = 0);
+    ~TurntablePipeline();
+
+    inline void set_projector_size(cv::Size const& size) {_settings.projector_size = size;} //before start()
+
+    //frames as captured: white, black, gray code, phase shift
+    void enqueue(std::vector<cv::Mat> const& frames, double angle);
+
+    //no more sets: the thread ends once the queue is empty
+    void finish(void);
+
+    //reconstructed sets with normals and their angles, read them after the thread ended
+    std::vector<scan3d::CompactPointcloud> clouds;
+    std::vector<double> angles;
+
+signals:
+    void set_finished(int index, unsigned points);
+
+protected:
+    virtual void run();
+
+private:
+    struct Job
+    {
+        std::vector<cv::Mat> frames;
+        double angle;
+        int index;
+    };
+
+    bool process(std::vector<cv::Mat> const& frames, scan3d::CompactPointcloud & cloud);
+
+private:
+    Settings _settings;
+    scan3d::RayPlaneTables _tables;
+    QMutex _mutex;
+    QWaitCondition _condition;
+    std::deque<Job> _queue;
+    int _count;
+    bool _finished;
+};
+
+#endif  /* __TURNTABLE_HPP__ */
@@ -58,7 +58,9 @@ VideoInput::VideoInput(QObject  * parent):
     _camera_index(-1),
     _video_capture(NULL),
     _init(false),
-    _stop(false)
+    _stop(false),
+    _exposure(0.0),
+    _exposure_changed(false)
 {
     qRegisterMetaType<cv::Mat>("cv::Mat");
 }
@@ -89,6 +91,12 @@ void VideoInput::run()
     timer.start();
     while(_video_capture && !_stop && error<max_error)
     {
+        if (_exposure_changed)
+        {   //camera property requested by the capture loop
+            _exposure_changed = false;
+            cvSetCaptureProperty(_video_capture, CV_CAP_PROP_EXPOSURE, _exposure);
+        }
+
         IplImage * frame = cvQueryFrame(_video_capture);
         if (frame)
         {   //ok
@@ -45,6 +45,7 @@ public:
     inline void stop(void) {_stop = true;}
     inline void set_camera_index(int index) {_camera_index = index;}
     inline int get_camera_index(void) const {return _camera_index;}
+    inline void set_exposure(double value) {_exposure = value; _exposure_changed = true;} //applied before the next frame
 
     static QStringList list_devices(void);
 
@@ -73,6 +74,8 @@ private:
     CvCapture * _video_capture;
     volatile bool _init;
     volatile bool _stop;
+    volatile double _exposure;
+    volatile bool _exposure_changed;
 };
 
 #endif  /* __VIDEOINPUT_HPP__ */
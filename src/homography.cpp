@@ -0,0 +1,315 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+#include "homography.hpp"
+
+#include <cmath>
+#include <limits>
+#include <opencv2/calib3d/calib3d.hpp>
+
+#include "structured_light.hpp"
+
+namespace
+{
+    //least-squares fit acceptance: residual in projector pixels and minimum inlier ratio
+    const double MAX_RESIDUAL = 1.5;
+    const double MIN_INLIER_RATIO = 0.9;
+
+    cv::Point2f apply(cv::Matx33d const& H, double x, double y)
+    {
+        double z = H(2,0)*x + H(2,1)*y + H(2,2);
+        return cv::Point2f(static_cast<float>((H(0,0)*x + H(0,1)*y + H(0,2))/z), 
+                           static_cast<float>((H(1,0)*x + H(1,1)*y + H(1,2))/z));
+    }
+
+    class ProjectorCornerBody : public cv::ParallelLoopBody
+    {
+    public:
+        ProjectorCornerBody(cv::Mat const& pattern_image, cv::Mat const& min_max_image, std::vector<cv::Point2f> const& corners, 
+                            std::vector<cv::Point2f> & pcorners, unsigned half_window, unsigned threshold, 
+                            homography::Method method, volatile bool & failed) :
+            _pattern_image(pattern_image), _min_max_image(min_max_image), _corners(corners), _pcorners(pcorners),
+            _half_window(half_window), _threshold(threshold), _method(method), _failed(failed) {}
+
+        virtual void operator()(const cv::Range & range) const
+        {
+            const unsigned WINDOW_SIZE = _half_window;
+            const unsigned capacity = 4*WINDOW_SIZE*WINDOW_SIZE + 4*WINDOW_SIZE + 1;
+            const double sigma2 = 2.0*(WINDOW_SIZE/2.0)*(WINDOW_SIZE/2.0);
+
+            //buffers shared by all corners in this range
+            std::vector<cv::Point2f> img_points, proj_points;
+            std::vector<float> weights, weight_x, weight_y;
+            img_points.reserve(capacity);
+            proj_points.reserve(capacity);
+            weights.reserve(capacity);
+            weight_x.resize(2*WINDOW_SIZE+2);
+            weight_y.resize(2*WINDOW_SIZE+2);
+
+            for (int i=range.start; i<range.end; i++)
+            {
+                const cv::Point2f & p = _corners[i];
+                cv::Point2f & q = _pcorners[i];
+                q = cv::Point2f(sl::PIXEL_UNCERTAIN, sl::PIXEL_UNCERTAIN);
+
+                if (!(p.x>WINDOW_SIZE && p.y>WINDOW_SIZE && p.x+WINDOW_SIZE<_pattern_image.cols && p.y+WINDOW_SIZE<_pattern_image.rows))
+                {   //window out of the image
+                    _failed = true;
+                    continue;
+                }
+
+                img_points.clear();
+                proj_points.clear();
+                weights.clear();
+
+                const unsigned h0 = p.y-WINDOW_SIZE;
+                const unsigned w0 = p.x-WINDOW_SIZE;
+                if (_method==homography::LeastSquaresMethod)
+                {   //separable gaussian centered at the corner
+                    for (unsigned k=0; k<weight_x.size(); k++)
+                    {
+                        double dx = w0 + k - p.x;
+                        double dy = h0 + k - p.y;
+                        weight_x[k] = static_cast<float>(std::exp(-dx*dx/sigma2));
+                        weight_y[k] = static_cast<float>(std::exp(-dy*dy/sigma2));
+                    }
+                }
+
+                for (unsigned h=h0; h<p.y+WINDOW_SIZE; h++)
+                {
+                    const cv::Vec2f * row = _pattern_image.ptr<cv::Vec2f>(h);
+                    const cv::Vec2b * min_max_row = _min_max_image.ptr<cv::Vec2b>(h);
+                    for (unsigned w=w0; w<p.x+WINDOW_SIZE; w++)
+                    {
+                        const cv::Vec2f & pattern = row[w];
+                        const cv::Vec2b & min_max = min_max_row[w];
+                        if (sl::INVALID(pattern))
+                        {
+                            continue;
+                        }
+                        if ((min_max[1]-min_max[0])<static_cast<int>(_threshold))
+                        {   //apply threshold and skip
+                            continue;
+                        }
+
+                        img_points.push_back(cv::Point2f(w, h));
+                        proj_points.push_back(cv::Point2f(pattern));
+                        if (_method==homography::LeastSquaresMethod)
+                        {
+                            weights.push_back(weight_x[w-w0]*weight_y[h-h0]);
+                        }
+                    }
+                }
+
+                if (img_points.size()<4)
+                {   //not enough decoded points
+                    _failed = true;
+                    continue;
+                }
+
+                cv::Matx33d H;
+                if (!(_method==homography::LeastSquaresMethod && fit_least_squares(img_points, proj_points, weights, H)))
+                {   //RANSAC
+                    cv::Mat Hmat = cv::findHomography(img_points, proj_points, CV_RANSAC);
+                    if (Hmat.rows!=3 || Hmat.cols!=3)
+                    {
+                        _failed = true;
+                        continue;
+                    }
+                    H = cv::Matx33d(Hmat);
+                }
+
+                q = apply(H, p.x, p.y);
+            }
+        }
+
+    private:
+        bool fit_least_squares(std::vector<cv::Point2f> const& img_points, std::vector<cv::Point2f> const& proj_points, 
+                               std::vector<float> const& weights, cv::Matx33d & H) const
+        {
+            int count = static_cast<int>(img_points.size());
+            if (!homography::fit_weighted(&img_points[0], &proj_points[0], &weights[0], count, H))
+            {
+                return false;
+            }
+
+            //inliers are copied: the window is left untouched for RANSAC
+            std::vector<cv::Point2f> img_inliers, proj_inliers;
+            std::vector<float> weight_inliers;
+            img_inliers.reserve(count);
+            proj_inliers.reserve(count);
+            weight_inliers.reserve(count);
+            for (int i=0; i<count; i++)
+            {
+                cv::Point2f r = apply(H, img_points[i].x, img_points[i].y) - proj_points[i];
+                if (r.x*r.x + r.y*r.y<=MAX_RESIDUAL*MAX_RESIDUAL)
+                {
+                    img_inliers.push_back(img_points[i]);
+                    proj_inliers.push_back(proj_points[i]);
+                    weight_inliers.push_back(weights[i]);
+                }
+            }
+            int inliers = static_cast<int>(img_inliers.size());
+
+            if (inliers<MIN_INLIER_RATIO*count)
+            {   //outlier-heavy window: use RANSAC on all the points
+                return false;
+            }
+            if (inliers<count)
+            {   //refit without the outliers
+                return homography::fit_weighted(&img_inliers[0], &proj_inliers[0], &weight_inliers[0], inliers, H);
+            }
+            return true;
+        }
+
+    private:
+        cv::Mat const& _pattern_image;
+        cv::Mat const& _min_max_image;
+        std::vector<cv::Point2f> const& _corners;
+        std::vector<cv::Point2f> & _pcorners;
+        unsigned _half_window;
+        unsigned _threshold;
+        homography::Method _method;
+        volatile bool & _failed;
+    };
+};
+
+bool homography::estimate_projector_corners(cv::Mat const& pattern_image, cv::Mat const& min_max_image,
+                                            std::vector<cv::Point2f> const& corners, std::vector<cv::Point2f> & pcorners,
+                                            unsigned half_window, unsigned threshold, Method method)
+{
+    pcorners.clear();
+    if (!pattern_image.data || pattern_image.type()!=CV_32FC2 || !min_max_image.data || min_max_image.type()!=CV_8UC2)
+    {   //not decoded
+        return false;
+    }
+
+    pcorners.resize(corners.size());
+
+    volatile bool failed = false;
+    cv::parallel_for_(cv::Range(0, static_cast<int>(corners.size())), 
+                      ProjectorCornerBody(pattern_image, min_max_image, corners, pcorners, half_window, threshold, method, failed));
+
+    if (failed)
+    {
+        pcorners.clear();
+        return false;
+    }
+    return true;
+}
+
+bool homography::fit_weighted(const cv::Point2f * img_points, const cv::Point2f * proj_points, const float * weights, 
+                              int count, cv::Matx33d & H)
+{
+    if (count<4)
+    {
+        return false;
+    }
+
+    //weighted centroids
+    double sw = 0.0, cx = 0.0, cy = 0.0, ux = 0.0, uy = 0.0;
+    for (int i=0; i<count; i++)
+    {
+        double w = weights[i];
+        sw += w;
+        cx += w*img_points[i].x;
+        cy += w*img_points[i].y;
+        ux += w*proj_points[i].x;
+        uy += w*proj_points[i].y;
+    }
+    if (sw<=std::numeric_limits<double>::epsilon())
+    {
+        return false;
+    }
+    cx /= sw; cy /= sw; ux /= sw; uy /= sw;
+
+    //scales so the mean distance to the centroid is sqrt(2)
+    double dc = 0.0, du = 0.0;
+    for (int i=0; i<count; i++)
+    {
+        double w = weights[i];
+        dc += w*std::sqrt((img_points[i].x-cx)*(img_points[i].x-cx) + (img_points[i].y-cy)*(img_points[i].y-cy));
+        du += w*std::sqrt((proj_points[i].x-ux)*(proj_points[i].x-ux) + (proj_points[i].y-uy)*(proj_points[i].y-uy));
+    }
+    if (dc<=0.0 || du<=0.0)
+    {   //degenerate
+        return false;
+    }
+    double sc = std::sqrt(2.0)*sw/dc;
+    double su = std::sqrt(2.0)*sw/du;
+
+    //normal equations of the DLT: sum w*(a1*a1' + a2*a2')
+    double M[9][9] = {{0.0}};
+    for (int i=0; i<count; i++)
+    {
+        double w = weights[i];
+        double x = sc*(img_points[i].x-cx);
+        double y = sc*(img_points[i].y-cy);
+        double u = su*(proj_points[i].x-ux);
+        double v = su*(proj_points[i].y-uy);
+
+        double a1[9] = {x, y, 1.0, 0.0, 0.0, 0.0, -u*x, -u*y, -u};
+        double a2[9] = {0.0, 0.0, 0.0, x, y, 1.0, -v*x, -v*y, -v};
+        for (int r=0; r<9; r++)
+        {
+            double w1 = w*a1[r], w2 = w*a2[r];
+            for (int c=r; c<9; c++)
+            {
+                M[r][c] += w1*a1[c] + w2*a2[c];
+            }
+        }
+    }
+    for (int r=1; r<9; r++)
+    {
+        for (int c=0; c<r; c++)
+        {
+            M[r][c] = M[c][r];
+        }
+    }
+
+    //solution is the eigenvector of the smallest eigenvalue
+    cv::Mat eigenvalues, eigenvectors;
+    if (!cv::eigen(cv::Mat(9, 9, CV_64FC1, M), eigenvalues, eigenvectors))
+    {
+        return false;
+    }
+    const double * h = eigenvectors.ptr<double>(8);
+    cv::Matx33d Hn(h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7], h[8]);
+
+    //undo normalization
+    cv::Matx33d Tc(sc, 0.0, -sc*cx, 0.0, sc, -sc*cy, 0.0, 0.0, 1.0);
+    cv::Matx33d Tu_inv(1.0/su, 0.0, ux, 0.0, 1.0/su, uy, 0.0, 0.0, 1.0);
+    H = Tu_inv*Hn*Tc;
+    if (std::fabs(H(2,2))<=std::numeric_limits<double>::epsilon())
+    {
+        return false;
+    }
+    H = H*(1.0/H(2,2));
+    return true;
+}
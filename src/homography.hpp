@@ -0,0 +1,52 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __HOMOGRAPHY_HPP__
+#define __HOMOGRAPHY_HPP__
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+namespace homography
+{
+    enum Method {RansacMethod = 0, LeastSquaresMethod = 1};
+
+    //Projector coordinates of each chessboard corner, from a local homography fitted to the 
+    //decoded pattern in a (2*half_window)^2 neighborhood. Corners are processed in parallel.
+    //LeastSquaresMethod fits a closed-form Gaussian-weighted homography and falls back to RANSAC
+    //when the window has too many outliers.
+    bool estimate_projector_corners(cv::Mat const& pattern_image, cv::Mat const& min_max_image,
+                                    std::vector<cv::Point2f> const& corners, std::vector<cv::Point2f> & pcorners,
+                                    unsigned half_window, unsigned threshold, Method method = RansacMethod);
+
+    //weighted DLT with Hartley normalization, maps img_points to proj_points
+    bool fit_weighted(const cv::Point2f * img_points, const cv::Point2f * proj_points, const float * weights, 
+                      int count, cv::Matx33d & H);
+};
+
+#endif //__HOMOGRAPHY_HPP__
@@ -0,0 +1,188 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+#include "instrument.hpp"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+volatile unsigned instrument::active_flags = 0;
+
+namespace
+{
+    struct Stage
+    {
+        Stage() : calls(0), total(0), longest(0) {}
+        cv::int64 calls;
+        cv::int64 total;    //ticks
+        cv::int64 longest;
+    };
+
+    struct TraceEvent
+    {
+        const char * stage;
+        int thread;
+        cv::int64 start;    //ticks since the run started
+        cv::int64 duration;
+    };
+
+    //events past this are dropped, a long run must not exhaust the memory
+    const size_t TRACE_MAX_EVENTS = 1<<20;
+
+    QMutex run_mutex;
+    cv::int64 run_start = cv::getTickCount();
+    std::map<std::string, Stage> stages;
+    std::map<std::string, cv::int64> counters;
+    std::vector<TraceEvent> trace_events;
+    size_t trace_dropped = 0;
+    std::map<Qt::HANDLE, int> threads;  //small ids for the trace
+
+    double to_ms(cv::int64 ticks) {return 1000.0*ticks/cv::getTickFrequency();}
+    double to_us(cv::int64 ticks) {return 1000000.0*ticks/cv::getTickFrequency();}
+
+    //JSON string: the names written here are plain identifiers and file names
+    std::string quoted(const std::string & text)
+    {
+        std::string out("\"");
+        for (size_t i=0; i<text.size(); i++)
+        {
+            if (text[i]=='"' || text[i]=='\\')
+            {
+                out += '\\';
+            }
+            out += text[i];
+        }
+        return out + "\"";
+    }
+};
+
+void instrument::set_flags(unsigned flags)
+{
+    active_flags = flags;
+}
+
+void instrument::reset(void)
+{
+    QMutexLocker locker(&run_mutex);
+    run_start = cv::getTickCount();
+    stages.clear();
+    counters.clear();
+    trace_events.clear();
+    trace_dropped = 0;
+    threads.clear();
+}
+
+void instrument::add_time(const char * stage, cv::int64 start_ticks, cv::int64 end_ticks)
+{
+    cv::int64 duration = end_ticks - start_ticks;
+
+    QMutexLocker locker(&run_mutex);
+    Stage & entry = stages[stage];
+    entry.calls++;
+    entry.total += duration;
+    entry.longest = std::max(entry.longest, duration);
+
+    if (active_flags & Trace)
+    {
+        if (trace_events.size()>=TRACE_MAX_EVENTS)
+        {
+            trace_dropped++;
+            return;
+        }
+        std::map<Qt::HANDLE, int>::iterator thread = threads.find(QThread::currentThreadId());
+        if (thread==threads.end())
+        {
+            thread = threads.insert(std::make_pair(QThread::currentThreadId(), static_cast<int>(threads.size()))).first;
+        }
+        TraceEvent event = {stage, thread->second, start_ticks - run_start, duration};
+        trace_events.push_back(event);
+    }
+}
+
+void instrument::add_count(const char * counter, cv::int64 value)
+{
+    QMutexLocker locker(&run_mutex);
+    counters[counter] += value;
+}
+
+bool instrument::write_json(const std::string & filename, const std::string & run_name)
+{
+    std::ofstream outfile(filename.c_str());
+    if (!outfile.is_open())
+    {
+        std::cerr << "[instrument] ERROR: cannot write " << filename << std::endl;
+        return false;
+    }
+
+    QMutexLocker locker(&run_mutex);
+    outfile << "{\n  \"run\": " << quoted(run_name) << ",\n";
+    outfile << "  \"wall_ms\": " << to_ms(cv::getTickCount() - run_start) << ",\n";
+    outfile << "  \"threads\": " << cv::getNumThreads() << ",\n";
+    outfile << "  \"stages\": {";
+    for (std::map<std::string, Stage>::const_iterator iter=stages.begin(); iter!=stages.end(); iter++)
+    {
+        outfile << (iter==stages.begin() ? "\n" : ",\n") << "    " << quoted(iter->first) << ": {\"calls\": " << iter->second.calls 
+                << ", \"total_ms\": " << to_ms(iter->second.total) << ", \"max_ms\": " << to_ms(iter->second.longest) << "}";
+    }
+    outfile << "\n  },\n  \"counters\": {";
+    for (std::map<std::string, cv::int64>::const_iterator iter=counters.begin(); iter!=counters.end(); iter++)
+    {
+        outfile << (iter==counters.begin() ? "\n" : ",\n") << "    " << quoted(iter->first) << ": " << iter->second;
+    }
+    outfile << "\n  }\n}\n";
+    return outfile.good();
+}
+
+bool instrument::write_trace(const std::string & filename)
+{
+    std::ofstream outfile(filename.c_str());
+    if (!outfile.is_open())
+    {
+        std::cerr << "[instrument] ERROR: cannot write " << filename << std::endl;
+        return false;
+    }
+
+    QMutexLocker locker(&run_mutex);
+    outfile << "{\"traceEvents\": [";
+    for (size_t i=0; i<trace_events.size(); i++)
+    {
+        TraceEvent const& event = trace_events[i];
+        outfile << (i==0 ? "\n" : ",\n") << "{\"name\": " << quoted(event.stage) << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.thread
+                << ", \"ts\": " << to_us(event.start) << ", \"dur\": " << to_us(event.duration) << "}";
+    }
+    outfile << "\n], \"otherData\": {\"dropped_events\": " << trace_dropped << "}}\n";
+    return outfile.good();
+}
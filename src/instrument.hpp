@@ -0,0 +1,74 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __INSTRUMENT_HPP__
+#define __INSTRUMENT_HPP__
+
+#include <string>
+#include <opencv2/core/core.hpp>
+
+//Per-stage timers and counters of a processing run, written as JSON and optionally
+//as a Chrome trace (chrome://tracing). Disabled by default: a timer or counter then 
+//costs one flag test. Stages may nest, their times add up separately.
+//All functions are safe to call from worker threads.
+namespace instrument
+{
+    enum Flags {Enabled = 0x01, Trace = 0x02};
+
+    extern volatile unsigned active_flags;
+    inline bool enabled(void) {return (active_flags & Enabled)!=0;}
+    void set_flags(unsigned flags);
+
+    //forget the previous run, time starts now
+    void reset(void);
+
+    void add_time(const char * stage, cv::int64 start_ticks, cv::int64 end_ticks);
+    void add_count(const char * counter, cv::int64 value);
+    inline void count(const char * counter, cv::int64 value) {if (enabled()) {add_count(counter, value);}}
+
+    //stage time from construction to destruction
+    class ScopedTimer
+    {
+    public:
+        explicit ScopedTimer(const char * stage) : _stage(stage), _active(enabled()), _start(_active ? cv::getTickCount() : 0) {}
+        ~ScopedTimer() {if (_active) {add_time(_stage, _start, cv::getTickCount());}}
+
+    private:
+        const char * _stage;
+        bool _active;
+        cv::int64 _start;
+    };
+
+    //calls, total and longest time of each stage, and every counter
+    bool write_json(const std::string & filename, const std::string & run_name);
+
+    //one complete event per timed call, only recorded with the Trace flag
+    bool write_trace(const std::string & filename);
+};
+
+#endif //__INSTRUMENT_HPP__
@@ -32,6 +32,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <iostream>
 #include <fstream>
 #include <float.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 
 #if defined(_MSC_VER) && !defined(isnan)
 # include <float.h>
@@ -39,6 +43,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 #include "structured_light.hpp"
+#include "instrument.hpp"
 
 
 QImage io_util::qImage(const cv::Mat & image)
@@ -147,8 +152,45 @@ bool io_util::write_pgm(const cv::Mat & image, const char * basename)
     return true;
 }
 
+//vertex_count is written as given, count_pos (optional) receives its position in the stream
+static void write_ply_header(std::ostream & outfile, bool binary, std::string const& vertex_count, bool normals, bool colors, 
+                             size_t face_count, std::streampos * count_pos = NULL)
+{
+    const char * format_header = (binary? "binary_little_endian 1.0" : "ascii 1.0");
+    outfile << "ply" << std::endl 
+            << "format " << format_header << std::endl 
+            << "comment scan3d-capture generated" << std::endl 
+            << "element vertex ";
+    if (count_pos)
+    {
+        *count_pos = outfile.tellp();
+    }
+    outfile << vertex_count << std::endl 
+            << "property float x" << std::endl 
+            << "property float y" << std::endl 
+            << "property float z" << std::endl;
+    if (normals)
+    {
+        outfile << "property float nx" << std::endl 
+                << "property float ny" << std::endl 
+                << "property float nz" << std::endl;
+    }
+    if (colors)
+    {
+        outfile << "property uchar red" << std::endl 
+                << "property uchar green" << std::endl 
+                << "property uchar blue" << std::endl 
+                << "property uchar alpha" << std::endl;
+    }
+    outfile << "element face " << face_count << std::endl 
+            << "property list uchar int vertex_indices" << std::endl 
+            << "end_header" << std::endl ;
+}
+
 bool io_util::write_ply(const std::string & filename, scan3d::Pointcloud const& pointcloud, unsigned flags)
 {
+    instrument::ScopedTimer timer("export");
+
     if (!pointcloud.points.data
         || (pointcloud.colors.data && pointcloud.colors.rows!=pointcloud.points.rows && pointcloud.colors.cols!=pointcloud.points.cols)
         || (pointcloud.normals.data && pointcloud.normals.rows!=pointcloud.points.rows && pointcloud.normals.cols!=pointcloud.points.cols))
@@ -159,6 +201,7 @@ bool io_util::write_ply(const std::string & filename, scan3d::Pointcloud const&
     bool binary  = (flags&PlyBinary);
     bool colors = (flags&PlyColors) && pointcloud.colors.data;
     bool normals = (flags&PlyNormals) && pointcloud.normals.data;
+    bool faces = (flags&PlyFaces) && !pointcloud.faces.empty();
     std::vector<int> points_index;
     points_index.reserve(pointcloud.points.total());
 
@@ -175,6 +218,31 @@ bool io_util::write_ply(const std::string & filename, scan3d::Pointcloud const&
         }
     }
 
+    //faces refer to grid indices, remap them to the written vertices
+    std::vector<cv::Vec3i> faces_index;
+    if (faces)
+    {
+        std::vector<int> vertex(total, -1);
+        for (size_t k=0; k<points_index.size(); k++)
+        {
+            vertex[points_index[k]] = static_cast<int>(k);
+        }
+        faces_index.reserve(pointcloud.faces.size());
+        for (std::vector<cv::Vec3i>::const_iterator iter=pointcloud.faces.begin(); iter!=pointcloud.faces.end(); iter++)
+        {
+            cv::Vec3i const& f = *iter;
+            if (f[0]<0 || f[1]<0 || f[2]<0 || f[0]>=total || f[1]>=total || f[2]>=total)
+            {   //not from this pointcloud
+                continue;
+            }
+            cv::Vec3i face(vertex[f[0]], vertex[f[1]], vertex[f[2]]);
+            if (face[0]>=0 && face[1]>=0 && face[2]>=0)
+            {   //all vertices were written
+                faces_index.push_back(face);
+            }
+        }
+    }
+
     std::ofstream outfile;
     std::ios::openmode mode = std::ios::out|std::ios::trunc|(binary?std::ios::binary:static_cast<std::ios::openmode>(0));
     outfile.open(filename.c_str(), mode);
@@ -183,30 +251,9 @@ bool io_util::write_ply(const std::string & filename, scan3d::Pointcloud const&
         return false;
     }
 
-    const char * format_header = (binary? "binary_little_endian 1.0" : "ascii 1.0");
-    outfile << "ply" << std::endl 
-            << "format " << format_header << std::endl 
-            << "comment scan3d-capture generated" << std::endl 
-            << "element vertex " << points_index.size() << std::endl 
-            << "property float x" << std::endl 
-            << "property float y" << std::endl 
-            << "property float z" << std::endl;
-    if (normals)
-    {
-        outfile << "property float nx" << std::endl 
-                << "property float ny" << std::endl 
-                << "property float nz" << std::endl;
-    }
-    if (colors)
-    {
-        outfile << "property uchar red" << std::endl 
-                << "property uchar green" << std::endl 
-                << "property uchar blue" << std::endl 
-                << "property uchar alpha" << std::endl;
-    }
-    outfile << "element face 0" << std::endl 
-            << "property list uchar int vertex_indices" << std::endl 
-            << "end_header" << std::endl ;
+    std::ostringstream vertex_count;
+    vertex_count << points_index.size();
+    write_ply_header(outfile, binary, vertex_count.str(), normals, colors, faces_index.size());
 
     for(std::vector<int>::const_iterator iter=points_index.begin(); iter!=points_index.end(); iter++)
     {
@@ -250,7 +297,426 @@ bool io_util::write_ply(const std::string & filename, scan3d::Pointcloud const&
         }
     }
 
+    for (std::vector<cv::Vec3i>::const_iterator iter=faces_index.begin(); iter!=faces_index.end(); iter++)
+    {
+        cv::Vec3i const& f = *iter;
+        if (binary)
+        {
+            const unsigned char n = 3U;
+            outfile.write(reinterpret_cast<const char *>(&n), sizeof(unsigned char));
+            outfile.write(reinterpret_cast<const char *>(&(f[0])), 3*sizeof(int));
+        }
+        else
+        {
+            outfile << "3 " << f[0] << " " << f[1] << " " << f[2] << std::endl;
+        }
+    }
+
+    instrument::count("bytes_written", static_cast<cv::int64>(outfile.tellp()));
+    outfile.close();
+    std::cerr << "[write_ply] Saved " << points_index.size() << " points, " << faces_index.size() << " faces (" << filename << ")" << std::endl;
+    return true;
+}
+
+bool io_util::write_ply(const std::string & filename, scan3d::CompactPointcloud const& pointcloud, unsigned flags)
+{
+    instrument::ScopedTimer timer("export");
+
+    if ((!pointcloud.colors.empty() && pointcloud.colors.size()!=pointcloud.size())
+        || (!pointcloud.normals.empty() && pointcloud.normals.size()!=pointcloud.size()))
+    {
+        return false;
+    }
+
+    bool binary  = (flags&PlyBinary);
+    bool colors = (flags&PlyColors) && !pointcloud.colors.empty();
+    bool normals = (flags&PlyNormals) && !pointcloud.normals.empty();
+
+    //points without a normal are not written
+    size_t count = pointcloud.size();
+    if (normals)
+    {
+        count = 0;
+        for (std::vector<cv::Vec3f>::const_iterator iter=pointcloud.normals.begin(); iter!=pointcloud.normals.end(); iter++)
+        {
+            count += (sl::INVALID(*iter) ? 0 : 1);
+        }
+    }
+
+    std::ofstream outfile;
+    std::ios::openmode mode = std::ios::out|std::ios::trunc|(binary?std::ios::binary:static_cast<std::ios::openmode>(0));
+    outfile.open(filename.c_str(), mode);
+    if (!outfile.is_open())
+    {
+        return false;
+    }
+
+    std::ostringstream vertex_count;
+    vertex_count << count;
+    write_ply_header(outfile, binary, vertex_count.str(), normals, colors, 0);
+
+    for (size_t i=0; i<pointcloud.size(); i++)
+    {
+        if (normals && sl::INVALID(pointcloud.normals[i]))
+        {
+            continue;
+        }
+
+        cv::Vec3f const& p = pointcloud.points[i];
+        if (binary)
+        {
+            outfile.write(reinterpret_cast<const char *>(&(p[0])), 3*sizeof(float));
+            if (normals)
+            {
+                outfile.write(reinterpret_cast<const char *>(&(pointcloud.normals[i][0])), 3*sizeof(float));
+            }
+            if (colors)
+            {
+                cv::Vec3b const& c = pointcloud.colors[i];
+                const unsigned char rgba[4] = {c[0], c[1], c[2], 255U};
+                outfile.write(reinterpret_cast<const char *>(rgba), 4*sizeof(unsigned char));
+            }
+        }
+        else
+        {
+            outfile << p[0] << " " << p[1] << " "  << p[2];
+            if (normals)
+            {
+                cv::Vec3f const& n = pointcloud.normals[i];
+                outfile << " " << n[0] << " " << n[1] << " " << n[2];
+            }
+            if (colors)
+            {
+                cv::Vec3b const& c = pointcloud.colors[i];
+                outfile << " " << static_cast<int>(c[0]) << " " << static_cast<int>(c[1]) << " " << static_cast<int>(c[2]) << " 255";
+            }
+            outfile << std::endl;
+        }
+    }
+
+    instrument::count("bytes_written", static_cast<cv::int64>(outfile.tellp()));
     outfile.close();
-    std::cerr << "[write_ply] Saved " << points_index.size() << " points (" << filename << ")" << std::endl;
+    std::cerr << "[write_ply] Saved " << count << " points (" << filename << ")" << std::endl;
     return true;
 }
+
+//space for the vertex count, patched on close
+static const int PLY_COUNT_WIDTH = 12;
+//buffered output is written in chunks of this size
+static const size_t PLY_CHUNK_SIZE = 1<<20;
+
+io_util::PlyWriter::PlyWriter(const std::string & filename, unsigned flags) :
+    _filename(filename),
+    _flags(flags),
+    _outfile(),
+    _buffer(),
+    _count_pos(0),
+    _count(0),
+    _last_row(-1),
+    _points(),
+    _colors(),
+    _normals()
+{
+}
+
+io_util::PlyWriter::~PlyWriter()
+{
+    close();
+}
+
+bool io_util::PlyWriter::begin(int rows, int cols)
+{
+    bool binary = (_flags&PlyBinary);
+    std::ios::openmode mode = std::ios::out|std::ios::trunc|(binary?std::ios::binary:static_cast<std::ios::openmode>(0));
+    _outfile.open(_filename.c_str(), mode);
+    if (!_outfile.is_open())
+    {
+        return false;
+    }
+
+    write_ply_header(_outfile, binary, std::string(PLY_COUNT_WIDTH, ' '), (_flags&PlyNormals)!=0, (_flags&PlyColors)!=0, 0, &_count_pos);
+
+    _count = 0;
+    _last_row = -1;
+    _points = cv::Mat(3, cols, CV_32FC3);
+    _colors = cv::Mat(3, cols, CV_8UC3);
+    _normals = cv::Mat(1, cols, CV_32FC3);
+    return _outfile.good();
+}
+
+bool io_util::PlyWriter::write_row(int row, cv::Mat const& points, cv::Mat const& colors)
+{
+    instrument::ScopedTimer timer("export");
+
+    if (!_outfile.is_open() || row!=_last_row+1 || points.cols!=_points.cols)
+    {   //rows must arrive in order
+        return false;
+    }
+
+    int slot = row%3;
+    points.copyTo(_points.row(slot));
+    colors.copyTo(_colors.row(slot));
+    _last_row = row;
+
+    if (!(_flags&PlyNormals))
+    {   //points can be written right away
+        write_points(slot, NULL);
+        return flush(false);
+    }
+
+    //the previous row has all its neighbors now
+    if (row>=2)
+    {
+        int prev = (row-1)%3;
+        _normals.setTo(cv::Scalar::all(std::numeric_limits<float>::quiet_NaN()));
+        scan3d::compute_normals_row(_points.ptr<cv::Vec3f>((row-2)%3), _points.ptr<cv::Vec3f>(prev), _points.ptr<cv::Vec3f>(slot), 
+                                    _points.cols, _normals.ptr<cv::Vec3f>(0));
+        write_points(prev, _normals.ptr<cv::Vec3f>(0));
+    }
+    //first and last rows have no normals and are never written
+
+    return flush(false);
+}
+
+void io_util::PlyWriter::write_points(int slot, const cv::Vec3f * normals_row)
+{
+    bool binary = (_flags&PlyBinary);
+    bool colors = (_flags&PlyColors);
+    const cv::Vec3f * points_row = _points.ptr<cv::Vec3f>(slot);
+    const cv::Vec3b * colors_row = _colors.ptr<cv::Vec3b>(slot);
+
+    for (int w=0; w<_points.cols; w++)
+    {
+        cv::Vec3f const& p = points_row[w];
+        if (sl::INVALID(p) || (normals_row && sl::INVALID(normals_row[w])))
+        {
+            continue;
+        }
+
+        if (binary)
+        {
+            _buffer.write(reinterpret_cast<const char *>(&(p[0])), 3*sizeof(float));
+            if (normals_row)
+            {
+                _buffer.write(reinterpret_cast<const char *>(&(normals_row[w][0])), 3*sizeof(float));
+            }
+            if (colors)
+            {
+                cv::Vec3b const& c = colors_row[w];
+                const unsigned char rgba[4] = {c[2], c[1], c[0], 255U};
+                _buffer.write(reinterpret_cast<const char *>(rgba), 4*sizeof(unsigned char));
+            }
+        }
+        else
+        {
+            _buffer << p[0] << " " << p[1] << " "  << p[2];
+            if (normals_row)
+            {
+                cv::Vec3f const& n = normals_row[w];
+                _buffer << " " << n[0] << " " << n[1] << " " << n[2];
+            }
+            if (colors)
+            {
+                cv::Vec3b const& c = colors_row[w];
+                _buffer << " " << static_cast<int>(c[2]) << " " << static_cast<int>(c[1]) << " " << static_cast<int>(c[0]) << " 255";
+            }
+            _buffer << std::endl;
+        }
+        _count++;
+    }
+}
+
+bool io_util::PlyWriter::flush(bool force)
+{
+    if (force || static_cast<size_t>(_buffer.tellp())>=PLY_CHUNK_SIZE)
+    {
+        std::string chunk = _buffer.str();
+        _outfile.write(chunk.data(), chunk.size());
+        _buffer.str(std::string());
+    }
+    return _outfile.good();
+}
+
+bool io_util::PlyWriter::close(void)
+{
+    if (!_outfile.is_open())
+    {
+        return false;
+    }
+
+    flush(true);
+
+    //patch the vertex count
+    std::ostringstream count;
+    count << _count;
+    _outfile.seekp(_count_pos);
+    _outfile << count.str();
+
+    bool rv = _outfile.good();
+    if (instrument::enabled())
+    {   //file size
+        _outfile.seekp(0, std::ios::end);
+        instrument::count("bytes_written", static_cast<cv::int64>(_outfile.tellp()));
+    }
+    _outfile.close();
+    std::cerr << "[PlyWriter] Saved " << _count << " points (" << _filename << ")" << std::endl;
+    return rv;
+}
+
+static unsigned read_be16(const unsigned char * p) {return (p[0]<<8) | p[1];}
+static unsigned read_be32(const unsigned char * p) {return (p[0]<<24) | (p[1]<<16) | (p[2]<<8) | p[3];}
+static unsigned read_le16(const unsigned char * p) {return p[0] | (p[1]<<8);}
+static int read_le32(const unsigned char * p) {return static_cast<int>(p[0] | (p[1]<<8) | (p[2]<<16) | (p[3]<<24));}
+
+static bool read_png_size(FILE * fp, cv::Size & size, int & channels, int & bit_depth)
+{
+    //signature(8) + IHDR length(4) + "IHDR"(4) + width(4) + height(4) + depth(1) + color type(1)
+    unsigned char header[26];
+    if (fread(header, 1, sizeof(header), fp)!=sizeof(header))
+    {
+        return false;
+    }
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+    if (memcmp(header, signature, 8) || memcmp(header+12, "IHDR", 4))
+    {
+        return false;
+    }
+    size = cv::Size(read_be32(header+16), read_be32(header+20));
+    bit_depth = header[24];
+    switch (header[25])
+    {
+    case 0: channels = 1; break;                //gray
+    case 2: channels = 3; break;                //RGB
+    case 3: channels = 3; bit_depth = 8; break; //palette, expanded when loaded
+    case 4: channels = 2; break;                //gray+alpha
+    case 6: channels = 4; break;                //RGBA
+    default: return false;
+    }
+    return true;
+}
+
+static bool read_jpeg_size(FILE * fp, cv::Size & size, int & channels, int & bit_depth)
+{
+    unsigned char buffer[8];
+    if (fread(buffer, 1, 2, fp)!=2 || buffer[0]!=0xFF || buffer[1]!=0xD8)
+    {   //no SOI marker
+        return false;
+    }
+
+    //walk the marker segments until a start-of-frame is found
+    for (;;)
+    {
+        int c = fgetc(fp);
+        if (c==EOF)
+        {
+            return false;
+        }
+        if (c!=0xFF)
+        {   //garbage between segments
+            continue;
+        }
+        int marker = 0xFF;
+        while (marker==0xFF)
+        {   //skip fill bytes
+            marker = fgetc(fp);
+        }
+        if (marker==EOF || marker==0xD9 || marker==0xDA)
+        {   //end of image or start of scan: no frame header
+            return false;
+        }
+        if (marker==0x01 || (marker>=0xD0 && marker<=0xD8))
+        {   //standalone markers
+            continue;
+        }
+        if (fread(buffer, 1, 2, fp)!=2)
+        {
+            return false;
+        }
+        unsigned length = read_be16(buffer);
+        if (length<2)
+        {
+            return false;
+        }
+        if (marker>=0xC0 && marker<=0xCF && marker!=0xC4 && marker!=0xC8 && marker!=0xCC)
+        {   //SOFn: precision(1) height(2) width(2) components(1)
+            if (fread(buffer, 1, 6, fp)!=6)
+            {
+                return false;
+            }
+            bit_depth = buffer[0];
+            size = cv::Size(read_be16(buffer+3), read_be16(buffer+1));
+            channels = buffer[5];
+            return true;
+        }
+        if (fseek(fp, length-2, SEEK_CUR))
+        {
+            return false;
+        }
+    }
+}
+
+static bool read_bmp_size(FILE * fp, cv::Size & size, int & channels, int & bit_depth)
+{
+    //file header(14) + DIB header: size(4) width height planes bpp
+    unsigned char header[30];
+    if (fread(header, 1, sizeof(header), fp)!=sizeof(header) || header[0]!='B' || header[1]!='M')
+    {
+        return false;
+    }
+    unsigned bpp = 0;
+    if (read_le32(header+14)==12)
+    {   //BITMAPCOREHEADER
+        size = cv::Size(read_le16(header+18), read_le16(header+20));
+        bpp = read_le16(header+24);
+    }
+    else
+    {   //BITMAPINFOHEADER and later, negative height is top-down
+        size = cv::Size(read_le32(header+18), std::abs(read_le32(header+22)));
+        bpp = read_le16(header+28);
+    }
+    //OpenCV loads palette and 16 bit images as 8 bit color
+    channels = (bpp==32 ? 4 : 3);
+    bit_depth = 8;
+    return (size.width>0 && size.height>0);
+}
+
+bool io_util::read_image_size(const std::string & filename, cv::Size & size, int * channels, int * bit_depth)
+{
+    FILE * fp = fopen(filename.c_str(), "rb");
+    if (!fp)
+    {
+        return false;
+    }
+
+    unsigned char magic[2] = {0, 0};
+    bool rv = (fread(magic, 1, 2, fp)==2 && fseek(fp, 0, SEEK_SET)==0);
+
+    int image_channels = 0, image_depth = 0;
+    if (rv && magic[0]==0x89 && magic[1]=='P')
+    {
+        rv = read_png_size(fp, size, image_channels, image_depth);
+    }
+    else if (rv && magic[0]==0xFF && magic[1]==0xD8)
+    {
+        rv = read_jpeg_size(fp, size, image_channels, image_depth);
+    }
+    else if (rv && magic[0]=='B' && magic[1]=='M')
+    {
+        rv = read_bmp_size(fp, size, image_channels, image_depth);
+    }
+    else
+    {   //unsupported format
+        rv = false;
+    }
+    fclose(fp);
+
+    if (rv && channels)
+    {
+        *channels = image_channels;
+    }
+    if (rv && bit_depth)
+    {
+        *bit_depth = image_depth;
+    }
+    return rv;
+}
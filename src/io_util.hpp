@@ -29,6 +29,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define __IO_UTIL_HPP__
 
 #include <QImage>
+#include <string>
+#include <fstream>
+#include <sstream>
 #include <opencv2/core/core.hpp>
 #include "scan3d.hpp"
 
@@ -37,12 +40,46 @@ namespace io_util
     enum PlyFlags {PlyPoints = 0x00, PlyColors = 0x01, PlyNormals = 0x02, PlyBinary = 0x04, PlyPlane = 0x08, PlyFaces = 0x10, PlyTexture = 0x20};
     
     bool write_ply(const std::string & filename, scan3d::Pointcloud const& pointcloud, unsigned flags = PlyPoints);
+    bool write_ply(const std::string & filename, scan3d::CompactPointcloud const& pointcloud, unsigned flags = PlyPoints);
+
+    //writes a PLY file while the rows of a reconstruction arrive, the vertex count is patched into 
+    //the header on close. Normals are computed from the 4-neighbors of the last three rows.
+    class PlyWriter : public scan3d::RowSink
+    {
+    public:
+        PlyWriter(const std::string & filename, unsigned flags = PlyPoints);
+        ~PlyWriter();
+
+        virtual bool begin(int rows, int cols);
+        virtual bool write_row(int row, cv::Mat const& points, cv::Mat const& colors);
+        bool close(void);
+
+        inline size_t count(void) const {return _count;}
+
+    private:
+        void write_points(int slot, const cv::Vec3f * normals_row);
+        bool flush(bool force);
+
+        std::string _filename;
+        unsigned _flags;
+        std::ofstream _outfile;
+        std::ostringstream _buffer;
+        std::streampos _count_pos;
+        size_t _count;
+        int _last_row;
+        cv::Mat _points;        //last three rows
+        cv::Mat _colors;
+        cv::Mat _normals;       //one row
+    };
 
     QImage qImage(const cv::Mat & image);
     QImage qImageFromRGB(const cv::Mat & image);
     QImage qImageFromGray(const cv::Mat & image);
 
     bool write_pgm(const cv::Mat & image, const char * basename);
+
+    //reads only the file header of a PNG, JPEG or BMP image
+    bool read_image_size(const std::string & filename, cv::Size & size, int * channels = NULL, int * bit_depth = NULL);
 };
 
 #endif  /* __IO_UTIL_HPP__ */
@@ -0,0 +1,480 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+#include "registration.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <opencv2/calib3d/calib3d.hpp>
+
+#include "structured_light.hpp"
+
+namespace
+{
+    //source ranges whose normal equations are reduced after each iteration
+    const int ICP_CHUNKS = 64;
+
+    //orders point indices by one coordinate
+    struct AxisLess
+    {
+        AxisLess(std::vector<cv::Vec3f> const& points, int axis) : _points(points), _axis(axis) {}
+        inline bool operator()(int a, int b) const {return _points[a][_axis]<_points[b][_axis];}
+
+        std::vector<cv::Vec3f> const& _points;
+        int _axis;
+    };
+}
+
+registration::KdTree::KdTree() :
+    _points(),
+    _index(),
+    _axis()
+{
+}
+
+void registration::KdTree::clear(void)
+{
+    _points.clear();
+    _index.clear();
+    _axis.clear();
+}
+
+void registration::KdTree::build(std::vector<cv::Vec3f> const& points)
+{
+    clear();
+
+    //sort a permutation, the points are reordered at the end
+    _points = points;
+    _index.resize(points.size());
+    for (size_t i=0; i<_index.size(); i++)
+    {
+        _index[i] = static_cast<int>(i);
+    }
+    _axis.assign(points.size(), 0);
+
+    build(0, static_cast<int>(points.size()));
+
+    for (size_t i=0; i<_index.size(); i++)
+    {
+        _points[i] = points[_index[i]];
+    }
+}
+
+void registration::KdTree::build(int begin, int end)
+{
+    if (end-begin<2)
+    {   //leaf
+        return;
+    }
+
+    //bounding box of the range
+    cv::Vec3f min_point = _points[_index[begin]];
+    cv::Vec3f max_point = min_point;
+    for (int i=begin+1; i<end; i++)
+    {
+        cv::Vec3f const& p = _points[_index[i]];
+        for (int k=0; k<3; k++)
+        {
+            min_point[k] = std::min(min_point[k], p[k]);
+            max_point[k] = std::max(max_point[k], p[k]);
+        }
+    }
+    cv::Vec3f extent = max_point - min_point;
+    int axis = (extent[0]>=extent[1] ? (extent[0]>=extent[2] ? 0 : 2) : (extent[1]>=extent[2] ? 1 : 2));
+
+    int mid = begin + (end-begin)/2;
+    std::nth_element(_index.begin()+begin, _index.begin()+mid, _index.begin()+end, AxisLess(_points, axis));
+    _axis[mid] = static_cast<unsigned char>(axis);
+
+    build(begin, mid);
+    build(mid+1, end);
+}
+
+int registration::KdTree::nearest(cv::Vec3f const& query, float max_dist2, float * dist2) const
+{
+    int best = -1;
+    float best_dist2 = max_dist2;
+    nearest(0, static_cast<int>(_points.size()), query, best, best_dist2);
+    if (dist2)
+    {
+        *dist2 = best_dist2;
+    }
+    return (best<0 ? -1 : _index[best]);
+}
+
+void registration::KdTree::nearest(int begin, int end, cv::Vec3f const& query, int & best, float & best_dist2) const
+{
+    if (begin>=end)
+    {
+        return;
+    }
+
+    int mid = begin + (end-begin)/2;
+    cv::Vec3f const& p = _points[mid];
+    cv::Vec3f d = query - p;
+    float dist2 = d.dot(d);
+    if (dist2<best_dist2)
+    {
+        best_dist2 = dist2;
+        best = mid;
+    }
+    if (end-begin<2)
+    {
+        return;
+    }
+
+    //near side first, the far side only if the splitting plane is closer than the best so far
+    float diff = d[_axis[mid]];
+    if (diff<0.f)
+    {
+        nearest(begin, mid, query, best, best_dist2);
+        if (diff*diff<best_dist2)
+        {
+            nearest(mid+1, end, query, best, best_dist2);
+        }
+    }
+    else
+    {
+        nearest(mid+1, end, query, best, best_dist2);
+        if (diff*diff<best_dist2)
+        {
+            nearest(begin, mid, query, best, best_dist2);
+        }
+    }
+}
+
+cv::Matx44d registration::axis_rotation(cv::Vec3d const& point, cv::Vec3d const& direction, double degrees)
+{
+    double length = cv::norm(direction);
+    if (length<=0.0)
+    {
+        return cv::Matx44d::eye();
+    }
+
+    cv::Mat rotation;
+    cv::Rodrigues(cv::Mat(direction*(degrees*CV_PI/180.0/length)), rotation);
+
+    //x' = R*(x - point) + point
+    cv::Matx44d T = cv::Matx44d::eye();
+    for (int u=0; u<3; u++)
+    {
+        double t = point[u];
+        for (int v=0; v<3; v++)
+        {
+            T(u,v) = rotation.at<double>(u,v);
+            t -= T(u,v)*point[v];
+        }
+        T(u,3) = t;
+    }
+    return T;
+}
+
+cv::Vec3f registration::transform_point(cv::Matx44d const& T, cv::Vec3f const& p)
+{
+    return cv::Vec3f(static_cast<float>(T(0,0)*p[0] + T(0,1)*p[1] + T(0,2)*p[2] + T(0,3)),
+                     static_cast<float>(T(1,0)*p[0] + T(1,1)*p[1] + T(1,2)*p[2] + T(1,3)),
+                     static_cast<float>(T(2,0)*p[0] + T(2,1)*p[1] + T(2,2)*p[2] + T(2,3)));
+}
+
+cv::Vec3f registration::transform_normal(cv::Matx44d const& T, cv::Vec3f const& n)
+{   //rigid transform: rotation only
+    return cv::Vec3f(static_cast<float>(T(0,0)*n[0] + T(0,1)*n[1] + T(0,2)*n[2]),
+                     static_cast<float>(T(1,0)*n[0] + T(1,1)*n[1] + T(1,2)*n[2]),
+                     static_cast<float>(T(2,0)*n[0] + T(2,1)*n[1] + T(2,2)*n[2]));
+}
+
+namespace
+{
+    //J^T*J and J^T*r of the linearized point-to-plane residuals, upper triangle only
+    struct NormalEquations
+    {
+        void clear(void) {memset(A, 0, sizeof(A)); memset(b, 0, sizeof(b)); error = 0.0; count = 0;}
+
+        double A[6][6];
+        double b[6];
+        double error;
+        size_t count;
+    };
+
+    //each chunk of source points searches its correspondences and fills its own equations
+    class PointToPlaneBody : public cv::ParallelLoopBody
+    {
+    public:
+        PointToPlaneBody(scan3d::CompactPointcloud const& source, scan3d::CompactPointcloud const& target, 
+                         registration::KdTree const& tree, cv::Matx44d const& transform, float max_dist2, size_t step,
+                         std::vector<NormalEquations> & equations) :
+            _source(source), _target(target), _tree(tree), _transform(transform), _max_dist2(max_dist2), _step(step), 
+            _equations(equations) {}
+
+        virtual void operator()(const cv::Range & range) const
+        {
+            const size_t count = _source.size();
+            const size_t chunks = _equations.size();
+            for (int c=range.start; c<range.end; c++)
+            {
+                NormalEquations & eq = _equations[c];
+                eq.clear();
+
+                size_t begin = count*c/chunks;
+                size_t end = count*(c+1)/chunks;
+                for (size_t i=((begin+_step-1)/_step)*_step; i<end; i+=_step)
+                {
+                    cv::Vec3f p = registration::transform_point(_transform, _source.points[i]);
+                    int j = _tree.nearest(p, _max_dist2);
+                    if (j<0)
+                    {   //no correspondence
+                        continue;
+                    }
+                    cv::Vec3f const& n = _target.normals[j];
+                    if (sl::INVALID(n))
+                    {
+                        continue;
+                    }
+
+                    //r + J*[w v] with a small rotation w and translation v
+                    double r = (p - _target.points[j]).dot(n);
+                    cv::Vec3f a = p.cross(n);
+                    double J[6] = {a[0], a[1], a[2], n[0], n[1], n[2]};
+                    for (int u=0; u<6; u++)
+                    {
+                        for (int v=u; v<6; v++)
+                        {
+                            eq.A[u][v] += J[u]*J[v];
+                        }
+                        eq.b[u] += J[u]*r;
+                    }
+                    eq.error += r*r;
+                    eq.count++;
+                }
+            }
+        }
+
+    private:
+        scan3d::CompactPointcloud const& _source;
+        scan3d::CompactPointcloud const& _target;
+        registration::KdTree const& _tree;
+        cv::Matx44d _transform;
+        float _max_dist2;
+        size_t _step;
+        std::vector<NormalEquations> & _equations;
+    };
+}
+
+bool registration::icp_point_to_plane(scan3d::CompactPointcloud const& source, scan3d::CompactPointcloud const& target, 
+                                      KdTree const& target_tree, cv::Matx44d & transform, 
+                                      IcpParams const& params, IcpResult * result)
+{
+    if (source.empty() || target.empty() || target.normals.size()!=target.size() || target_tree.size()!=target.size())
+    {   //nothing to align or no target normals
+        return false;
+    }
+
+    float max_dist2 = static_cast<float>(params.max_distance*params.max_distance);
+    size_t step = static_cast<size_t>(std::max(params.sample_step, 1));
+    std::vector<NormalEquations> equations(ICP_CHUNKS);
+
+    IcpResult local;
+    bool converged = false;
+    for (int iteration=0; iteration<params.max_iterations && !converged; iteration++)
+    {
+        cv::parallel_for_(cv::Range(0, ICP_CHUNKS), 
+                          PointToPlaneBody(source, target, target_tree, transform, max_dist2, step, equations));
+
+        //reduce in chunk order: the result does not depend on the thread count
+        cv::Matx66d A = cv::Matx66d::zeros();
+        cv::Vec6d b(0.0, 0.0, 0.0, 0.0, 0.0, 0.0);
+        double error = 0.0;
+        size_t count = 0;
+        for (std::vector<NormalEquations>::const_iterator iter=equations.begin(); iter!=equations.end(); iter++)
+        {
+            for (int u=0; u<6; u++)
+            {
+                for (int v=u; v<6; v++)
+                {
+                    A(u,v) += iter->A[u][v];
+                }
+                b(u) += iter->b[u];
+            }
+            error += iter->error;
+            count += iter->count;
+        }
+        for (int u=1; u<6; u++)
+        {
+            for (int v=0; v<u; v++)
+            {
+                A(u,v) = A(v,u);
+            }
+        }
+
+        local.iterations = iteration + 1;
+        local.correspondences = count;
+        local.rms = (count ? std::sqrt(error/count) : 0.0);
+        if (count<6)
+        {   //not enough overlap
+            if (result) {*result = local;}
+            return false;
+        }
+
+        cv::Mat x;
+        if (!cv::solve(cv::Mat(A), cv::Mat(-b), x, cv::DECOMP_CHOLESKY))
+        {   //degenerate geometry (e.g. a single plane)
+            if (result) {*result = local;}
+            return false;
+        }
+
+        //compose the update on the left
+        cv::Mat rotation;
+        cv::Rodrigues(x.rowRange(0, 3), rotation);
+        cv::Matx44d update = cv::Matx44d::eye();
+        for (int u=0; u<3; u++)
+        {
+            for (int v=0; v<3; v++)
+            {
+                update(u,v) = rotation.at<double>(u,v);
+            }
+            update(u,3) = x.at<double>(u+3);
+        }
+        transform = update*transform;
+
+        converged = (cv::norm(x)<params.min_update);
+    }
+
+    if (result) {*result = local;}
+    return true;
+}
+
+namespace
+{
+    struct VoxelEntry
+    {
+        inline bool operator<(VoxelEntry const& other) const {return key<other.key;}
+
+        unsigned long long key;
+        cv::Vec3f point;            //transformed
+        int cloud;
+        int index;
+    };
+}
+
+void registration::merge_voxel(std::vector<scan3d::CompactPointcloud> const& clouds, std::vector<cv::Matx44d> const& transforms, 
+                               double voxel_size, scan3d::CompactPointcloud & merged)
+{
+    merged.clear();
+    if (clouds.empty() || clouds.size()!=transforms.size())
+    {
+        return;
+    }
+
+    //colors and normals are merged only if every cloud has them
+    bool has_colors = true;
+    bool has_normals = true;
+    size_t total = 0;
+    for (std::vector<scan3d::CompactPointcloud>::const_iterator iter=clouds.begin(); iter!=clouds.end(); iter++)
+    {
+        has_colors = has_colors && iter->colors.size()==iter->size();
+        has_normals = has_normals && iter->normals.size()==iter->size();
+        total += iter->size();
+    }
+
+    //bucket the points by voxel, sorting keeps the output independent of the cloud order within a voxel
+    double inv_size = (voxel_size>0.0 ? 1.0/voxel_size : 0.0);
+    std::vector<VoxelEntry> entries(total);
+    size_t n = 0;
+    for (size_t c=0; c<clouds.size(); c++)
+    {
+        scan3d::CompactPointcloud const& cloud = clouds[c];
+        for (size_t i=0; i<cloud.size(); i++, n++)
+        {
+            VoxelEntry & entry = entries[n];
+            entry.point = transform_point(transforms[c], cloud.points[i]);
+            entry.key = (inv_size>0.0 ? scan3d::voxel_key(entry.point, inv_size) : n);
+            entry.cloud = static_cast<int>(c);
+            entry.index = static_cast<int>(i);
+        }
+    }
+    std::stable_sort(entries.begin(), entries.end());
+
+    //one output point per run of equal keys
+    merged.points.reserve(total);
+    if (has_colors) {merged.colors.reserve(total);}
+    if (has_normals) {merged.normals.reserve(total);}
+    for (size_t begin=0; begin<entries.size(); )
+    {
+        size_t end = begin + 1;
+        while (end<entries.size() && entries[end].key==entries[begin].key)
+        {
+            end++;
+        }
+
+        cv::Vec3d point(0.0, 0.0, 0.0);
+        cv::Vec3d color(0.0, 0.0, 0.0);
+        cv::Vec3d normal(0.0, 0.0, 0.0);
+        for (size_t i=begin; i<end; i++)
+        {
+            VoxelEntry const& entry = entries[i];
+            scan3d::CompactPointcloud const& cloud = clouds[entry.cloud];
+            point += cv::Vec3d(entry.point);
+            if (has_colors)
+            {
+                color += cv::Vec3d(cloud.colors[entry.index]);
+            }
+            if (has_normals && !sl::INVALID(cloud.normals[entry.index]))
+            {
+                normal += cv::Vec3d(transform_normal(transforms[entry.cloud], cloud.normals[entry.index]));
+            }
+        }
+
+        double scale = 1.0/(end-begin);
+        merged.points.push_back(cv::Vec3f(point*scale));
+        if (has_colors)
+        {
+            color *= scale;
+            merged.colors.push_back(cv::Vec3b(cv::saturate_cast<uchar>(color[0]), cv::saturate_cast<uchar>(color[1]), 
+                                              cv::saturate_cast<uchar>(color[2])));
+        }
+        if (has_normals)
+        {
+            double length = cv::norm(normal);
+            const float nan = std::numeric_limits<float>::quiet_NaN();
+            merged.normals.push_back(length>0.0 ? cv::Vec3f(normal*(1.0/length)) : cv::Vec3f(nan, nan, nan));
+        }
+
+        begin = end;
+    }
+
+    merged.rows = 1;
+    merged.cols = static_cast<int>(merged.points.size());
+    merged.index.resize(merged.points.size());
+    for (size_t i=0; i<merged.index.size(); i++)
+    {
+        merged.index[i] = static_cast<int>(i);
+    }
+}
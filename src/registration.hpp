@@ -0,0 +1,103 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __REGISTRATION_HPP__
+#define __REGISTRATION_HPP__
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+#include "scan3d.hpp"
+
+namespace registration
+{
+    //static 3D KD-tree: nodes are stored implicitly, the median of each range splits it on the
+    //axis of largest extent, so that a tree over n points uses 2 arrays of n elements
+    class KdTree
+    {
+    public:
+        KdTree();
+
+        void clear(void);
+        void build(std::vector<cv::Vec3f> const& points);
+        inline size_t size(void) const {return _points.size();}
+        inline bool empty(void) const {return _points.empty();}
+
+        //index (in the points given to build) of the point closest to query, 
+        //-1 if none is closer than sqrt(max_dist2); safe to call from several threads
+        int nearest(cv::Vec3f const& query, float max_dist2, float * dist2 = NULL) const;
+
+    private:
+        void build(int begin, int end);
+        void nearest(int begin, int end, cv::Vec3f const& query, int & best, float & best_dist2) const;
+
+        std::vector<cv::Vec3f> _points;     //tree order
+        std::vector<int> _index;            //original index of each point
+        std::vector<unsigned char> _axis;   //split axis of the node stored at each position
+    };
+
+    struct IcpParams
+    {
+        IcpParams() : max_iterations(30), max_distance(5.0), min_update(1e-6), sample_step(1) {}
+
+        int max_iterations;
+        double max_distance;    //correspondences further apart are rejected
+        double min_update;      //stop when the pose update (radians + length units) is smaller
+        int sample_step;        //use every sample_step-th source point
+    };
+
+    struct IcpResult
+    {
+        IcpResult() : iterations(0), correspondences(0), rms(0.0) {}
+
+        int iterations;
+        size_t correspondences;
+        double rms;             //point-to-plane distance of the last iteration
+    };
+
+    //point-to-plane ICP: refines transform (initial guess on input) so that transform*source 
+    //lies on target, target_tree must be built on target.points and target must have normals
+    //correspondences are searched and the normal equations accumulated in parallel
+    bool icp_point_to_plane(scan3d::CompactPointcloud const& source, scan3d::CompactPointcloud const& target, 
+                            KdTree const& target_tree, cv::Matx44d & transform, 
+                            IcpParams const& params = IcpParams(), IcpResult * result = NULL);
+
+    //transforms each cloud to a common frame and keeps one point per voxel of side voxel_size, 
+    //the average of the points (colors, normals) that fall into it
+    //merged is unorganized: a single row, index is 0..size-1
+    void merge_voxel(std::vector<scan3d::CompactPointcloud> const& clouds, std::vector<cv::Matx44d> const& transforms, 
+                     double voxel_size, scan3d::CompactPointcloud & merged);
+
+    //rigid rotation of degrees about the axis through point with the given direction
+    cv::Matx44d axis_rotation(cv::Vec3d const& point, cv::Vec3d const& direction, double degrees);
+
+    cv::Vec3f transform_point(cv::Matx44d const& T, cv::Vec3f const& p);
+    cv::Vec3f transform_normal(cv::Matx44d const& T, cv::Vec3f const& n);
+};
+
+#endif //__REGISTRATION_HPP__
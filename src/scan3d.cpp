@@ -28,31 +28,34 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "scan3d.hpp"
 
 #include <iostream>
+#include <cmath>
+#include <algorithm>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
-#include <QApplication>
-#include <QProgressDialog>
 #include <QMap>
 
 #include "structured_light.hpp"
+#include "instrument.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#  include <emmintrin.h>
+#  define SCAN3D_USE_SSE2
+#endif
 
 void scan3d::Pointcloud::clear(void)
 {
     points = cv::Mat();
     colors = cv::Mat();
     normals = cv::Mat();
+    faces.clear();
 }
 
 void scan3d::Pointcloud::init_points(int rows, int cols)
 {
     points = cv::Mat(rows, cols, CV_32FC3);
-    size_t total = points.total()*points.channels();
-    float * data = points.ptr<float>(0);
-    for (size_t i=0; i<total; i++)
-    {
-        data[i] = std::numeric_limits<float>::quiet_NaN();
-    }
+    points.setTo(cv::Scalar::all(std::numeric_limits<float>::quiet_NaN()));
+    faces.clear();
 }
 
 void scan3d::Pointcloud::init_color(int rows, int cols)
@@ -64,26 +67,136 @@ void scan3d::Pointcloud::init_color(int rows, int cols)
 void scan3d::Pointcloud::init_normals(int rows, int cols)
 {
     normals = cv::Mat(rows, cols, CV_32FC3);
-    size_t total = normals.total()*normals.channels();;
-    float * data = normals.ptr<float>(0);
-    for (size_t i=0; i<total; i++)
+    normals.setTo(cv::Scalar::all(std::numeric_limits<float>::quiet_NaN()));
+}
+
+scan3d::CompactPointcloud::CompactPointcloud() :
+    rows(0),
+    cols(0),
+    points(),
+    colors(),
+    normals(),
+    index()
+{
+}
+
+void scan3d::CompactPointcloud::clear(void)
+{
+    rows = 0;
+    cols = 0;
+    points.clear();
+    colors.clear();
+    normals.clear();
+    index.clear();
+}
+
+void scan3d::CompactPointcloud::from_pointcloud(Pointcloud const& pointcloud)
+{
+    clear();
+    if (!pointcloud.points.data)
+    {
+        return;
+    }
+
+    rows = pointcloud.points.rows;
+    cols = pointcloud.points.cols;
+    bool has_colors = (pointcloud.colors.data && pointcloud.colors.size()==pointcloud.points.size());
+    bool has_normals = (pointcloud.normals.data && pointcloud.normals.size()==pointcloud.points.size());
+
+    //count first so that every array is allocated once
+    size_t count = 0;
+    for (int h=0; h<rows; h++)
+    {
+        const cv::Vec3f * points_row = pointcloud.points.ptr<cv::Vec3f>(h);
+        for (int w=0; w<cols; w++)
+        {
+            count += (sl::INVALID(points_row[w]) ? 0 : 1);
+        }
+    }
+    points.reserve(count);
+    index.reserve(count);
+    if (has_colors) {colors.reserve(count);}
+    if (has_normals) {normals.reserve(count);}
+
+    for (int h=0; h<rows; h++)
     {
-        data[i] = std::numeric_limits<float>::quiet_NaN();
+        const cv::Vec3f * points_row = pointcloud.points.ptr<cv::Vec3f>(h);
+        const cv::Vec3b * colors_row = (has_colors ? pointcloud.colors.ptr<cv::Vec3b>(h) : NULL);
+        const cv::Vec3f * normals_row = (has_normals ? pointcloud.normals.ptr<cv::Vec3f>(h) : NULL);
+        for (int w=0; w<cols; w++)
+        {
+            if (sl::INVALID(points_row[w]))
+            {
+                continue;
+            }
+            points.push_back(points_row[w]);
+            index.push_back(h*cols + w);
+            if (colors_row)
+            {   //BGR to RGB
+                cv::Vec3b const& c = colors_row[w];
+                colors.push_back(cv::Vec3b(c[2], c[1], c[0]));
+            }
+            if (normals_row)
+            {
+                normals.push_back(normals_row[w]);
+            }
+        }
+    }
+}
+
+void scan3d::CompactPointcloud::to_pointcloud(Pointcloud & pointcloud) const
+{
+    pointcloud.clear();
+    if (rows<1 || cols<1)
+    {
+        return;
+    }
+
+    pointcloud.init_points(rows, cols);
+    if (!colors.empty())
+    {
+        pointcloud.init_color(rows, cols);
+    }
+    if (!normals.empty())
+    {
+        pointcloud.init_normals(rows, cols);
+    }
+
+    cv::Vec3f * points_data = pointcloud.points.ptr<cv::Vec3f>(0);
+    cv::Vec3b * colors_data = (colors.empty() ? NULL : pointcloud.colors.ptr<cv::Vec3b>(0));
+    cv::Vec3f * normals_data = (normals.empty() ? NULL : pointcloud.normals.ptr<cv::Vec3f>(0));
+    for (size_t i=0; i<index.size(); i++)
+    {
+        int k = index[i];
+        points_data[k] = points[i];
+        if (colors_data)
+        {   //RGB to BGR
+            cv::Vec3b const& c = colors[i];
+            colors_data[k] = cv::Vec3b(c[2], c[1], c[0]);
+        }
+        if (normals_data)
+        {
+            normals_data[k] = normals[i];
+        }
     }
 }
 
 void scan3d::reconstruct_model(Pointcloud & pointcloud, CalibrationData const& calib, 
                                 cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
-                                cv::Size const& projector_size, int threshold, double max_dist, QWidget * parent_widget)
+                                cv::Size const& projector_size, int threshold, double max_dist, JobProgress * progress, 
+                                cv::Rect const& roi)
 {
     reconstruct_model_patch_center(pointcloud, calib, pattern_image, min_max_image, color_image, projector_size, 
-                                    threshold, max_dist, parent_widget);
+                                    threshold, max_dist, progress, roi);
 }
 
 void scan3d::reconstruct_model_simple(Pointcloud & pointcloud, CalibrationData const& calib, 
                                 cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
-                                cv::Size const& projector_size, int threshold, double max_dist, QWidget * parent_widget)
+                                cv::Size const& projector_size, int threshold, double max_dist, JobProgress * progress, 
+                                cv::Rect const& roi)
 {
+    instrument::ScopedTimer timer("triangulation");
+
     if (!pattern_image.data || pattern_image.type()!=CV_32FC2)
     {   //pattern not correctly decoded
         std::cerr << "[reconstruct_model] ERROR invalid pattern_image\n";
@@ -140,23 +253,22 @@ void scan3d::reconstruct_model_simple(Pointcloud & pointcloud, CalibrationData c
     }
     */
 
+    //the rest of the image is not visited
+    const cv::Rect area = (roi.area()>0 ? roi & cv::Rect(0, 0, pattern_image.cols, pattern_image.rows) 
+                                        : cv::Rect(0, 0, pattern_image.cols, pattern_image.rows));
+
     //init point cloud
     int scale_factor = 1;
-    int out_cols = pattern_image.cols/scale_factor;
-    int out_rows = pattern_image.rows/scale_factor;
+    int out_cols = area.width/scale_factor;
+    int out_rows = area.height/scale_factor;
     pointcloud.clear();
     pointcloud.init_points(out_rows, out_cols);
     pointcloud.init_color(out_rows, out_cols);
 
     //progress
-    QProgressDialog * progress = NULL;
-    if (parent_widget)
+    if (progress)
     {
-        progress = new QProgressDialog("Reconstruction in progress.", "Abort", 0, pattern_image.rows, parent_widget, 
-                                        Qt::Dialog|Qt::CustomizeWindowHint|Qt::WindowCloseButtonHint);
-        progress->setWindowModality(Qt::WindowModal);
-        progress->setWindowTitle("Processing");
-        progress->setMinimumWidth(400);
+        progress->set_total(area.height);
     }
 
     //take 3 points in back plane
@@ -212,23 +324,22 @@ void scan3d::reconstruct_model_simple(Pointcloud & pointcloud, CalibrationData c
     unsigned bad  = 0;
     unsigned invalid = 0;
     unsigned repeated = 0;
-    for (int h=0; h<pattern_image.rows; h+=scale_factor)
+    for (int h=area.y; h<area.y+area.height; h+=scale_factor)
     {
-        if (progress && h%4==0)
+        if (progress && (h-area.y)%4==0)
         {
-            progress->setValue(h);
-            progress->setLabelText(QString("Reconstruction in progress: %1 good points/%2 bad points").arg(good).arg(bad));
-            QApplication::instance()->processEvents();
-        }
-        if (progress && progress->wasCanceled())
-        {   //abort
-            pointcloud.clear();
-            return;
+            progress->set_value(h-area.y);
+            progress->set_label(QString("Reconstruction in progress: %1 good points/%2 bad points").arg(good).arg(bad));
+            if (progress->canceled())
+            {   //abort
+                pointcloud.clear();
+                return;
+            }
         }
 
         register const cv::Vec2f * curr_pattern_row = pattern_image.ptr<cv::Vec2f>(h);
         register const cv::Vec2b * min_max_row = min_max_image.ptr<cv::Vec2b>(h);
-        for (register int w=0; w<pattern_image.cols; w+=scale_factor)
+        for (register int w=area.x; w<area.x+area.width; w+=scale_factor)
         {
             double distance = max_dist;  //quality meassure
             cv::Point3d p;               //reconstructed point
@@ -252,7 +363,7 @@ void scan3d::reconstruct_model_simple(Pointcloud & pointcloud, CalibrationData c
                 continue;
             }
 
-            cv::Vec3f & cloud_point = pointcloud.points.at<cv::Vec3f>(h/scale_factor, w/scale_factor);
+            cv::Vec3f & cloud_point = pointcloud.points.at<cv::Vec3f>((h-area.y)/scale_factor, (w-area.x)/scale_factor);
             if (!sl::INVALID(cloud_point[0]))
             {   //point already reconstructed!
                 repeated++;
@@ -296,7 +407,7 @@ void scan3d::reconstruct_model_simple(Pointcloud & pointcloud, CalibrationData c
                     if (color_image.data)
                     {
                         const cv::Vec3b & vec = color_image.at<cv::Vec3b>(h, w);
-                        cv::Vec3b & cloud_color = pointcloud.colors.at<cv::Vec3b>(h/scale_factor, w/scale_factor);
+                        cv::Vec3b & cloud_color = pointcloud.colors.at<cv::Vec3b>((h-area.y)/scale_factor, (w-area.x)/scale_factor);
                         cloud_color[0] = vec[0];
                         cloud_color[1] = vec[1];
                         cloud_color[2] = vec[2];
@@ -313,38 +424,83 @@ void scan3d::reconstruct_model_simple(Pointcloud & pointcloud, CalibrationData c
 
     if (progress)
     {
-        progress->setValue(pattern_image.rows);
-        progress->close();
-        delete progress;
-        progress = NULL;
+        progress->set_value(area.height);
     }
 
     std::cout << "Reconstructed points[simple]: " << good << " (" << bad << " skipped, " << invalid << " invalid) " << std::endl
                 << " - repeated points: " << repeated << " (ignored) " << std::endl;
+    instrument::count("points_good", good);
+    instrument::count("points_bad", bad);
+    instrument::count("points_invalid", invalid);
+    instrument::count("points_repeated", repeated);
 }
 
+namespace
+{
+    //fills a full pointcloud
+    class PointcloudSink : public scan3d::RowSink
+    {
+    public:
+        PointcloudSink(scan3d::Pointcloud & pointcloud) : _pointcloud(pointcloud) {}
+
+        virtual bool begin(int rows, int cols)
+        {
+            _pointcloud.clear();
+            _pointcloud.init_points(rows, cols);
+            _pointcloud.init_color(rows, cols);
+            return true;
+        }
+
+        virtual bool write_row(int row, cv::Mat const& points, cv::Mat const& colors)
+        {
+            points.copyTo(_pointcloud.points.row(row));
+            colors.copyTo(_pointcloud.colors.row(row));
+            return true;
+        }
+
+    private:
+        scan3d::Pointcloud & _pointcloud;
+    };
+};
+
 void scan3d::reconstruct_model_patch_center(Pointcloud & pointcloud, CalibrationData const& calib, 
                                 cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
-                                cv::Size const& projector_size, int threshold, double max_dist, QWidget * parent_widget)
+                                cv::Size const& projector_size, int threshold, double max_dist, JobProgress * progress, 
+                                cv::Rect const& roi)
+{
+    PointcloudSink sink(pointcloud);
+    if (!reconstruct_model_stream(sink, calib, pattern_image, min_max_image, color_image, projector_size, 
+                                  threshold, max_dist, progress, roi))
+    {   //canceled or failed
+        pointcloud.clear();
+    }
+}
+
+bool scan3d::reconstruct_model_stream(RowSink & sink, CalibrationData const& calib, 
+                                cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
+                                cv::Size const& projector_size, int threshold, double max_dist, JobProgress * progress, 
+                                cv::Rect const& roi)
 {
+    instrument::ScopedTimer timer("triangulation");
+
     if (!pattern_image.data || pattern_image.type()!=CV_32FC2)
     {   //pattern not correctly decoded
         std::cerr << "[reconstruct_model] ERROR invalid pattern_image\n";
-        return;
+        return false;
     }
     if (!min_max_image.data || min_max_image.type()!=CV_8UC2)
     {   //pattern not correctly decoded
         std::cerr << "[reconstruct_model] ERROR invalid min_max_image\n";
-        return;
+        return false;
     }
     if (color_image.data && color_image.type()!=CV_8UC3)
     {   //not standard RGB image
         std::cerr << "[reconstruct_model] ERROR invalid color_image\n";
-        return;
+        return false;
     }
     if (!calib.is_valid())
     {   //invalid calibration
-        return;
+        return false;
     }
 
     //parameters
@@ -388,22 +544,18 @@ void scan3d::reconstruct_model_patch_center(Pointcloud & pointcloud, Calibration
     int scale_factor_y = (projector_size.width>projector_size.height ? 1 : 2); //XXX HACK: preserve regular aspect ratio XXX HACK
     int out_cols = projector_size.width/scale_factor_x;
     int out_rows = projector_size.height/scale_factor_y;
-    pointcloud.clear();
-    pointcloud.init_points(out_rows, out_cols);
-    pointcloud.init_color(out_rows, out_cols);
-
-    //progress
-    QProgressDialog * progress = NULL;
-    if (parent_widget)
+    if (!sink.begin(out_rows, out_cols))
     {
-        progress = new QProgressDialog("Reconstruction in progress.", "Abort", 0, pattern_image.rows, parent_widget, 
-                                        Qt::Dialog|Qt::CustomizeWindowHint|Qt::WindowCloseButtonHint);
-        progress->setWindowModality(Qt::WindowModal);
-        progress->setWindowTitle("Processing");
-        progress->setMinimumWidth(400);
-        progress->show();
+        return false;
     }
 
+    //only the current row is kept
+    cv::Mat row_points(1, out_cols, CV_32FC3);
+    cv::Mat row_colors(1, out_cols, CV_8UC3);
+    row_points.setTo(cv::Scalar::all(std::numeric_limits<float>::quiet_NaN()));
+    row_colors.setTo(cv::Scalar::all(255)); //white
+    int current_row = 0;
+
     //take 3 points in back plane
     /*cv::Mat plane;
     if (remove_background)
@@ -451,8 +603,19 @@ void scan3d::reconstruct_model_patch_center(Pointcloud & pointcloud, Calibration
     }
     */
 
-    //candidate points
-    QMap<unsigned, cv::Point2f> proj_points;
+    //the rest of the image is not visited
+    const cv::Rect area = (roi.area()>0 ? roi & cv::Rect(0, 0, pattern_image.cols, pattern_image.rows) 
+                                        : cv::Rect(0, 0, pattern_image.cols, pattern_image.rows));
+
+    //progress: camera rows first, then projector points
+    if (progress)
+    {
+        progress->set_total(area.height);
+        progress->set_label("Reconstruction in progress: collecting points");
+    }
+
+    //candidate points: sum of the sub-pixel projector coordinates and camera pixels of each projector pixel
+    QMap<unsigned, cv::Point2d> proj_points;
     QMap<unsigned, std::vector<cv::Point2f> > cam_points;
 
     //cv::Mat proj_image = cv::Mat::zeros(out_rows, out_cols, CV_8UC3);
@@ -461,23 +624,20 @@ void scan3d::reconstruct_model_patch_center(Pointcloud & pointcloud, Calibration
     unsigned bad  = 0;
     unsigned invalid = 0;
     unsigned repeated = 0;
-    for (int h=0; h<pattern_image.rows; h++)
+    for (int h=area.y; h<area.y+area.height; h++)
     {
-        if (progress && h%4==0)
+        if (progress && (h-area.y)%4==0)
         {
-            progress->setValue(h);
-            progress->setLabelText(QString("Reconstruction in progress: collecting points"));
-            QApplication::instance()->processEvents();
-        }
-        if (progress && progress->wasCanceled())
-        {   //abort
-            pointcloud.clear();
-            return;
+            progress->set_value(h-area.y);
+            if (progress->canceled())
+            {   //abort
+                return false;
+            }
         }
 
         register const cv::Vec2f * curr_pattern_row = pattern_image.ptr<cv::Vec2f>(h);
         register const cv::Vec2b * min_max_row = min_max_image.ptr<cv::Vec2b>(h);
-        for (register int w=0; w<pattern_image.cols; w++)
+        for (register int w=area.x; w<area.x+area.width; w++)
         {
             const cv::Vec2f & pattern = curr_pattern_row[w];
             const cv::Vec2b & min_max = min_max_row[w];
@@ -486,13 +646,14 @@ void scan3d::reconstruct_model_patch_center(Pointcloud & pointcloud, Calibration
                 || pattern[0]<0.f || pattern[0]>=projector_size.width || pattern[1]<0.f || pattern[1]>=projector_size.height
                 || (min_max[1]-min_max[0])<static_cast<int>(threshold))
             {   //skip
+                invalid++;
                 continue;
             }
 
             //ok
             cv::Point2f proj_point(pattern[0]/scale_factor_x, pattern[1]/scale_factor_y);
             unsigned index = static_cast<unsigned>(proj_point.y)*out_cols + static_cast<unsigned>(proj_point.x);
-            proj_points.insert(index, proj_point);
+            proj_points[index] += cv::Point2d(proj_point.x, proj_point.y);
             cam_points[index].push_back(cv::Point2f(w, h));
 
             //proj_image.at<cv::Vec3b>(static_cast<unsigned>(proj_point.y), static_cast<unsigned>(proj_point.x)) = color_image.at<cv::Vec3b>(h, w);
@@ -501,38 +662,43 @@ void scan3d::reconstruct_model_patch_center(Pointcloud & pointcloud, Calibration
 
     //cv::imwrite("proj_image.png", proj_image);
     
-    if (progress)
-    {
-        progress->setValue(pattern_image.rows);
-    }
-
     cv::Mat Rt = calib.R.t();
 
     if (progress)
     {
-        progress->setMaximum(proj_points.size());
+        progress->set_value(0);
+        progress->set_total(proj_points.size());
     }
 
-    QMapIterator<unsigned, cv::Point2f> iter1(proj_points);
+    QMapIterator<unsigned, cv::Point2d> iter1(proj_points);
     unsigned n = 0;
     while (iter1.hasNext()) 
     {
         n++;
         if (progress && n%1000==0)
         {
-            progress->setValue(n);
-            progress->setLabelText(QString("Reconstruction in progress: %1 good points/%2 bad points").arg(good).arg(bad));
-            QApplication::instance()->processEvents();
-        }
-        if (progress && progress->wasCanceled())
-        {   //abort
-            pointcloud.clear();
-            return;
+            progress->set_value(n);
+            progress->set_label(QString("Reconstruction in progress: %1 good points/%2 bad points").arg(good).arg(bad));
+            if (progress->canceled())
+            {   //abort
+                return false;
+            }
         }
 
         iter1.next();
         unsigned index = iter1.key();
-        const cv::Point2f & proj_point = iter1.value();
+
+        //keys are sorted: every row before this one is finished
+        int point_row = static_cast<int>(index/out_cols);
+        for (; current_row<point_row; current_row++)
+        {
+            if (!sink.write_row(current_row, row_points, row_colors))
+            {
+                return false;
+            }
+            row_points.setTo(cv::Scalar::all(std::numeric_limits<float>::quiet_NaN()));
+            row_colors.setTo(cv::Scalar::all(255));
+        }
         const std::vector<cv::Point2f> & cam_point_list = cam_points.value(index);
         const unsigned count = static_cast<int>(cam_point_list.size());
 
@@ -540,6 +706,11 @@ void scan3d::reconstruct_model_patch_center(Pointcloud & pointcloud, Calibration
         {   //empty list
             continue;
         }
+        repeated += count - 1; //camera pixels sharing the projector pixel of another one
+
+        //the camera center is matched with the average of the projector coordinates
+        const cv::Point2d proj_point(iter1.value().x/count, iter1.value().y/count);
+        const int point_col = static_cast<int>(index%out_cols);
 
         //center average
         cv::Point2d sum(0.0, 0.0), sum2(0.0, 0.0);
@@ -571,7 +742,7 @@ void scan3d::reconstruct_model_patch_center(Pointcloud & pointcloud, Calibration
             {   //object point, keep
                 good++;
 
-                cv::Vec3f & cloud_point = pointcloud.points.at<cv::Vec3f>(proj_point.y, proj_point.x);
+                cv::Vec3f & cloud_point = row_points.at<cv::Vec3f>(0, point_col);
                 cloud_point[0] = p.x;
                 cloud_point[1] = p.y;
                 cloud_point[2] = p.z;
@@ -579,7 +750,7 @@ void scan3d::reconstruct_model_patch_center(Pointcloud & pointcloud, Calibration
                 if (color_image.data)
                 {
                     const cv::Vec3b & vec = color_image.at<cv::Vec3b>(static_cast<unsigned>(cam.y), static_cast<unsigned>(cam.x));
-                    cv::Vec3b & cloud_color = pointcloud.colors.at<cv::Vec3b>(proj_point.y, proj_point.x);
+                    cv::Vec3b & cloud_color = row_colors.at<cv::Vec3b>(0, point_col);
                     cloud_color[0] = vec[0];
                     cloud_color[1] = vec[1];
                     cloud_color[2] = vec[2];
@@ -593,16 +764,291 @@ void scan3d::reconstruct_model_patch_center(Pointcloud & pointcloud, Calibration
         }
     }   //while
 
+    //remaining rows
+    for (; current_row<out_rows; current_row++)
+    {
+        if (!sink.write_row(current_row, row_points, row_colors))
+        {
+            return false;
+        }
+        row_points.setTo(cv::Scalar::all(std::numeric_limits<float>::quiet_NaN()));
+        row_colors.setTo(cv::Scalar::all(255));
+    }
+
     if (progress)
     {
-        progress->setValue(proj_points.size());
-        progress->close();
-        delete progress;
-        progress = NULL;
+        progress->set_value(proj_points.size());
     }
 
     std::cout << "Reconstructed points [patch center]: " << good << " (" << bad << " skipped, " << invalid << " invalid) " << std::endl
                 << " - repeated points: " << repeated << " (ignored) " << std::endl;
+    instrument::count("points_good", good);
+    instrument::count("points_bad", bad);
+    instrument::count("points_invalid", invalid);
+    instrument::count("points_repeated", repeated);
+    return true;
+}
+
+scan3d::RayPlaneTables::RayPlaneTables() :
+    rays(),
+    planes(),
+    camera_size(),
+    projector_size(),
+    calib()
+{
+}
+
+void scan3d::RayPlaneTables::clear(void)
+{
+    rays = cv::Mat();
+    planes = cv::Mat();
+    camera_size = cv::Size();
+    projector_size = cv::Size();
+    calib.clear();
+}
+
+bool scan3d::RayPlaneTables::matches(CalibrationData const& other, cv::Size const& other_camera_size, cv::Size const& other_projector_size) const
+{
+    if (!rays.data || !planes.data || camera_size!=other_camera_size || projector_size!=other_projector_size)
+    {
+        return false;
+    }
+    const cv::Mat * a[] = {&calib.cam_K, &calib.cam_kc, &calib.proj_K, &calib.proj_kc, &calib.R, &calib.T};
+    const cv::Mat * b[] = {&other.cam_K, &other.cam_kc, &other.proj_K, &other.proj_kc, &other.R, &other.T};
+    for (int i=0; i<6; i++)
+    {
+        if (a[i]->size()!=b[i]->size() || a[i]->type()!=b[i]->type() || cv::norm(*a[i], *b[i], cv::NORM_INF)!=0.0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool scan3d::RayPlaneTables::init(CalibrationData const& other, cv::Size const& other_camera_size, cv::Size const& other_projector_size)
+{
+    clear();
+    if (!other.is_valid() || other_camera_size.area()<1 || other_projector_size.area()<1)
+    {
+        return false;
+    }
+
+    //camera rays: undistorted normalized coordinates of every pixel
+    cv::Mat pixels(other_camera_size.height*other_camera_size.width, 1, CV_32FC2);
+    cv::Vec2f * pixel = pixels.ptr<cv::Vec2f>(0);
+    for (int h=0; h<other_camera_size.height; h++)
+    {
+        for (int w=0; w<other_camera_size.width; w++, pixel++)
+        {
+            *pixel = cv::Vec2f(static_cast<float>(w), static_cast<float>(h));
+        }
+    }
+    cv::Mat undistorted;
+    cv::undistortPoints(pixels, undistorted, other.cam_K, other.cam_kc);
+    rays = cv::Mat(other_camera_size, CV_32FC3);
+    const cv::Vec2f * uv = undistorted.ptr<cv::Vec2f>(0);
+    for (int h=0; h<rays.rows; h++)
+    {
+        cv::Vec3f * rays_row = rays.ptr<cv::Vec3f>(h);
+        for (int w=0; w<rays.cols; w++, uv++)
+        {
+            rays_row[w] = cv::Vec3f((*uv)[0], (*uv)[1], 1.f);
+        }
+    }
+
+    //projector column planes: rays through a few samples along the column, the plane contains
+    //the projector center; one extra column so that sub-pixel codes interpolate up to width
+    const int SAMPLES = 5;
+    int cols = other_projector_size.width + 1;
+    cv::Mat column_pixels(cols*SAMPLES, 1, CV_64FC2);
+    for (int c=0; c<cols; c++)
+    {
+        for (int s=0; s<SAMPLES; s++)
+        {
+            double row = (other_projector_size.height - 1)*static_cast<double>(s)/(SAMPLES-1);
+            column_pixels.at<cv::Vec2d>(c*SAMPLES+s, 0) = cv::Vec2d(c, row);
+        }
+    }
+    cv::Mat column_rays;
+    cv::undistortPoints(column_pixels, column_rays, other.proj_K, other.proj_kc);
+
+    //projector coordinates: Xp = R*Xc + T ==> plane np.Xp = 0 is (R^t*np).Xc + np.T = 0
+    cv::Matx33d R(other.R);
+    cv::Vec3d T(other.T.at<double>(0,0), other.T.at<double>(1,0), other.T.at<double>(2,0));
+    planes = cv::Mat(1, cols, CV_32FC4);
+    cv::Vec4f * planes_row = planes.ptr<cv::Vec4f>(0);
+    for (int c=0; c<cols; c++)
+    {
+        cv::Vec3d np(0.0, 0.0, 0.0);
+        for (int s=0; s+1<SAMPLES; s++)
+        {   //sum of the normals of consecutive ray pairs: averages the column curvature due to distortion
+            const cv::Vec2d & a = column_rays.at<cv::Vec2d>(c*SAMPLES+s, 0);
+            const cv::Vec2d & b = column_rays.at<cv::Vec2d>(c*SAMPLES+s+1, 0);
+            np += cv::Vec3d(a[0], a[1], 1.0).cross(cv::Vec3d(b[0], b[1], 1.0));
+        }
+        double len = cv::norm(np);
+        if (len>0.0)
+        {
+            np *= 1.0/len;
+        }
+        cv::Vec3d n = R.t()*np;
+        planes_row[c] = cv::Vec4f(static_cast<float>(n[0]), static_cast<float>(n[1]), static_cast<float>(n[2]), static_cast<float>(np.dot(T)));
+    }
+
+    camera_size = other_camera_size;
+    projector_size = other_projector_size;
+    other.cam_K.copyTo(calib.cam_K);
+    other.cam_kc.copyTo(calib.cam_kc);
+    other.proj_K.copyTo(calib.proj_K);
+    other.proj_kc.copyTo(calib.proj_kc);
+    other.R.copyTo(calib.R);
+    other.T.copyTo(calib.T);
+    return true;
+}
+
+void scan3d::reconstruct_model_ray_plane(Pointcloud & pointcloud, RayPlaneTables const& tables, 
+                                cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
+                                int threshold, JobProgress * progress, cv::Rect const& roi)
+{
+    PointcloudSink sink(pointcloud);
+    if (!reconstruct_model_ray_plane(sink, tables, pattern_image, min_max_image, color_image, threshold, progress, roi))
+    {   //canceled or failed
+        pointcloud.clear();
+    }
+}
+
+bool scan3d::reconstruct_model_ray_plane(RowSink & sink, RayPlaneTables const& tables, 
+                                cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
+                                int threshold, JobProgress * progress, cv::Rect const& roi)
+{
+    instrument::ScopedTimer timer("triangulation");
+
+    if (!pattern_image.data || pattern_image.type()!=CV_32FC2)
+    {   //pattern not correctly decoded
+        std::cerr << "[reconstruct_model] ERROR invalid pattern_image\n";
+        return false;
+    }
+    if (!min_max_image.data || min_max_image.type()!=CV_8UC2)
+    {   //pattern not correctly decoded
+        std::cerr << "[reconstruct_model] ERROR invalid min_max_image\n";
+        return false;
+    }
+    if (color_image.data && (color_image.type()!=CV_8UC3 || color_image.size()!=pattern_image.size()))
+    {   //not standard RGB image
+        std::cerr << "[reconstruct_model] ERROR invalid color_image\n";
+        return false;
+    }
+    if (!tables.rays.data || tables.rays.size()!=pattern_image.size() || !tables.planes.data)
+    {   //tables not built for this camera
+        std::cerr << "[reconstruct_model] ERROR ray-plane tables do not match the pattern image\n";
+        return false;
+    }
+
+    //views of the region of interest, the rest of the image is not visited
+    const cv::Rect area = (roi.area()>0 ? roi & cv::Rect(0, 0, pattern_image.cols, pattern_image.rows) 
+                                        : cv::Rect(0, 0, pattern_image.cols, pattern_image.rows));
+    const cv::Mat pattern_area = pattern_image(area);
+    const cv::Mat min_max_area = min_max_image(area);
+    const cv::Mat color_area = (color_image.data ? color_image(area) : cv::Mat());
+    const cv::Mat rays_area = tables.rays(area);
+
+    const int rows = area.height;
+    const int cols = area.width;
+    if (!sink.begin(rows, cols))
+    {
+        return false;
+    }
+
+    //only the current row is kept
+    cv::Mat row_points(1, cols, CV_32FC3);
+    cv::Mat row_colors(1, cols, CV_8UC3);
+
+    //progress
+    if (progress)
+    {
+        progress->set_total(rows);
+    }
+
+    const float NaN = std::numeric_limits<float>::quiet_NaN();
+    const float max_col = static_cast<float>(tables.planes.cols - 1);
+    const cv::Vec4f * planes = tables.planes.ptr<cv::Vec4f>(0);
+
+    unsigned good = 0;
+    unsigned invalid = 0;
+    for (int h=0; h<rows; h++)
+    {
+        if (progress && h%16==0)
+        {
+            progress->set_value(h);
+            progress->set_label(QString("Reconstruction in progress: %1 good points").arg(good));
+            if (progress->canceled())
+            {   //abort
+                return false;
+            }
+        }
+
+        const cv::Vec2f * pattern_row = pattern_area.ptr<cv::Vec2f>(h);
+        const cv::Vec2b * min_max_row = min_max_area.ptr<cv::Vec2b>(h);
+        const cv::Vec3f * rays_row = rays_area.ptr<cv::Vec3f>(h);
+        const cv::Vec3b * color_row = (color_area.data ? color_area.ptr<cv::Vec3b>(h) : NULL);
+        cv::Vec3f * points_row = row_points.ptr<cv::Vec3f>(0);
+        cv::Vec3b * colors_row = row_colors.ptr<cv::Vec3b>(0);
+        for (int w=0; w<cols; w++)
+        {
+            points_row[w] = cv::Vec3f(NaN, NaN, NaN);
+            colors_row[w] = (color_row ? color_row[w] : cv::Vec3b(255, 255, 255));
+
+            const float col = pattern_row[w][0];
+            const cv::Vec2b & min_max = min_max_row[w];
+            if (sl::INVALID(col) || col<0.f || col>=max_col || (min_max[1]-min_max[0])<threshold)
+            {   //skip
+                invalid++;
+                continue;
+            }
+
+            //plane of a sub-pixel column: linear blend of the neighbor planes (same pencil through the projector center)
+            int c = static_cast<int>(col);
+            float a = col - c;
+            const cv::Vec4f & p0 = planes[c];
+            const cv::Vec4f & p1 = planes[c+1];
+            float nx = p0[0] + a*(p1[0] - p0[0]);
+            float ny = p0[1] + a*(p1[1] - p0[1]);
+            float nz = p0[2] + a*(p1[2] - p0[2]);
+            float d  = p0[3] + a*(p1[3] - p0[3]);
+
+            //X = t*ray, n.X + d = 0
+            const cv::Vec3f & ray = rays_row[w];
+            float den = nx*ray[0] + ny*ray[1] + nz*ray[2];
+            if (den==0.f)
+            {   //ray parallel to the plane
+                invalid++;
+                continue;
+            }
+            float t = -d/den;
+            if (t<=0.f)
+            {   //behind the camera
+                invalid++;
+                continue;
+            }
+            points_row[w] = cv::Vec3f(t*ray[0], t*ray[1], t);
+            good++;
+        }
+
+        if (!sink.write_row(h, row_points, row_colors))
+        {
+            return false;
+        }
+    }
+
+    if (progress)
+    {
+        progress->set_value(rows);
+    }
+
+    std::cout << "Reconstructed points [ray-plane]: " << good << " (" << invalid << " invalid) " << std::endl;
+    instrument::count("points_good", good);
+    instrument::count("points_invalid", invalid);
+    return true;
 }
 
 void scan3d::triangulate_stereo(const cv::Mat & K1, const cv::Mat & kc1, const cv::Mat & K2, const cv::Mat & kc2, 
@@ -701,54 +1147,856 @@ cv::Point3d scan3d::approximate_ray_intersection(const cv::Point3d & v1, const c
     return p;
 }
 
-void scan3d::compute_normals(scan3d::Pointcloud & pointcloud)
+namespace
+{
+    //cross product of the 4-neighbors differences, one row per iteration
+    class CrossNormalsBody : public cv::ParallelLoopBody
+    {
+    public:
+        CrossNormalsBody(cv::Mat const& points, cv::Mat & normals) : _points(points), _normals(normals) {}
+
+        virtual void operator()(const cv::Range & range) const
+        {
+            for (int h=range.start; h<range.end; h++)
+            {
+                scan3d::compute_normals_row(_points.ptr<cv::Vec3f>(h-1), _points.ptr<cv::Vec3f>(h), _points.ptr<cv::Vec3f>(h+1), 
+                                            _points.cols, _normals.ptr<cv::Vec3f>(h));
+            }
+        }
+
+    private:
+        cv::Mat const& _points;
+        cv::Mat & _normals;
+    };
+
+    //point moments: count, x, y, z, xx, xy, xz, yy, yz, zz
+    const int MOMENT_COUNT = 10;
+
+    //integral image pass 1: prefix sums along each row, rows in parallel
+    class MomentRowsBody : public cv::ParallelLoopBody
+    {
+    public:
+        MomentRowsBody(cv::Mat const& points, cv::Vec3d const& origin, cv::Mat & moments) : 
+            _points(points), _origin(origin), _moments(moments) {}
+
+        virtual void operator()(const cv::Range & range) const
+        {
+            for (int h=range.start; h<range.end; h++)
+            {
+                const cv::Vec3f * points_row = _points.ptr<cv::Vec3f>(h);
+                double * sum = _moments.ptr<double>(h+1);
+                for (int k=0; k<MOMENT_COUNT; k++)
+                {
+                    sum[k] = 0.0;
+                }
+                for (int w=0; w<_points.cols; w++, sum+=MOMENT_COUNT)
+                {
+                    double * next = sum + MOMENT_COUNT;
+                    cv::Vec3f const& p = points_row[w];
+                    if (sl::INVALID(p))
+                    {
+                        for (int k=0; k<MOMENT_COUNT; k++)
+                        {
+                            next[k] = sum[k];
+                        }
+                        continue;
+                    }
+                    //centered coordinates keep the sums well conditioned
+                    double x = p[0] - _origin[0], y = p[1] - _origin[1], z = p[2] - _origin[2];
+                    next[0] = sum[0] + 1.0;
+                    next[1] = sum[1] + x;
+                    next[2] = sum[2] + y;
+                    next[3] = sum[3] + z;
+                    next[4] = sum[4] + x*x;
+                    next[5] = sum[5] + x*y;
+                    next[6] = sum[6] + x*z;
+                    next[7] = sum[7] + y*y;
+                    next[8] = sum[8] + y*z;
+                    next[9] = sum[9] + z*z;
+                }
+            }
+        }
+
+    private:
+        cv::Mat const& _points;
+        cv::Vec3d _origin;
+        cv::Mat & _moments;
+    };
+
+    //integral image pass 2: accumulate down the columns, column blocks in parallel
+    class MomentColumnsBody : public cv::ParallelLoopBody
+    {
+    public:
+        MomentColumnsBody(cv::Mat & moments) : _moments(moments) {}
+
+        virtual void operator()(const cv::Range & range) const
+        {
+            for (int h=2; h<_moments.rows; h++)
+            {
+                const double * prev = _moments.ptr<double>(h-1) + range.start*MOMENT_COUNT;
+                double * curr = _moments.ptr<double>(h) + range.start*MOMENT_COUNT;
+                for (int k=0; k<(range.end-range.start)*MOMENT_COUNT; k++)
+                {
+                    curr[k] += prev[k];
+                }
+            }
+        }
+
+    private:
+        cv::Mat & _moments;
+    };
+
+    //eigenvector of the smallest eigenvalue of a symmetric 3x3 matrix
+    //returns false if the matrix is degenerate
+    bool smallest_eigenvector(double a00, double a01, double a02, double a11, double a12, double a22,
+                              cv::Vec3d & vector, double & smallest, double & trace)
+    {
+        trace = a00 + a11 + a22;
+        double q = trace/3.0;
+        double p1 = a01*a01 + a02*a02 + a12*a12;
+        double b00 = a00 - q, b11 = a11 - q, b22 = a22 - q;
+        double p2 = b00*b00 + b11*b11 + b22*b22 + 2.0*p1;
+        double p = std::sqrt(p2/6.0);
+        if (p<=0.0)
+        {   //isotropic
+            return false;
+        }
+
+        //trigonometric solution of the characteristic polynomial
+        double det = b00*(b11*b22 - a12*a12) - a01*(a01*b22 - a12*a02) + a02*(a01*a12 - b11*a02);
+        double r = det/(2.0*p*p*p);
+        double phi = (r<=-1.0 ? CV_PI/3.0 : (r>=1.0 ? 0.0 : std::acos(r)/3.0));
+        smallest = q + 2.0*p*std::cos(phi + 2.0*CV_PI/3.0);
+
+        //null space of A - smallest*I: largest cross product of its rows
+        cv::Vec3d r0(a00 - smallest, a01, a02);
+        cv::Vec3d r1(a01, a11 - smallest, a12);
+        cv::Vec3d r2(a02, a12, a22 - smallest);
+        cv::Vec3d c01 = r0.cross(r1), c02 = r0.cross(r2), c12 = r1.cross(r2);
+        double d01 = c01.dot(c01), d02 = c02.dot(c02), d12 = c12.dot(c12);
+        double dmax = std::max(d01, std::max(d02, d12));
+        if (dmax<=0.0)
+        {
+            return false;
+        }
+        vector = (dmax==d01 ? c01 : (dmax==d02 ? c02 : c12))*(1.0/std::sqrt(dmax));
+        return true;
+    }
+
+    //PCA of the window around each valid point, rows in parallel
+    class PcaNormalsBody : public cv::ParallelLoopBody
+    {
+    public:
+        PcaNormalsBody(cv::Mat const& points, cv::Mat const& moments, int window, cv::Mat & normals, cv::Mat * confidence) : 
+            _points(points), _moments(moments), _window(window), _normals(normals), _confidence(confidence) {}
+
+        virtual void operator()(const cv::Range & range) const
+        {
+            for (int h=range.start; h<range.end; h++)
+            {
+                const cv::Vec3f * points_row = _points.ptr<cv::Vec3f>(h);
+                cv::Vec3f * normals_row = _normals.ptr<cv::Vec3f>(h);
+                float * confidence_row = (_confidence ? _confidence->ptr<float>(h) : NULL);
+
+                const double * top = _moments.ptr<double>(std::max(h - _window, 0));
+                const double * bottom = _moments.ptr<double>(std::min(h + _window + 1, _points.rows));
+
+                for (int w=0; w<_points.cols; w++)
+                {
+                    cv::Vec3f const& point = points_row[w];
+                    if (sl::INVALID(point))
+                    {
+                        continue;
+                    }
+
+                    //box sum from the integral image
+                    int left = std::max(w - _window, 0)*MOMENT_COUNT;
+                    int right = std::min(w + _window + 1, _points.cols)*MOMENT_COUNT;
+                    double s[MOMENT_COUNT];
+                    for (int k=0; k<MOMENT_COUNT; k++)
+                    {
+                        s[k] = bottom[right+k] - bottom[left+k] - top[right+k] + top[left+k];
+                    }
+                    if (s[0]<3.0)
+                    {   //too few neighbors
+                        continue;
+                    }
+
+                    //covariance
+                    double n = s[0];
+                    double mx = s[1]/n, my = s[2]/n, mz = s[3]/n;
+                    cv::Vec3d normal;
+                    double smallest, trace;
+                    if (!smallest_eigenvector(s[4]/n - mx*mx, s[5]/n - mx*my, s[6]/n - mx*mz, 
+                                              s[7]/n - my*my, s[8]/n - my*mz, s[9]/n - mz*mz, normal, smallest, trace))
+                    {
+                        continue;
+                    }
+
+                    //orient towards the camera center
+                    cv::Vec3d view(point[0], point[1], point[2]);
+                    if (normal.dot(view)>0.0)
+                    {
+                        normal = -normal;
+                    }
+                    normals_row[w] = cv::Vec3f(normal);
+
+                    if (confidence_row)
+                    {   //1 on a plane, 0 for isotropic neighborhoods
+                        confidence_row[w] = static_cast<float>(trace>0.0 ? std::max(0.0, 1.0 - 3.0*smallest/trace) : 0.0);
+                    }
+                }
+            }
+        }
+
+    private:
+        cv::Mat const& _points;
+        cv::Mat const& _moments;
+        int _window;
+        cv::Mat & _normals;
+        cv::Mat * _confidence;
+    };
+};
+
+void scan3d::compute_normals_row(const cv::Vec3f * points_row0, const cv::Vec3f * points_row1, const cv::Vec3f * points_row2, 
+                                 int cols, cv::Vec3f * normals_row)
+{
+    int w = 1;
+
+#ifdef SCAN3D_USE_SSE2
+    //unaligned 4-float loads read one float past each point, the last column is left to the scalar loop
+    //invalid points are NaN and the NaN propagates to the result
+    for (; w+2<cols; w++)
+    {
+        __m128 n1 = _mm_sub_ps(_mm_loadu_ps(&points_row1[w+1][0]), _mm_loadu_ps(&points_row1[w-1][0]));
+        __m128 n2 = _mm_sub_ps(_mm_loadu_ps(&points_row2[w][0]), _mm_loadu_ps(&points_row0[w][0]));
+
+        //normal = n2 x n1
+        __m128 a = _mm_mul_ps(_mm_shuffle_ps(n2, n2, _MM_SHUFFLE(3,0,2,1)), _mm_shuffle_ps(n1, n1, _MM_SHUFFLE(3,1,0,2)));
+        __m128 b = _mm_mul_ps(_mm_shuffle_ps(n2, n2, _MM_SHUFFLE(3,1,0,2)), _mm_shuffle_ps(n1, n1, _MM_SHUFFLE(3,0,2,1)));
+        __m128 normal = _mm_sub_ps(a, b);
+
+        float n[4];
+        _mm_storeu_ps(n, normal);
+        float norm = std::sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+        if (norm>0.f)
+        {
+            normals_row[w] = cv::Vec3f(n[0]/norm, n[1]/norm, n[2]/norm);
+        }
+    }
+#endif //SCAN3D_USE_SSE2
+
+    for (; w+1<cols; w++)
+    {
+        cv::Vec3f const& w1 = points_row1[w-1];
+        cv::Vec3f const& w2 = points_row1[w+1];
+
+        cv::Vec3f const& h1 = points_row0[w];
+        cv::Vec3f const& h2 = points_row2[w];
+
+        if (sl::INVALID(w1[0]) || sl::INVALID(w2[0]) || sl::INVALID(h1[0]) || sl::INVALID(h2[0]))
+        {
+            continue;
+        }
+
+        cv::Vec3f n1 = w2 - w1;
+        cv::Vec3f n2 = h2 - h1;
+
+        cv::Vec3f normal = n2.cross(n1);
+        float norm = std::sqrt(normal.dot(normal));
+        if (norm>0.f)
+        {
+            normals_row[w] = normal*(1.f/norm);
+        }
+    }
+}
+
+void scan3d::compute_normals(scan3d::Pointcloud & pointcloud, int window, cv::Mat * confidence)
 {
+    instrument::ScopedTimer timer("normals");
+
     if (!pointcloud.points.data)
     {
         return;
     }
 
-    pointcloud.init_normals(pointcloud.points.rows, pointcloud.points.cols);
+    cv::Mat const& points = pointcloud.points;
+    pointcloud.init_normals(points.rows, points.cols);
+    if (confidence)
+    {
+        *confidence = cv::Mat::zeros(points.rows, points.cols, CV_32FC1);
+    }
 
-    for (int h=1; h+1<pointcloud.points.rows; h++)
+    if (window<=1)
+    {   //4-neighbors
+        cv::parallel_for_(cv::Range(1, std::max(points.rows-1, 1)), CrossNormalsBody(points, pointcloud.normals));
+        if (confidence)
+        {   //no quality measure: every valid normal counts the same
+            for (int h=0; h<points.rows; h++)
+            {
+                const cv::Vec3f * normals_row = pointcloud.normals.ptr<cv::Vec3f>(h);
+                float * confidence_row = confidence->ptr<float>(h);
+                for (int w=0; w<points.cols; w++)
+                {
+                    confidence_row[w] = (sl::INVALID(normals_row[w]) ? 0.f : 1.f);
+                }
+            }
+        }
+        return;
+    }
+
+    //centroid of the valid points
+    cv::Vec3d origin(0.0, 0.0, 0.0);
+    size_t valid = 0;
+    for (int h=0; h<points.rows; h++)
     {
-        const cv::Vec3f * points_row0 = pointcloud.points.ptr<cv::Vec3f>(h-1);
-        const cv::Vec3f * points_row1 = pointcloud.points.ptr<cv::Vec3f>(h);
-        const cv::Vec3f * points_row2 = pointcloud.points.ptr<cv::Vec3f>(h+1);
+        const cv::Vec3f * points_row = points.ptr<cv::Vec3f>(h);
+        for (int w=0; w<points.cols; w++)
+        {
+            if (!sl::INVALID(points_row[w]))
+            {
+                origin += cv::Vec3d(points_row[w]);
+                valid++;
+            }
+        }
+    }
+    if (!valid)
+    {
+        return;
+    }
+    origin *= 1.0/valid;
+
+    //integral image of the point moments, first row and column are zero
+    cv::Mat moments(points.rows+1, (points.cols+1)*MOMENT_COUNT, CV_64FC1);
+    memset(moments.ptr<double>(0), 0, moments.step[0]);
+    cv::parallel_for_(cv::Range(0, points.rows), MomentRowsBody(points, origin, moments));
+    cv::parallel_for_(cv::Range(0, points.cols+1), MomentColumnsBody(moments));
 
-        cv::Vec3f * normals_row = pointcloud.normals.ptr<cv::Vec3f>(h);
+    cv::parallel_for_(cv::Range(0, points.rows), PcaNormalsBody(points, moments, window, pointcloud.normals, confidence));
+}
+
+namespace
+{
+    //triangulates the quads between rows h and h+1, one row per iteration
+    class MeshRowsBody : public cv::ParallelLoopBody
+    {
+    public:
+        MeshRowsBody(cv::Mat const& points, float max_edge, std::vector<std::vector<cv::Vec3i> > & row_faces) : 
+            _points(points), _max_edge2(max_edge*max_edge), _row_faces(row_faces) {}
 
-        for (int w=1; w+1<pointcloud.points.cols; w++)
+        virtual void operator()(const cv::Range & range) const
         {
-            cv::Vec3f const& w1 = points_row1[w-1];
-            cv::Vec3f const& w2 = points_row1[w+1];
+            const int cols = _points.cols;
+            for (int h=range.start; h<range.end; h++)
+            {
+                const cv::Vec3f * row0 = _points.ptr<cv::Vec3f>(h);
+                const cv::Vec3f * row1 = _points.ptr<cv::Vec3f>(h+1);
+                std::vector<cv::Vec3i> & faces = _row_faces[h];
+                faces.clear();
+
+                for (int w=0; w+1<cols; w++)
+                {
+                    //quad corners: a=(h,w) b=(h,w+1) c=(h+1,w) d=(h+1,w+1)
+                    bool a = !sl::INVALID(row0[w]);
+                    bool b = !sl::INVALID(row0[w+1]);
+                    bool c = !sl::INVALID(row1[w]);
+                    bool d = !sl::INVALID(row1[w+1]);
+                    if (a+b+c+d<3)
+                    {
+                        continue;
+                    }
+
+                    int ia = h*cols + w, ib = ia + 1, ic = ia + cols, id = ic + 1;
+                    //counter-clockwise seen from the camera
+                    if (a && b && c && d)
+                    {
+                        add(faces, row0[w], row1[w], row0[w+1], ia, ic, ib);
+                        add(faces, row0[w+1], row1[w], row1[w+1], ib, ic, id);
+                    }
+                    else if (!a) {add(faces, row0[w+1], row1[w], row1[w+1], ib, ic, id);}
+                    else if (!b) {add(faces, row0[w], row1[w], row1[w+1], ia, ic, id);}
+                    else if (!c) {add(faces, row0[w], row1[w+1], row0[w+1], ia, id, ib);}
+                    else         {add(faces, row0[w], row1[w], row0[w+1], ia, ic, ib);}
+                }
+            }
+        }
+
+    private:
+        inline void add(std::vector<cv::Vec3i> & faces, cv::Vec3f const& p0, cv::Vec3f const& p1, cv::Vec3f const& p2, 
+                        int i0, int i1, int i2) const
+        {
+            if (_max_edge2>0.f)
+            {   //depth discontinuity: skip long edges
+                cv::Vec3f e0 = p1 - p0, e1 = p2 - p1, e2 = p0 - p2;
+                if (e0.dot(e0)>_max_edge2 || e1.dot(e1)>_max_edge2 || e2.dot(e2)>_max_edge2)
+                {
+                    return;
+                }
+            }
+            faces.push_back(cv::Vec3i(i0, i1, i2));
+        }
+
+    private:
+        cv::Mat const& _points;
+        float _max_edge2;
+        std::vector<std::vector<cv::Vec3i> > & _row_faces;
+    };
+};
+
+void scan3d::make_mesh(scan3d::Pointcloud & pointcloud, double max_edge)
+{
+    pointcloud.faces.clear();
+    if (!pointcloud.points.data || pointcloud.points.rows<2)
+    {
+        return;
+    }
+
+    std::vector<std::vector<cv::Vec3i> > row_faces(pointcloud.points.rows-1);
+    cv::parallel_for_(cv::Range(0, pointcloud.points.rows-1), 
+                      MeshRowsBody(pointcloud.points, static_cast<float>(std::max(max_edge, 0.0)), row_faces));
+
+    //concatenate in row order
+    size_t total = 0;
+    for (size_t h=0; h<row_faces.size(); h++)
+    {
+        total += row_faces[h].size();
+    }
+    pointcloud.faces.reserve(total);
+    for (size_t h=0; h<row_faces.size(); h++)
+    {
+        pointcloud.faces.insert(pointcloud.faces.end(), row_faces[h].begin(), row_faces[h].end());
+    }
+}
 
-            cv::Vec3f const& h1 = points_row0[w];
-            cv::Vec3f const& h2 = points_row2[w];
+unsigned long long scan3d::voxel_key(cv::Vec3f const& p, double inv_size)
+{
+    const long long offset = 1<<20;
+    const long long mask = (1<<21) - 1;
+    unsigned long long key = 0;
+    for (int k=0; k<3; k++)
+    {
+        long long v = static_cast<long long>(std::floor(p[k]*inv_size)) + offset;
+        key = (key<<21) | static_cast<unsigned long long>(std::min(std::max(v, 0LL), mask));
+    }
+    return key;
+}
 
-            if (sl::INVALID(w1[0]) || sl::INVALID(w2[0]) || sl::INVALID(h1[0]) || sl::INVALID(h2[0]))
+namespace
+{
+    //valid neighbors of each point in its (2*window+1)^2 grid neighborhood: how many (only those 
+    //closer than sqrt(radius2) if radius2>0) and their mean distance, NaN for isolated points
+    class GridNeighborsBody : public cv::ParallelLoopBody
+    {
+    public:
+        GridNeighborsBody(cv::Mat const& points, int window, float radius2, cv::Mat & counts, cv::Mat & distances) : 
+            _points(points), _window(window), _radius2(radius2), _counts(counts), _distances(distances) {}
+
+        virtual void operator()(const cv::Range & range) const
+        {
+            const float nan = std::numeric_limits<float>::quiet_NaN();
+            for (int h=range.start; h<range.end; h++)
             {
-                continue;
+                const cv::Vec3f * points_row = _points.ptr<cv::Vec3f>(h);
+                int * counts_row = _counts.ptr<int>(h);
+                float * distances_row = _distances.ptr<float>(h);
+                int h0 = std::max(h-_window, 0);
+                int h1 = std::min(h+_window, _points.rows-1);
+                for (int w=0; w<_points.cols; w++)
+                {
+                    counts_row[w] = 0;
+                    distances_row[w] = nan;
+                    cv::Vec3f const& p = points_row[w];
+                    if (sl::INVALID(p))
+                    {
+                        continue;
+                    }
+
+                    int w0 = std::max(w-_window, 0);
+                    int w1 = std::min(w+_window, _points.cols-1);
+                    int count = 0;
+                    double sum = 0.0;
+                    for (int y=h0; y<=h1; y++)
+                    {
+                        const cv::Vec3f * row = _points.ptr<cv::Vec3f>(y);
+                        for (int x=w0; x<=w1; x++)
+                        {
+                            cv::Vec3f const& q = row[x];
+                            if ((y==h && x==w) || sl::INVALID(q))
+                            {
+                                continue;
+                            }
+                            cv::Vec3f d = q - p;
+                            float dist2 = d.dot(d);
+                            if (_radius2>0.f && dist2>_radius2)
+                            {
+                                continue;
+                            }
+                            sum += std::sqrt(dist2);
+                            count++;
+                        }
+                    }
+                    counts_row[w] = count;
+                    if (count)
+                    {
+                        distances_row[w] = static_cast<float>(sum/count);
+                    }
+                }
+            }
+        }
+
+    private:
+        cv::Mat const& _points;
+        int _window;
+        float _radius2;
+        cv::Mat & _counts;
+        cv::Mat & _distances;
+    };
+
+    //sum, sum of squares and count of the valid mean distances of each row
+    class DistanceStatsBody : public cv::ParallelLoopBody
+    {
+    public:
+        DistanceStatsBody(cv::Mat const& distances, std::vector<cv::Vec3d> & row_stats) : 
+            _distances(distances), _row_stats(row_stats) {}
+
+        virtual void operator()(const cv::Range & range) const
+        {
+            for (int h=range.start; h<range.end; h++)
+            {
+                const float * distances_row = _distances.ptr<float>(h);
+                cv::Vec3d stats(0.0, 0.0, 0.0);
+                for (int w=0; w<_distances.cols; w++)
+                {
+                    float d = distances_row[w];
+                    if (d==d)
+                    {   //not NaN
+                        stats += cv::Vec3d(d, d*d, 1.0);
+                    }
+                }
+                _row_stats[h] = stats;
             }
+        }
 
-            cv::Point3d n1(w2[0]-w1[0], w2[1]-w1[1], w2[2]-w1[2]);
-            cv::Point3d n2(h2[0]-h1[0], h2[1]-h1[1], h2[2]-h1[2]);
+    private:
+        cv::Mat const& _distances;
+        std::vector<cv::Vec3d> & _row_stats;
+    };
+
+    //sets to NaN the valid points with fewer than min_count neighbors or a larger mean distance
+    class RemovePointsBody : public cv::ParallelLoopBody
+    {
+    public:
+        RemovePointsBody(cv::Mat & points, cv::Mat const& counts, cv::Mat const& distances, int min_count, 
+                         float max_distance, std::vector<size_t> & row_removed) : 
+            _points(points), _counts(counts), _distances(distances), _min_count(min_count), _max_distance(max_distance), 
+            _row_removed(row_removed) {}
 
-            cv::Point3d normal = cv::Point3d(-n2.z*n1.y+n2.y*n1.z, n2.z*n1.x-n2.x*n1.z, -n2.y*n1.x+n2.x*n1.y);
-            double norm = std::sqrt(normal.x*normal.x+normal.y*normal.y+normal.z*normal.z);
-            if (norm>0.0)
+        virtual void operator()(const cv::Range & range) const
+        {
+            const float nan = std::numeric_limits<float>::quiet_NaN();
+            for (int h=range.start; h<range.end; h++)
             {
-                cv::Vec3f & cloud_normal = normals_row[w];
-                cloud_normal[0] = normal.x/norm;
-                cloud_normal[1] = normal.y/norm;
-                cloud_normal[2] = normal.z/norm;
+                cv::Vec3f * points_row = _points.ptr<cv::Vec3f>(h);
+                const int * counts_row = _counts.ptr<int>(h);
+                const float * distances_row = _distances.ptr<float>(h);
+                size_t removed = 0;
+                for (int w=0; w<_points.cols; w++)
+                {
+                    if (sl::INVALID(points_row[w]))
+                    {
+                        continue;
+                    }
+                    if (counts_row[w]<_min_count || distances_row[w]>_max_distance)
+                    {
+                        points_row[w] = cv::Vec3f(nan, nan, nan);
+                        removed++;
+                    }
+                }
+                _row_removed[h] = removed;
             }
         }
+
+    private:
+        cv::Mat & _points;
+        cv::Mat const& _counts;
+        cv::Mat const& _distances;
+        int _min_count;
+        float _max_distance;
+        std::vector<size_t> & _row_removed;
+    };
+
+    size_t remove_points(cv::Mat & points, cv::Mat const& counts, cv::Mat const& distances, int min_count, float max_distance)
+    {
+        std::vector<size_t> row_removed(points.rows, 0);
+        cv::parallel_for_(cv::Range(0, points.rows), RemovePointsBody(points, counts, distances, min_count, max_distance, row_removed));
+
+        size_t removed = 0;
+        for (size_t h=0; h<row_removed.size(); h++)
+        {
+            removed += row_removed[h];
+        }
+        return removed;
     }
 }
 
+size_t scan3d::remove_statistical_outliers(scan3d::Pointcloud & pointcloud, int window, double std_ratio)
+{
+    if (!pointcloud.points.data || window<1)
+    {
+        return 0;
+    }
+
+    cv::Mat & points = pointcloud.points;
+    cv::Mat counts(points.rows, points.cols, CV_32SC1);
+    cv::Mat distances(points.rows, points.cols, CV_32FC1);
+    cv::parallel_for_(cv::Range(0, points.rows), GridNeighborsBody(points, window, 0.f, counts, distances));
+
+    //distribution of the mean neighbor distance
+    std::vector<cv::Vec3d> row_stats(points.rows);
+    cv::parallel_for_(cv::Range(0, points.rows), DistanceStatsBody(distances, row_stats));
+    cv::Vec3d stats(0.0, 0.0, 0.0);
+    for (size_t h=0; h<row_stats.size(); h++)
+    {
+        stats += row_stats[h];
+    }
+    if (stats[2]<1.0)
+    {   //no point has neighbors: remove them all
+        return remove_points(points, counts, distances, 1, std::numeric_limits<float>::max());
+    }
+    double mean = stats[0]/stats[2];
+    double stddev = std::sqrt(std::max(stats[1]/stats[2] - mean*mean, 0.0));
+
+    return remove_points(points, counts, distances, 1, static_cast<float>(mean + std_ratio*stddev));
+}
+
+size_t scan3d::remove_radius_outliers(scan3d::Pointcloud & pointcloud, int window, double radius, int min_neighbors)
+{
+    if (!pointcloud.points.data || window<1 || radius<=0.0)
+    {
+        return 0;
+    }
+
+    cv::Mat & points = pointcloud.points;
+    cv::Mat counts(points.rows, points.cols, CV_32SC1);
+    cv::Mat distances(points.rows, points.cols, CV_32FC1);
+    cv::parallel_for_(cv::Range(0, points.rows), 
+                      GridNeighborsBody(points, window, static_cast<float>(radius*radius), counts, distances));
+
+    return remove_points(points, counts, distances, min_neighbors, std::numeric_limits<float>::max());
+}
+
+namespace
+{
+    const unsigned long long NO_VOXEL = ~0ULL;
+
+    class VoxelKeysBody : public cv::ParallelLoopBody
+    {
+    public:
+        VoxelKeysBody(cv::Mat const& points, double inv_size, std::vector<unsigned long long> & keys) : 
+            _points(points), _inv_size(inv_size), _keys(keys) {}
+
+        virtual void operator()(const cv::Range & range) const
+        {
+            for (int h=range.start; h<range.end; h++)
+            {
+                const cv::Vec3f * points_row = _points.ptr<cv::Vec3f>(h);
+                unsigned long long * keys_row = &_keys[static_cast<size_t>(h)*_points.cols];
+                for (int w=0; w<_points.cols; w++)
+                {
+                    keys_row[w] = (sl::INVALID(points_row[w]) ? NO_VOXEL : scan3d::voxel_key(points_row[w], _inv_size));
+                }
+            }
+        }
+
+    private:
+        cv::Mat const& _points;
+        double _inv_size;
+        std::vector<unsigned long long> & _keys;
+    };
+
+    typedef std::pair<unsigned long long, int> VoxelEntry; //voxel key, pixel index
+
+    //sorts each chunk of entries on its own
+    class SortChunksBody : public cv::ParallelLoopBody
+    {
+    public:
+        SortChunksBody(std::vector<VoxelEntry> & entries, size_t chunk) : _entries(entries), _chunk(chunk) {}
+
+        virtual void operator()(const cv::Range & range) const
+        {
+            for (int c=range.start; c<range.end; c++)
+            {
+                size_t begin = c*_chunk;
+                size_t end = std::min(begin + _chunk, _entries.size());
+                std::sort(_entries.begin()+begin, _entries.begin()+end);
+            }
+        }
+
+    private:
+        std::vector<VoxelEntry> & _entries;
+        size_t _chunk;
+    };
+
+    //merges pairs of adjacent sorted runs of the given width
+    class MergeRunsBody : public cv::ParallelLoopBody
+    {
+    public:
+        MergeRunsBody(std::vector<VoxelEntry> & entries, size_t width) : _entries(entries), _width(width) {}
+
+        virtual void operator()(const cv::Range & range) const
+        {
+            for (int p=range.start; p<range.end; p++)
+            {
+                size_t begin = 2*p*_width;
+                size_t middle = std::min(begin + _width, _entries.size());
+                size_t end = std::min(begin + 2*_width, _entries.size());
+                std::inplace_merge(_entries.begin()+begin, _entries.begin()+middle, _entries.begin()+end);
+            }
+        }
+
+    private:
+        std::vector<VoxelEntry> & _entries;
+        size_t _width;
+    };
+
+    //averages the pixels of each voxel into its first pixel and clears the others, 
+    //every pixel of a voxel is mapped to the one that keeps the average
+    //voxels do not share pixels: they can be processed in any order
+    class VoxelAverageBody : public cv::ParallelLoopBody
+    {
+    public:
+        VoxelAverageBody(scan3d::Pointcloud & pointcloud, std::vector<int> const& offsets, std::vector<int> const& members, 
+                         std::vector<int> & kept) : 
+            _pointcloud(pointcloud), _offsets(offsets), _members(members), _kept(kept) {}
+
+        virtual void operator()(const cv::Range & range) const
+        {
+            const float nan = std::numeric_limits<float>::quiet_NaN();
+            const int cols = _pointcloud.points.cols;
+            const bool has_colors = (_pointcloud.colors.data && _pointcloud.colors.size()==_pointcloud.points.size());
+            const bool has_normals = (_pointcloud.normals.data && _pointcloud.normals.size()==_pointcloud.points.size());
+            for (int v=range.start; v<range.end; v++)
+            {
+                int begin = _offsets[v];
+                int end = _offsets[v+1];
+
+                cv::Vec3d point(0.0, 0.0, 0.0);
+                cv::Vec3d color(0.0, 0.0, 0.0);
+                cv::Vec3d normal(0.0, 0.0, 0.0);
+                for (int i=begin; i<end; i++)
+                {
+                    int h = _members[i]/cols;
+                    int w = _members[i]%cols;
+                    point += cv::Vec3d(_pointcloud.points.at<cv::Vec3f>(h, w));
+                    if (has_colors)
+                    {
+                        color += cv::Vec3d(_pointcloud.colors.at<cv::Vec3b>(h, w));
+                    }
+                    if (has_normals && !sl::INVALID(_pointcloud.normals.at<cv::Vec3f>(h, w)))
+                    {
+                        normal += cv::Vec3d(_pointcloud.normals.at<cv::Vec3f>(h, w));
+                    }
+                    if (i>begin)
+                    {
+                        _pointcloud.points.at<cv::Vec3f>(h, w) = cv::Vec3f(nan, nan, nan);
+                    }
+                    _kept[_members[i]] = _members[begin];
+                }
+
+                int h = _members[begin]/cols;
+                int w = _members[begin]%cols;
+                double scale = 1.0/(end-begin);
+                _pointcloud.points.at<cv::Vec3f>(h, w) = cv::Vec3f(point*scale);
+                if (has_colors)
+                {
+                    color *= scale;
+                    _pointcloud.colors.at<cv::Vec3b>(h, w) = cv::Vec3b(cv::saturate_cast<uchar>(color[0]), 
+                                                        cv::saturate_cast<uchar>(color[1]), cv::saturate_cast<uchar>(color[2]));
+                }
+                if (has_normals)
+                {
+                    double length = cv::norm(normal);
+                    _pointcloud.normals.at<cv::Vec3f>(h, w) = (length>0.0 ? cv::Vec3f(normal*(1.0/length)) : cv::Vec3f(nan, nan, nan));
+                }
+            }
+        }
+
+    private:
+        scan3d::Pointcloud & _pointcloud;
+        std::vector<int> const& _offsets;
+        std::vector<int> const& _members;
+        std::vector<int> & _kept;
+    };
+}
+
+size_t scan3d::voxel_downsample(scan3d::Pointcloud & pointcloud, double leaf_size)
+{
+    if (!pointcloud.points.data || leaf_size<=0.0)
+    {
+        return 0;
+    }
+
+    cv::Mat const& points = pointcloud.points;
+    size_t count = static_cast<size_t>(points.rows)*points.cols;
+    std::vector<unsigned long long> keys(count);
+    cv::parallel_for_(cv::Range(0, points.rows), VoxelKeysBody(points, 1.0/leaf_size, keys));
+
+    //valid pixels sorted by voxel: chunks in parallel, then pairwise merges of the sorted runs
+    std::vector<VoxelEntry> entries;
+    entries.reserve(count);
+    for (size_t i=0; i<count; i++)
+    {
+        if (keys[i]!=NO_VOXEL)
+        {
+            entries.push_back(VoxelEntry(keys[i], static_cast<int>(i)));
+        }
+    }
+    if (entries.empty())
+    {
+        return 0;
+    }
+    const size_t chunk = std::max<size_t>(4096, (entries.size() + cv::getNumberOfCPUs() - 1)/cv::getNumberOfCPUs());
+    cv::parallel_for_(cv::Range(0, static_cast<int>((entries.size() + chunk - 1)/chunk)), SortChunksBody(entries, chunk));
+    for (size_t width=chunk; width<entries.size(); width*=2)
+    {
+        cv::parallel_for_(cv::Range(0, static_cast<int>((entries.size() + 2*width - 1)/(2*width))), MergeRunsBody(entries, width));
+    }
+
+    //pixels grouped by voxel, in pixel order: the first one of each group keeps the average
+    std::vector<int> offsets(1, 0);
+    std::vector<int> members(entries.size());
+    for (size_t i=0; i<entries.size(); i++)
+    {
+        if (i>0 && entries[i].first!=entries[i-1].first)
+        {
+            offsets.push_back(static_cast<int>(i));
+        }
+        members[i] = entries[i].second;
+    }
+    offsets.push_back(static_cast<int>(entries.size()));
+
+    std::vector<int> kept(count, -1);
+    cv::parallel_for_(cv::Range(0, static_cast<int>(offsets.size())-1), VoxelAverageBody(pointcloud, offsets, members, kept));
+
+    //faces follow their vertices to the kept points, those left with less than three distinct vertices are dropped
+    size_t face_count = 0;
+    for (size_t f=0; f<pointcloud.faces.size(); f++)
+    {
+        cv::Vec3i const& face = pointcloud.faces[f];
+        cv::Vec3i remapped(kept[face[0]], kept[face[1]], kept[face[2]]);
+        if (remapped[0]>=0 && remapped[1]>=0 && remapped[2]>=0
+            && remapped[0]!=remapped[1] && remapped[1]!=remapped[2] && remapped[0]!=remapped[2])
+        {
+            pointcloud.faces[face_count++] = remapped;
+        }
+    }
+    pointcloud.faces.resize(face_count);
+
+    return offsets.size()-1;
+}
+
 cv::Mat scan3d::make_projector_view(cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
-                                        cv::Size const& projector_size, int threshold)
+                                        cv::Size const& projector_size, int threshold, bool columns)
 {
     if (!pattern_image.data || pattern_image.type()!=CV_32FC2)
     {   //pattern not correctly decoded
@@ -780,8 +2028,12 @@ cv::Mat scan3d::make_projector_view(cv::Mat const& pattern_image, cv::Mat const&
         register const cv::Vec2b * min_max_row = min_max_image.ptr<cv::Vec2b>(h);
         for (register int w=0; w<pattern_image.cols; w++)
         {
-            const cv::Vec2f & pattern = curr_pattern_row[w];
             const cv::Vec2b & min_max = min_max_row[w];
+            cv::Vec2f pattern = curr_pattern_row[w];
+            if (columns)
+            {
+                pattern[1] = static_cast<float>(h)*projector_size.height/pattern_image.rows;
+            }
 
             if (sl::INVALID(pattern) 
                 || pattern[0]<0.f || pattern[0]>=projector_size.width || pattern[1]<0.f || pattern[1]>=projector_size.height
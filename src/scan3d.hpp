@@ -28,8 +28,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef __SCAN3D_HPP__
 #define __SCAN3D_HPP__
 
-#include <QWidget>
 #include <QString>
+#include <vector>
 #include <opencv2/core/core.hpp>
 
 #ifndef _MSC_VER
@@ -40,9 +40,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 #include "CalibrationData.hpp"
+#include "Job.hpp"
 
 namespace scan3d
 {
+    enum OutlierMethod {NoOutliers = 0, StatisticalOutliers = 1, RadiusOutliers = 2};
+
     class Pointcloud
     {
     public:
@@ -55,19 +58,96 @@ namespace scan3d
         cv::Mat points;
         cv::Mat colors;
         cv::Mat normals;
+        std::vector<cv::Vec3i> faces;       //triangles as point indices (row*cols+col)
     };
 
+    //valid points only, as parallel arrays: memory and loops scale with the reconstructed points
+    //index is the position in the organized grid (row*cols+col), colors are RGB, 
+    //colors and normals are empty if the grid did not have them
+    class CompactPointcloud
+    {
+    public:
+        CompactPointcloud();
+
+        void clear(void);
+        inline size_t size(void) const {return points.size();}
+        inline bool empty(void) const {return points.empty();}
+
+        void from_pointcloud(Pointcloud const& pointcloud);
+        void to_pointcloud(Pointcloud & pointcloud) const;
+
+        //data
+        int rows;
+        int cols;
+        std::vector<cv::Vec3f> points;
+        std::vector<cv::Vec3b> colors;
+        std::vector<cv::Vec3f> normals;
+        std::vector<int> index;
+    };
+
+    //receives a reconstruction one row at a time, in order: 1 x cols CV_32FC3 points 
+    //(NaN where nothing was reconstructed) and CV_8UC3 colors
+    //returning false cancels the reconstruction
+    class RowSink
+    {
+    public:
+        virtual ~RowSink() {}
+        virtual bool begin(int rows, int cols) = 0;
+        virtual bool write_row(int row, cv::Mat const& points, cv::Mat const& colors) = 0;
+    };
+
+    //camera rays per pixel and projector column light planes, in camera coordinates
+    //they depend only on the calibration and the image sizes: build once, reuse for every set
+    class RayPlaneTables
+    {
+    public:
+        RayPlaneTables();
+
+        void clear(void);
+        bool init(CalibrationData const& calib, cv::Size const& camera_size, cv::Size const& projector_size);
+        bool matches(CalibrationData const& calib, cv::Size const& camera_size, cv::Size const& projector_size) const;
+
+        //data
+        cv::Mat rays;       //CV_32FC3, camera_size: undistorted (x, y, 1) of each pixel
+        cv::Mat planes;     //CV_32FC4, 1 x (projector width + 1): plane (n, d) with n.X + d = 0 of each column
+        cv::Size camera_size;
+        cv::Size projector_size;
+        CalibrationData calib; //calibration the tables were built from
+    };
+
+    //roi: camera image region to reconstruct, the whole image if empty; camera organized 
+    //pointclouds (simple, ray-plane) then have the size of the region
+    //progress: rows done and cancellation, polled by the caller; the reconstruction never touches the UI
     void reconstruct_model(Pointcloud & pointcloud, CalibrationData const& calib, 
             cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
-            cv::Size const& projector_size, int threshold, double max_dist, QWidget * parent_widget = NULL);
+            cv::Size const& projector_size, int threshold, double max_dist, JobProgress * progress = NULL, 
+            cv::Rect const& roi = cv::Rect());
 
     void reconstruct_model_simple(Pointcloud & pointcloud, CalibrationData const& calib, 
             cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
-            cv::Size const& projector_size, int threshold, double max_dist, QWidget * parent_widget = NULL);
+            cv::Size const& projector_size, int threshold, double max_dist, JobProgress * progress = NULL, 
+            cv::Rect const& roi = cv::Rect());
 
     void reconstruct_model_patch_center(Pointcloud & pointcloud, CalibrationData const& calib, 
             cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
-            cv::Size const& projector_size, int threshold, double max_dist, QWidget * parent_widget = NULL);
+            cv::Size const& projector_size, int threshold, double max_dist, JobProgress * progress = NULL, 
+            cv::Rect const& roi = cv::Rect());
+
+    //patch center reconstruction without a full-size pointcloud, rows go to the sink as they are completed
+    bool reconstruct_model_stream(RowSink & sink, CalibrationData const& calib, 
+            cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
+            cv::Size const& projector_size, int threshold, double max_dist, JobProgress * progress = NULL, 
+            cv::Rect const& roi = cv::Rect());
+
+    //camera ray - projector column plane intersection: only the column code is used, 
+    //the pointcloud is organized as the camera image
+    void reconstruct_model_ray_plane(Pointcloud & pointcloud, RayPlaneTables const& tables, 
+            cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
+            int threshold, JobProgress * progress = NULL, cv::Rect const& roi = cv::Rect());
+
+    bool reconstruct_model_ray_plane(RowSink & sink, RayPlaneTables const& tables, 
+            cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
+            int threshold, JobProgress * progress = NULL, cv::Rect const& roi = cv::Rect());
 
     void triangulate_stereo(const cv::Mat & K1, const cv::Mat & kc1, const cv::Mat & K2, const cv::Mat & kc2, 
                             const cv::Mat & Rt, const cv::Mat & T, const cv::Point2d & p1, const cv::Point2d & p2, 
@@ -77,10 +157,38 @@ namespace scan3d
                                         const cv::Point3d & v2, const cv::Point3d & q2,
                                         double * distance = NULL, double * out_lambda1 = NULL, double * out_lambda2 = NULL);
 
-    void compute_normals(scan3d::Pointcloud & pointcloud);
+    //window<=1: cross product of the 4-neighbors
+    //window>1: PCA of the (2*window+1)^2 neighborhood from integral images of the point moments, 
+    //          O(1) per point, normals oriented towards the camera
+    //confidence (optional): CV_32FC1, 1 for planar neighborhoods down to 0 for isotropic ones
+    void compute_normals(scan3d::Pointcloud & pointcloud, int window = 0, cv::Mat * confidence = NULL);
+
+    //4-neighbors normals of points_row1, first and last columns are not written
+    void compute_normals_row(const cv::Vec3f * points_row0, const cv::Vec3f * points_row1, const cv::Vec3f * points_row2, 
+                             int cols, cv::Vec3f * normals_row);
+
+    //triangles between valid neighbors of the organized grid, edges longer than max_edge are 
+    //dropped as depth discontinuities (max_edge<=0: no limit)
+    void make_mesh(scan3d::Pointcloud & pointcloud, double max_edge);
+
+    //outlier removal on the organized grid: the neighbors of a point are the valid points of its 
+    //(2*window+1)^2 neighborhood, removed points are set to NaN, returns how many were removed
+    //statistical: mean neighbor distance above mean + std_ratio*stddev of all points, or no neighbors
+    size_t remove_statistical_outliers(scan3d::Pointcloud & pointcloud, int window, double std_ratio);
+    //radius: fewer than min_neighbors neighbors closer than radius
+    size_t remove_radius_outliers(scan3d::Pointcloud & pointcloud, int window, double radius, int min_neighbors);
+
+    //one point per voxel of side leaf_size, the average of its points (colors, normals), stored at 
+    //the first pixel of the voxel so that the grid stays organized; faces are moved to the kept
+    //points and dropped when they collapse; returns the points left
+    size_t voxel_downsample(scan3d::Pointcloud & pointcloud, double leaf_size);
+
+    //21 bits per axis, centered at the origin
+    unsigned long long voxel_key(cv::Vec3f const& p, double inv_size);
 
+    //columns: there is no row code, pixels stay at their camera row scaled to the projector height
     cv::Mat make_projector_view(cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image, 
-                                        cv::Size const& projector_size, int threshold);
+                                        cv::Size const& projector_size, int threshold, bool columns = false);
 };
 
 #endif //__SCAN3D_HPP__
\ No newline at end of file
@@ -28,182 +28,800 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "structured_light.hpp"
 
 #include <iostream>
+#include <fstream>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include "instrument.hpp"
+
 namespace sl
 {
     const float PIXEL_UNCERTAIN = std::numeric_limits<float>::quiet_NaN();
     const unsigned short BIT_UNCERTAIN = 0xffff;
 };
 
-bool sl::decode_pattern(const std::vector<std::string> & images, cv::Mat & pattern_image, cv::Mat & min_max_image, cv::Size const& projector_size, unsigned flags, const cv::Mat & direct_light, unsigned m)
+namespace
+{
+    //bit repair: window radius, most undecided bits per code, widest code span 
+    //of the neighbors (larger is a depth discontinuity), fewest valid neighbors
+    const int REPAIR_RADIUS = 2;
+    const int REPAIR_MAX_UNKNOWN = 3;
+    const int REPAIR_MAX_SPAN = 4*REPAIR_RADIUS;
+    const int REPAIR_MIN_SUPPORT = 3;
+
+    inline int bit_count(unsigned value)
+    {
+        int count = 0;
+        for (; value; value&=value-1) {count++;}
+        return count;
+    }
+
+    //re-decodes the uncertain pixels from the valid codes around them, rows in parallel
+    //candidates are the codes next to the neighbors' (Gray adjacency), bounded by the nearest
+    //valid codes before and after along the scan direction (monotonic codes), the one that 
+    //disagrees least with the decided bits is kept if it agrees with all of them
+    class RepairBitsBody : public cv::ParallelLoopBody
+    {
+    public:
+        RepairBitsBody(cv::Mat const& decoded, cv::Mat const& codes, cv::Mat const& unknown, 
+                       unsigned total_bits, const int offset[2], bool binary, unsigned directions,
+                       cv::Mat & pattern_image, std::vector<int> & row_counts) : 
+            _decoded(decoded), _codes(codes), _unknown(unknown), _total_bits(total_bits), _offset(offset), 
+            _binary(binary), _directions(directions), _pattern_image(pattern_image), _row_counts(row_counts) {}
+
+        virtual void operator()(const cv::Range & range) const
+        {
+            const int full_mask = (1<<_total_bits) - 1;
+            for (int h=range.start; h<range.end; h++)
+            {
+                const cv::Vec2f * decoded_row = _decoded.ptr<cv::Vec2f>(h);
+                const cv::Vec2i * codes_row = _codes.ptr<cv::Vec2i>(h);
+                const cv::Vec2i * unknown_row = _unknown.ptr<cv::Vec2i>(h);
+                cv::Vec2f * pattern_row = _pattern_image.ptr<cv::Vec2f>(h);
+                int count = 0;
+                for (int w=0; w<_decoded.cols; w++)
+                {
+                    for (unsigned channel=0; channel<_directions; channel++)
+                    {
+                        int unknown = unknown_row[w][channel];
+                        if (!sl::INVALID(decoded_row[w][channel]) || unknown==0 || bit_count(unknown)>REPAIR_MAX_UNKNOWN)
+                        {   //valid, invalid for another reason, or too little left to go on
+                            continue;
+                        }
+                        int known_mask = full_mask & ~unknown;
+                        if (repair(h, w, channel, codes_row[w][channel] & known_mask, known_mask, pattern_row[w][channel]))
+                        {
+                            count++;
+                        }
+                    }
+                }
+                _row_counts[h] = count;
+            }
+        }
+
+    private:
+        inline int to_binary(int code, unsigned channel) const {return (_binary ? code : sl::grayToBinary(code, _offset[channel]));}
+        inline int from_binary(int code, unsigned channel) const {return (_binary ? code : sl::binaryToGray(code, _offset[channel]));}
+
+        bool repair(int h, int w, unsigned channel, int known, int known_mask, float & value) const
+        {
+            //the column code changes along rows, the row code along columns
+            const int along_x = (channel==0 ? 1 : 0);
+            int lo = std::numeric_limits<int>::max(), hi = std::numeric_limits<int>::min();
+            int before = 0, after = 0, before_dist = REPAIR_RADIUS+1, after_dist = REPAIR_RADIUS+1;
+            int support = 0;
+            long sum = 0;
+            for (int y=std::max(0, h-REPAIR_RADIUS); y<=std::min(_decoded.rows-1, h+REPAIR_RADIUS); y++)
+            {
+                const cv::Vec2f * decoded_row = _decoded.ptr<cv::Vec2f>(y);
+                for (int x=std::max(0, w-REPAIR_RADIUS); x<=std::min(_decoded.cols-1, w+REPAIR_RADIUS); x++)
+                {
+                    float neighbor = decoded_row[x][channel];
+                    if (sl::INVALID(neighbor))
+                    {
+                        continue;
+                    }
+                    int code = to_binary(static_cast<int>(neighbor), channel);
+                    lo = std::min(lo, code);
+                    hi = std::max(hi, code);
+                    sum += code;
+                    support++;
+
+                    int step = (along_x ? x-w : y-h);
+                    if ((along_x ? y==h : x==w) && step!=0)
+                    {   //same scan line
+                        if (step<0 && -step<before_dist) {before = code; before_dist = -step;}
+                        if (step>0 && step<after_dist) {after = code; after_dist = step;}
+                    }
+                }
+            }
+            if (support<REPAIR_MIN_SUPPORT || hi-lo>REPAIR_MAX_SPAN)
+            {
+                return false;
+            }
+
+            //Gray adjacency: the code is next to one of the neighbors
+            lo -= 1;
+            hi += 1;
+            if (before_dist<=REPAIR_RADIUS && after_dist<=REPAIR_RADIUS)
+            {   //monotonic: between the nearest codes on either side
+                lo = std::max(lo, std::min(before, after));
+                hi = std::min(hi, std::max(before, after));
+            }
+
+            int best = -1, best_errors = 0;
+            long best_spread = 0;
+            for (int code=lo; code<=hi; code++)
+            {
+                int gray = from_binary(code, channel);
+                if (gray<0 || gray>=(1<<_total_bits))
+                {   //outside the pattern
+                    continue;
+                }
+                int errors = bit_count((gray ^ known) & known_mask);
+                long spread = std::abs(code*support - sum);
+                if (best<0 || errors<best_errors || (errors==best_errors && spread<best_spread))
+                {
+                    best = gray;
+                    best_errors = errors;
+                    best_spread = spread;
+                }
+            }
+            if (best<0 || best_errors>0)
+            {
+                return false;
+            }
+            value = static_cast<float>(best);
+            return true;
+        }
+
+        cv::Mat const& _decoded;
+        cv::Mat const& _codes;
+        cv::Mat const& _unknown;
+        unsigned _total_bits;
+        const int * _offset;
+        bool _binary;
+        unsigned _directions;
+        cv::Mat & _pattern_image;
+        std::vector<int> & _row_counts;
+    };
+};
+
+bool sl::decode_pattern(const std::vector<std::string> & images, cv::Mat & pattern_image, cv::Mat & min_max_image, cv::Size const& projector_size, unsigned flags, const cv::Mat & direct_light, unsigned m, DecodeAux * aux, unsigned shadow)
+{
+    FileFrameSource source(images);
+    return decode_pattern(source, pattern_image, min_max_image, projector_size, flags, direct_light, m, aux, shadow);
+}
+
+bool sl::decode_pattern(FrameSource & images, cv::Mat & pattern_image, cv::Mat & min_max_image, cv::Size const& projector_size, unsigned flags, const cv::Mat & direct_light, unsigned m, DecodeAux * aux, unsigned shadow)
 {
     bool binary   = (flags & GrayPatternDecode)!=GrayPatternDecode;
     bool robust   = (flags & RobustDecode)==RobustDecode;
+    bool single   = (flags & ThresholdDecode)==ThresholdDecode;
+    bool columns  = (flags & ColumnDecode)==ColumnDecode;
+    bool repair   = (flags & RepairDecode)==RepairDecode && robust;
 
-    std::cout << " --- decode_pattern START ---\n";
+    instrument::ScopedTimer timer("bit_decode");
 
     //delete previous data
     pattern_image = cv::Mat();
     min_max_image = cv::Mat();
+    if (aux)
+    {
+        *aux = DecodeAux();
+    }
     bool init = true;
 
     std::cout << "Decode: " << (binary?"Binary ":"Gray ")
                             << (robust?"Robust ":"") 
+                            << (single?"Threshold ":"") 
+                            << (columns?"Columns ":"") 
+                            << (repair?"Repair ":"") 
+                            << (shadow>0?"Active ":"") 
                             << std::endl;
 
+    // images: white, black, then for each direction (columns, and rows unless 'columns') 
+    //         one image per bit from MSB to LSB, followed by its inverse unless 'single'
+    const unsigned per_bit = (single ? 1 : 2);
+    const unsigned directions = (columns ? 1 : 2);
     unsigned int total_images = static_cast<unsigned int>(images.size());
-    unsigned int total_patterns = total_images/2 - 1;
-    unsigned int total_bits = total_patterns/2;
-    if (2+4*total_bits!=total_images)
+    unsigned int total_bits = (total_images<2 ? 0 : (total_images-2)/(per_bit*directions));
+    if (total_bits<1 || 2+per_bit*directions*total_bits!=total_images)
     {   //error
         std::cout << "[sl::decode_pattern] ERROR: cannot detect pattern and bit count from image set.\n";
         return false;
     }
 
-    const unsigned bit_count[] = {0, total_bits, total_bits};  //pattern bits
-    const unsigned set_size[]  = {1, total_bits, total_bits};  //number of image pairs
-    const unsigned COUNT = 2*(set_size[0]+set_size[1]+set_size[2]); //total image count
     const int pattern_offset[2] = {((1<<total_bits)-projector_size.width)/2, ((1<<total_bits)-projector_size.height)/2};
 
-    if (images.size()<COUNT)
-    {   //error
-        std::cout << "Image list size does not match set size, please supply exactly " << COUNT << " image names.\n";
-        return false;
-    }
+    //bit repair: decided bits and undecided bit mask of each code
+    cv::Mat codes, unknown;
 
-    //load every image pair and compute the maximum, minimum, and bit code
-    unsigned set = 0;
-    unsigned current = 0;
-    for (unsigned t=0; t<COUNT; t+=2, current++)
+    //single image per bit: the threshold is the mean of the white and black images
+    //shadow mask: pixels with less white-black contrast than 'shadow' are not decoded,
+    //the others are listed per row and leave their list as soon as their code in the current direction is invalid
+    std::vector<std::vector<int> > active;
+    cv::Mat threshold_image;
+    if (single || shadow>0)
     {
-        if (current==set_size[set])
+        const cv::Mat & white_image = images.get_gray_image(0);
+        const cv::Mat & black_image = images.get_gray_image(1);
+        if (white_image.rows<1 || black_image.rows<1 || white_image.size()!=black_image.size())
         {
-            set++;
-            current = 0;
+            std::cout << "Failed to load white and black images" << std::endl;
+            return false;
         }
-
-        if (set==0)
-        {   //skip
-            continue;
+        if (robust && !single && white_image.size()!=direct_light.size())
+        {   //different size
+            std::cout << " --> Direct Component image has different size: \n";
+            return false;
         }
-
-        unsigned bit = bit_count[set] - current - 1; //current bit: from 0 to (bit_count[set]-1)
-        unsigned channel = set - 1;
-
-        //load images
-        const cv::Mat & gray_image1 = get_gray_image(images.at(t+0));
-        if (gray_image1.rows<1)
+        if (single)
         {
-            std::cout << "Failed to load " << images.at(t+0) << std::endl;
-            return false;
+            cv::addWeighted(white_image, 0.5, black_image, 0.5, 0.0, threshold_image);
         }
-        const cv::Mat & gray_image2 = get_gray_image(images.at(t+1));
-        if (gray_image2.rows<1)
+        if (shadow>0)
         {
-            std::cout << "Failed to load " << images.at(t+1) << std::endl;
-            return false;
+            active.resize(white_image.rows);
         }
 
-        //initialize data structures
-        if (init)
+        pattern_image = cv::Mat(white_image.size(), CV_32FC2);
+        min_max_image = cv::Mat(white_image.size(), CV_8UC2);
+        for (int h=0; h<pattern_image.rows; h++)
         {
-            //sanity check
-            if (gray_image1.size()!=gray_image2.size())
-            {   //different size
-                std::cout << " --> Initial images have different size: \n";
-                return false;
-            }
-            if (robust && gray_image1.size()!=direct_light.size())
-            {   //different size
-                std::cout << " --> Direct Component image has different size: \n";
-                return false;
+            const unsigned char * row1 = white_image.ptr<unsigned char>(h);
+            const unsigned char * row2 = black_image.ptr<unsigned char>(h);
+            cv::Vec2f * pattern_row = pattern_image.ptr<cv::Vec2f>(h);
+            cv::Vec2b * min_max_row = min_max_image.ptr<cv::Vec2b>(h);
+            for (int w=0; w<pattern_image.cols; w++)
+            {
+                unsigned char low = std::min(row1[w], row2[w]);
+                unsigned char high = std::max(row1[w], row2[w]);
+                if (shadow>0 && static_cast<unsigned>(high-low)<shadow)
+                {   //shadow: never decoded
+                    pattern_row[w] = cv::Vec2f(PIXEL_UNCERTAIN, PIXEL_UNCERTAIN);
+                    min_max_row[w] = cv::Vec2b(low, high);
+                    continue;
+                }
+                if (shadow>0)
+                {
+                    active[h].push_back(w);
+                }
+                pattern_row[w] = cv::Vec2f(0.f, (columns ? PIXEL_UNCERTAIN : 0.f));
+                //pairs: min/max start empty, as if initialized by the first pair
+                min_max_row[w] = (single ? cv::Vec2b(low, high) : cv::Vec2b(255, 0));
             }
-            pattern_image = cv::Mat(gray_image1.size(), CV_32FC2);
-            min_max_image = cv::Mat(gray_image1.size(), CV_8UC2);
         }
-
-        //sanity check
-        if (gray_image1.size()!=pattern_image.size())
-        {   //different size
-            std::cout << " --> Image 1 has different size, image pair " << t << " (skipped!)\n";
-            continue;
+        if (aux)
+        {
+            aux->margin = cv::Mat(white_image.size(), CV_8UC1, cv::Scalar(255));
+            aux->uncertain = cv::Mat::zeros(white_image.size(), CV_8UC1);
         }
-        if (gray_image2.size()!=pattern_image.size())
-        {   //different size
-            std::cout << " --> Image 2 has different size, image pair " << t << " (skipped!)\n";
-            continue;
+        if (repair)
+        {
+            codes = cv::Mat::zeros(white_image.size(), CV_32SC2);
+            unknown = cv::Mat::zeros(white_image.size(), CV_32SC2);
         }
+        init = false;
+    }
 
-        //compare
-        for (int h=0; h<pattern_image.rows; h++)
+    //each direction starts again from the pixels out of the shadow: 
+    //a pixel with an invalid column code still gets its row code
+    const std::vector<std::vector<int> > shadow_active = (directions>1 ? active : std::vector<std::vector<int> >());
+
+    //load every image (pair) and compute the maximum, minimum, and bit code
+    for (unsigned channel=0; channel<directions; channel++)
+    {
+        if (channel>0 && !active.empty())
         {
-            const unsigned char * row1 = gray_image1.ptr<unsigned char>(h);
-            const unsigned char * row2 = gray_image2.ptr<unsigned char>(h);
-            const cv::Vec2b * row_light = (robust ? direct_light.ptr<cv::Vec2b>(h) : NULL);
-            cv::Vec2f * pattern_row = pattern_image.ptr<cv::Vec2f>(h);
-            cv::Vec2b * min_max_row = min_max_image.ptr<cv::Vec2b>(h);
+            active = shadow_active;
+        }
 
-            for (int w=0; w<pattern_image.cols; w++)
+        for (unsigned current=0; current<total_bits; current++)
+        {
+            unsigned bit = total_bits - current - 1; //current bit: from 0 to (total_bits-1)
+            unsigned t = 2 + per_bit*(channel*total_bits + current);
+
+            //load images
+            const cv::Mat & gray_image1 = images.get_gray_image(t+0);
+            if (gray_image1.rows<1)
+            {
+                std::cout << "Failed to load image " << t+0 << std::endl;
+                return false;
+            }
+            const cv::Mat & gray_image2 = (single ? threshold_image : images.get_gray_image(t+1));
+            if (gray_image2.rows<1)
             {
-                cv::Vec2f & pattern = pattern_row[w];
-                cv::Vec2b & min_max = min_max_row[w];
-                unsigned char value1 = row1[w];
-                unsigned char value2 = row2[w];
+                std::cout << "Failed to load image " << t+1 << std::endl;
+                return false;
+            }
 
-                if (init)
-                {
-                    pattern[0] = 0.f; //vertical
-                    pattern[1] = 0.f; //horizontal
+            //initialize data structures
+            if (init)
+            {
+                //sanity check
+                if (gray_image1.size()!=gray_image2.size())
+                {   //different size
+                    std::cout << " --> Initial images have different size: \n";
+                    return false;
                 }
-
-                //min/max
-                if (init || value1<min_max[0] || value2<min_max[0])
+                if (robust && gray_image1.size()!=direct_light.size())
+                {   //different size
+                    std::cout << " --> Direct Component image has different size: \n";
+                    return false;
+                }
+                pattern_image = cv::Mat(gray_image1.size(), CV_32FC2);
+                min_max_image = cv::Mat(gray_image1.size(), CV_8UC2);
+                if (aux)
                 {
-                    min_max[0] = (value1<value2?value1:value2);
+                    aux->margin = cv::Mat(gray_image1.size(), CV_8UC1, cv::Scalar(255));
+                    aux->uncertain = cv::Mat::zeros(gray_image1.size(), CV_8UC1);
                 }
-                if (init || value1>min_max[1] || value2>min_max[1])
+                if (repair)
                 {
-                    min_max[1] = (value1>value2?value1:value2);
+                    codes = cv::Mat::zeros(gray_image1.size(), CV_32SC2);
+                    unknown = cv::Mat::zeros(gray_image1.size(), CV_32SC2);
                 }
-                
-                if (!robust)
-                {   // [simple] pattern bit assignment
-                    if (value1>value2)
-                    {   //set bit n to 1
-                        pattern[channel] += (1<<bit);
+            }
+
+            //sanity check
+            if (gray_image1.size()!=pattern_image.size())
+            {   //different size
+                std::cout << " --> Image 1 has different size, image pair " << t << " (skipped!)\n";
+                continue;
+            }
+            if (gray_image2.size()!=pattern_image.size())
+            {   //different size
+                std::cout << " --> Image 2 has different size, image pair " << t << " (skipped!)\n";
+                continue;
+            }
+
+            //compare
+            for (int h=0; h<pattern_image.rows; h++)
+            {
+                const unsigned char * row1 = gray_image1.ptr<unsigned char>(h);
+                const unsigned char * row2 = gray_image2.ptr<unsigned char>(h);
+                const cv::Vec2b * row_light = (robust && !single ? direct_light.ptr<cv::Vec2b>(h) : NULL);
+                cv::Vec2f * pattern_row = pattern_image.ptr<cv::Vec2f>(h);
+                cv::Vec2b * min_max_row = min_max_image.ptr<cv::Vec2b>(h);
+                unsigned char * margin_row = (aux ? aux->margin.ptr<unsigned char>(h) : NULL);
+                unsigned char * uncertain_row = (aux ? aux->uncertain.ptr<unsigned char>(h) : NULL);
+                cv::Vec2i * codes_row = (repair ? codes.ptr<cv::Vec2i>(h) : NULL);
+                cv::Vec2i * unknown_row = (repair ? unknown.ptr<cv::Vec2i>(h) : NULL);
+
+                const int count = (active.empty() ? pattern_image.cols : static_cast<int>(active[h].size()));
+                for (int k=0; k<count; k++)
+                {
+                    const int w = (active.empty() ? k : active[h][k]);
+                    cv::Vec2f & pattern = pattern_row[w];
+                    cv::Vec2b & min_max = min_max_row[w];
+                    unsigned char value1 = row1[w];
+                    unsigned char value2 = row2[w];
+                    unsigned char diff = (value1>value2 ? value1-value2 : value2-value1);
+
+                    if (margin_row && diff<margin_row[w])
+                    {
+                        margin_row[w] = diff;
                     }
-                }
-                else
-                {   // [robust] pattern bit assignment
-                    if (row_light && (init || pattern[channel]!=PIXEL_UNCERTAIN))
+
+                    if (init)
                     {
-                        const cv::Vec2b & L = row_light[w];
-                        unsigned short p = get_robust_bit(value1, value2, L[0], L[1], m);
-                        if (p==BIT_UNCERTAIN)
-                        {
+                        pattern[0] = 0.f; //vertical
+                        pattern[1] = (columns ? PIXEL_UNCERTAIN : 0.f); //horizontal
+                    }
+
+                    if (single)
+                    {   // [threshold] pattern bit assignment, min/max come from the white and black images
+                        if (robust && diff<m)
+                        {   //too close to the threshold
                             pattern[channel] = PIXEL_UNCERTAIN;
+                            if (uncertain_row && uncertain_row[w]<255)
+                            {
+                                uncertain_row[w]++;
+                            }
+                            if (unknown_row)
+                            {
+                                unknown_row[w][channel] |= (1<<bit);
+                            }
+                        }
+                        else if (value1>value2)
+                        {   //set bit n to 1
+                            pattern[channel] += (1<<bit);
+                            if (codes_row)
+                            {
+                                codes_row[w][channel] |= (1<<bit);
+                            }
+                        }
+                        continue;
+                    }
+
+                    //min/max
+                    if (init || value1<min_max[0] || value2<min_max[0])
+                    {
+                        min_max[0] = (value1<value2?value1:value2);
+                    }
+                    if (init || value1>min_max[1] || value2>min_max[1])
+                    {
+                        min_max[1] = (value1>value2?value1:value2);
+                    }
+                    
+                    if (!robust)
+                    {   // [simple] pattern bit assignment
+                        if (value1>value2)
+                        {   //set bit n to 1
+                            pattern[channel] += (1<<bit);
+                        }
+                    }
+                    else
+                    {   // [robust] pattern bit assignment
+                        //uncertain pixels are skipped, unless every bit is being counted or kept for repair
+                        if (row_light && (init || uncertain_row || codes_row || !INVALID(pattern[channel])))
+                        {
+                            const cv::Vec2b & L = row_light[w];
+                            unsigned short p = get_robust_bit(value1, value2, L[0], L[1], m);
+                            if (p==BIT_UNCERTAIN)
+                            {
+                                pattern[channel] = PIXEL_UNCERTAIN;
+                                if (uncertain_row && uncertain_row[w]<255)
+                                {
+                                    uncertain_row[w]++;
+                                }
+                                if (unknown_row)
+                                {
+                                    unknown_row[w][channel] |= (1<<bit);
+                                }
+                            }
+                            else
+                            {
+                                if (!INVALID(pattern[channel]))
+                                {
+                                    pattern[channel] += (p<<bit);
+                                }
+                                if (codes_row)
+                                {
+                                    codes_row[w][channel] |= (p<<bit);
+                                }
+                            }
+                        }
+                    }
+
+                }   //for each column
+            }   //for each row
+
+            if (!active.empty() && !aux && !repair)
+            {   //early rejection: a pixel with an invalid code in this direction skips its remaining bits, unless they are still needed
+                for (int h=0; h<pattern_image.rows; h++)
+                {
+                    cv::Vec2f * pattern_row = pattern_image.ptr<cv::Vec2f>(h);
+                    std::vector<int> & active_row = active[h];
+                    size_t kept = 0;
+                    for (size_t k=0; k<active_row.size(); k++)
+                    {
+                        int w = active_row[k];
+                        if (INVALID(pattern_row[w][channel]))
+                        {
+                            pattern_row[w][channel] = PIXEL_UNCERTAIN;
                         }
                         else
                         {
-                            pattern[channel] += (p<<bit);
+                            active_row[kept++] = w;
                         }
                     }
+                    active_row.resize(kept);
                 }
+            }
 
-            }   //for each column
-        }   //for each row
+            init = false;
+        }   //for each bit
+    }   //for each direction
 
-        init = false;
-    }   //for all image pairs
+    if (repair)
+    {   //neighbors are read from a copy so the result does not depend on the order rows are done
+        cv::Mat decoded = pattern_image.clone();
+        std::vector<int> row_counts(pattern_image.rows, 0);
+        cv::parallel_for_(cv::Range(0, pattern_image.rows), 
+                          RepairBitsBody(decoded, codes, unknown, total_bits, pattern_offset, binary, directions, pattern_image, row_counts));
+        int repaired = 0;
+        for (size_t i=0; i<row_counts.size(); i++)
+        {
+            repaired += row_counts[i];
+        }
+        instrument::count("codes_repaired", repaired);
+    }
+
+    if (aux)
+    {   //direct/global ratio and confidence
+        const bool with_light = (robust && !single && direct_light.size()==pattern_image.size());
+        if (with_light)
+        {
+            aux->direct_ratio = cv::Mat(pattern_image.size(), CV_32FC1);
+        }
+        aux->confidence = cv::Mat(pattern_image.size(), CV_32FC1);
+
+        //a pair differs by at most the contrast, a single image by half of it from the threshold
+        const float scale = (single ? 2.f : 1.f);
+        for (int h=0; h<pattern_image.rows; h++)
+        {
+            const cv::Vec2f * pattern_row = pattern_image.ptr<cv::Vec2f>(h);
+            const cv::Vec2b * min_max_row = min_max_image.ptr<cv::Vec2b>(h);
+            const unsigned char * margin_row = aux->margin.ptr<unsigned char>(h);
+            float * confidence_row = aux->confidence.ptr<float>(h);
+            if (with_light)
+            {
+                const cv::Vec2b * row_light = direct_light.ptr<cv::Vec2b>(h);
+                float * ratio_row = aux->direct_ratio.ptr<float>(h);
+                for (int w=0; w<pattern_image.cols; w++)
+                {
+                    ratio_row[w] = static_cast<float>(row_light[w][0])/std::max(1, static_cast<int>(row_light[w][1]));
+                }
+            }
+            for (int w=0; w<pattern_image.cols; w++)
+            {
+                const cv::Vec2f & pattern = pattern_row[w];
+                if (INVALID(pattern[0]) || (!columns && INVALID(pattern[1])))
+                {
+                    confidence_row[w] = 0.f;
+                    continue;
+                }
+                int contrast = std::max(1, min_max_row[w][1] - min_max_row[w][0]);
+                confidence_row[w] = std::min(1.f, scale*margin_row[w]/contrast);
+            }
+        }
+    }
 
     if (!binary)
     {   //not binary... it must be gray code
         convert_pattern(pattern_image, projector_size, pattern_offset, binary);
     }
 
-    std::cout << " --- decode_pattern END ---\n";
+    return true;
+}
+
+namespace
+{
+    //decodes one band of rows, with a margin of extra rows read around it
+    class DecodeBandBody : public cv::ParallelLoopBody
+    {
+    public:
+        DecodeBandBody(sl::FrameSource & images, cv::Size const& projector_size, unsigned flags, 
+                       const std::vector<size_t> & direct_frames, float b, unsigned m, unsigned shadow, int band_rows, int margin,
+                       cv::Mat & pattern_image, cv::Mat & min_max_image, sl::DecodeAux * aux, std::vector<unsigned char> & band_ok) : 
+            _images(images), _projector_size(projector_size), _flags(flags), _direct_frames(direct_frames), _b(b), _m(m), _shadow(shadow), 
+            _band_rows(band_rows), _margin(margin), _pattern_image(pattern_image), _min_max_image(min_max_image), _aux(aux), _band_ok(band_ok) {}
+
+        virtual void operator()(const cv::Range & range) const
+        {
+            const bool direct = (_flags & sl::RobustDecode) && !(_flags & sl::ThresholdDecode);
+            for (int k=range.start; k<range.end; k++)
+            {
+                int row_start = k*_band_rows;
+                int row_end = std::min(row_start+_band_rows, _pattern_image.rows);
+                int read_start = std::max(0, row_start-_margin);
+                int read_end = std::min(_pattern_image.rows, row_end+_margin);
+                sl::BandFrameSource band(_images, read_start, read_end);
+                sl::RetainFrameSource retain_band(band, (direct ? _direct_frames : std::vector<size_t>()));
+
+                cv::Mat direct_light;
+                if (direct)
+                {
+                    sl::DirectLightAccumulator accumulator(_b);
+                    for (size_t i=0; i<_direct_frames.size(); i++)
+                    {
+                        accumulator.add(retain_band.get_gray_image(_direct_frames[i]));
+                    }
+                    direct_light = accumulator.finish();
+                }
+
+                cv::Mat pattern_band, min_max_band;
+                sl::DecodeAux aux;
+                if (!sl::decode_pattern(retain_band, pattern_band, min_max_band, _projector_size, _flags, direct_light, _m, (_aux ? &aux : NULL), _shadow))
+                {
+                    continue;
+                }
+                cv::Range inner(row_start-read_start, row_end-read_start);
+                pattern_band.rowRange(inner).copyTo(_pattern_image.rowRange(row_start, row_end));
+                min_max_band.rowRange(inner).copyTo(_min_max_image.rowRange(row_start, row_end));
+                if (_aux)
+                {
+                    copy_rows(aux.margin, inner, _aux->margin, row_start);
+                    copy_rows(aux.uncertain, inner, _aux->uncertain, row_start);
+                    copy_rows(aux.direct_ratio, inner, _aux->direct_ratio, row_start);
+                    copy_rows(aux.confidence, inner, _aux->confidence, row_start);
+                }
+                _band_ok[k] = 1;
+            }
+        }
+
+    private:
+        static void copy_rows(cv::Mat const& band, cv::Range const& inner, cv::Mat & image, int row_start)
+        {
+            if (band.data && image.data)
+            {
+                band.rowRange(inner).copyTo(image.rowRange(row_start, row_start+inner.size()));
+            }
+        }
+
+        sl::FrameSource & _images;
+        cv::Size const& _projector_size;
+        unsigned _flags;
+        const std::vector<size_t> & _direct_frames;
+        float _b;
+        unsigned _m;
+        unsigned _shadow;
+        int _band_rows;
+        int _margin;
+        cv::Mat & _pattern_image;
+        cv::Mat & _min_max_image;
+        sl::DecodeAux * _aux;
+        std::vector<unsigned char> & _band_ok;
+    };
+};
+
+bool sl::decode_pattern_tiled(FrameSource & images, cv::Mat & pattern_image, cv::Mat & min_max_image, cv::Size const& projector_size,
+                              unsigned flags, const std::vector<size_t> & direct_frames, float b, unsigned m, int band_rows, DecodeAux * aux, unsigned shadow)
+{
+    pattern_image = cv::Mat();
+    min_max_image = cv::Mat();
+    if (aux)
+    {
+        *aux = DecodeAux();
+    }
+
+    cv::Size size = images.frame_size();
+    if (size.height<1 || band_rows<1)
+    {
+        std::cout << "[sl::decode_pattern_tiled] ERROR: no frames or no band size.\n";
+        return false;
+    }
+
+    //only the results are full frame
+    pattern_image = cv::Mat(size, CV_32FC2);
+    min_max_image = cv::Mat(size, CV_8UC2);
+    if (aux)
+    {
+        aux->margin = cv::Mat(size, CV_8UC1);
+        aux->uncertain = cv::Mat(size, CV_8UC1);
+        if ((flags & RobustDecode) && !(flags & ThresholdDecode))
+        {
+            aux->direct_ratio = cv::Mat(size, CV_32FC1);
+        }
+        aux->confidence = cv::Mat(size, CV_32FC1);
+    }
+
+    int margin = ((flags & RepairDecode) ? REPAIR_RADIUS : 0);
+    int bands = (size.height + band_rows - 1)/band_rows;
+    std::vector<unsigned char> band_ok(bands, 0);
+    cv::parallel_for_(cv::Range(0, bands), 
+                      DecodeBandBody(images, projector_size, flags, direct_frames, b, m, shadow, band_rows, margin, pattern_image, min_max_image, aux, band_ok));
+
+    if (std::find(band_ok.begin(), band_ok.end(), 0)!=band_ok.end())
+    {
+        std::cout << "[sl::decode_pattern_tiled] ERROR: cannot decode every band.\n";
+        pattern_image = cv::Mat();
+        min_max_image = cv::Mat();
+        if (aux)
+        {
+            *aux = DecodeAux();
+        }
+        return false;
+    }
+    return true;
+}
+
+size_t sl::reject_low_confidence(cv::Mat & pattern_image, const cv::Mat & confidence, float min_confidence)
+{
+    if (pattern_image.type()!=CV_32FC2 || confidence.type()!=CV_32FC1 || pattern_image.size()!=confidence.size())
+    {
+        return 0;
+    }
+
+    size_t count = 0;
+    for (int h=0; h<pattern_image.rows; h++)
+    {
+        cv::Vec2f * pattern_row = pattern_image.ptr<cv::Vec2f>(h);
+        const float * confidence_row = confidence.ptr<float>(h);
+        for (int w=0; w<pattern_image.cols; w++)
+        {
+            if (confidence_row[w]<min_confidence && !INVALID(pattern_row[w][0]))
+            {
+                pattern_row[w] = cv::Vec2f(PIXEL_UNCERTAIN, PIXEL_UNCERTAIN);
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+bool sl::decode_phase(const std::vector<std::string> & images, cv::Mat & pattern_image, unsigned steps, float period, float min_amplitude)
+{
+    FileFrameSource source(images);
+    return decode_phase(source, pattern_image, steps, period, min_amplitude);
+}
+
+bool sl::decode_phase(FrameSource & images, cv::Mat & pattern_image, unsigned steps, float period, float min_amplitude)
+{
+    // images: 'steps' vertical fringes followed by 'steps' horizontal fringes (omitted in column sets),
+    //   I_k = A + B*cos(phi + 2*pi*k/steps), phi = 2*pi*x/period
+    // pattern_image: integer gray code values, replaced by the unwrapped phase
+    if (steps<3 || (images.size()!=steps && images.size()!=2*steps) || period<=0.f)
+    {   //error
+        std::cout << "[sl::decode_phase] ERROR: expected " << 2*steps << " images with 3 or more steps.\n";
+        return false;
+    }
+    if (pattern_image.rows==0 || pattern_image.type()!=CV_32FC2)
+    {   //no gray code to unwrap against
+        std::cout << "[sl::decode_phase] ERROR: invalid pattern image.\n";
+        return false;
+    }
+
+    instrument::ScopedTimer timer("phase_decode");
+
+    const float scale = static_cast<float>(period/(2.0*CV_PI));
+    const float amplitude_scale = 2.f/steps;
+    unsigned total_valid = 0;
+
+    unsigned directions = static_cast<unsigned>(images.size())/steps;
+    for (unsigned channel=0; channel<directions; channel++)
+    {
+        //accumulate C = sum(I_k*cos(d_k)) and S = -sum(I_k*sin(d_k)), then phi = atan2(S, C)
+        cv::Mat C = cv::Mat::zeros(pattern_image.size(), CV_32FC1);
+        cv::Mat S = cv::Mat::zeros(pattern_image.size(), CV_32FC1);
+        cv::Mat image32;
+        for (unsigned k=0; k<steps; k++)
+        {
+            unsigned index = channel*steps + k;
+            cv::Mat gray_image = images.get_gray_image(index);
+            if (gray_image.rows<1)
+            {
+                std::cout << "Failed to load phase image " << index << std::endl;
+                return false;
+            }
+            if (gray_image.size()!=pattern_image.size())
+            {   //different size
+                std::cout << " --> Phase image " << index << " has different size" << std::endl;
+                return false;
+            }
+            gray_image.convertTo(image32, CV_32F);
+
+            double delta = 2.0*CV_PI*k/steps;
+            cv::scaleAdd(image32,  cos(delta), C, C);
+            cv::scaleAdd(image32, -sin(delta), S, S);
+        }
+
+        cv::Mat phase, amplitude;
+        cv::phase(C, S, phase);             //[0, 2*pi)
+        cv::magnitude(C, S, amplitude);     //steps/2*B
+
+        //unwrap: choose the fringe order which places the phase inside the gray code pixel
+        for (int h=0; h<pattern_image.rows; h++)
+        {
+            const float * phase_row = phase.ptr<float>(h);
+            const float * amplitude_row = amplitude.ptr<float>(h);
+            cv::Vec2f * pattern_row = pattern_image.ptr<cv::Vec2f>(h);
+            for (int w=0; w<pattern_image.cols; w++)
+            {
+                float & code = pattern_row[w][channel];
+                if (INVALID(code) || amplitude_row[w]*amplitude_scale<min_amplitude)
+                {   //keep the gray code value
+                    continue;
+                }
+                float center = code + 0.5f;
+                float fraction = phase_row[w]*scale;
+                float order = std::floor((center - fraction)/period + 0.5f);
+                float value = order*period + fraction;
+                if (std::fabs(value - center)<=1.5f)
+                {   //phase agrees with gray code
+                    code = value;
+                    total_valid++;
+                }
+            }
+        }
+    }
+
+    instrument::count("phase_values", total_valid);
 
     return true;
 }
@@ -240,6 +858,7 @@ void sl::convert_pattern(cv::Mat & pattern_image, cv::Size const& projector_size
         return;
     }
 
+    instrument::ScopedTimer timer("gray_code_conversion");
     if (binary)
     {
        std::cout << "Converting binary code to gray\n";
@@ -295,81 +914,414 @@ void sl::convert_pattern(cv::Mat & pattern_image, cv::Size const& projector_size
     }
 }
 
-cv::Mat sl::estimate_direct_light(const std::vector<cv::Mat> & images, float b)
+std::vector<size_t> sl::direct_light_frames(int direction_images, int directions)
 {
-    static const unsigned COUNT = 10; // max number of images
+    const int count = 4;
+    const int offset = 4;
 
-    unsigned count = static_cast<int>(images.size());
-    if (count<1)
-    {   //no images
-        return cv::Mat();
+    std::vector<size_t> frames;
+    if (direction_images<count+offset)
+    {   //too few images
+        return frames;
     }
-    
-    std::cout << " --- estimate_direct_light START ---\n";
 
-    if (count>COUNT)
+    //white and black come first
+    for (int i=0; i<count; i++)
     {
-        count = COUNT;
-        std::cout << "WARNING: Using only " << COUNT << " of " << count << std::endl;
+        int frame = 2 + direction_images - count - offset + i;
+        frames.push_back(frame);
+        if (directions>1)
+        {
+            frames.push_back(frame + direction_images);
+        }
     }
+    return frames;
+}
 
-    for (unsigned i=0; i<count; i++)
+cv::Mat sl::estimate_direct_light(const std::vector<cv::Mat> & images, float b)
+{
+    DirectLightAccumulator accumulator(b);
+    for (size_t i=0; i<images.size(); i++)
     {
-        if (images.at(i).type()!=CV_8UC1)
-        {   //error
-            std::cout << "Gray images required\n";
+        if (!accumulator.add(images[i]))
+        {
             return cv::Mat();
         }
     }
+    return accumulator.finish();
+}
+
+bool sl::DirectLightAccumulator::add(const cv::Mat & gray_image)
+{
+    if (gray_image.type()!=CV_8UC1 || (_count>0 && gray_image.size()!=_min.size()))
+    {   //error
+        std::cout << "[DirectLightAccumulator] Gray images of the same size required\n";
+        return false;
+    }
+
+    instrument::ScopedTimer timer("direct_light");
+    if (_count==0)
+    {
+        _min = gray_image.clone();
+        _max = gray_image.clone();
+    }
+    else
+    {   //vectorized by OpenCV
+        cv::min(_min, gray_image, _min);
+        cv::max(_max, gray_image, _max);
+    }
+    _count++;
+    return true;
+}
+
+namespace
+{
+    //Ld and Lg from the minimum and maximum images, rows in parallel
+    class DirectLightBody : public cv::ParallelLoopBody
+    {
+    public:
+        DirectLightBody(cv::Mat const& min_image, cv::Mat const& max_image, float b, cv::Mat & direct_light) : 
+            _min_image(min_image), _max_image(max_image), _b(b), _b1(1.f/(1.f - b)), _b2(2.f/(1.f - b*b)), _direct_light(direct_light) {}
+
+        virtual void operator()(const cv::Range & range) const
+        {
+            for (int h=range.start; h<range.end; h++)
+            {
+                const unsigned char * min_row = _min_image.ptr<unsigned char>(h);
+                const unsigned char * max_row = _max_image.ptr<unsigned char>(h);
+                cv::Vec2b * row_light = _direct_light.ptr<cv::Vec2b>(h);
+                for (int w=0; w<_direct_light.cols; w++)
+                {
+                    float Lmax = max_row[w];
+                    float Lmin = min_row[w];
+                    int Ld = static_cast<int>(_b1*(Lmax - Lmin) + 0.5f);
+                    int Lg = static_cast<int>(_b2*(Lmin - _b*Lmax) + 0.5f);
+                    row_light[w][0] = (Lg>0 ? cv::saturate_cast<unsigned char>(Ld) : max_row[w]);
+                    row_light[w][1] = (Lg>0 ? cv::saturate_cast<unsigned char>(Lg) : 0);
+                }
+            }
+        }
+
+    private:
+        cv::Mat const& _min_image;
+        cv::Mat const& _max_image;
+        float _b;
+        float _b1;
+        float _b2;
+        cv::Mat & _direct_light;
+    };
+};
+
+cv::Mat sl::DirectLightAccumulator::finish(void) const
+{
+    if (_count==0)
+    {   //no images
+        return cv::Mat();
+    }
 
-    cv::Size size = images.at(0).size();
+    instrument::ScopedTimer timer("direct_light");
+    cv::Mat direct_light(_min.size(), CV_8UC2);
+    cv::parallel_for_(cv::Range(0, direct_light.rows), DirectLightBody(_min, _max, _b, direct_light));
+    return direct_light;
+}
 
-    //initialize direct light image
-    cv::Mat direct_light(size, CV_8UC2);
+cv::Mat sl::RoiFrameSource::get_gray_rows(size_t index, int row_start, int row_end)
+{
+    cv::Mat gray_image = _source.get_gray_rows(index, _roi.y+row_start, _roi.y+row_end);
+    if (gray_image.cols<_roi.x+_roi.width)
+    {
+        return cv::Mat();
+    }
+    return gray_image.colRange(_roi.x, _roi.x+_roi.width).clone();
+}
 
-    double b1 = 1.0/(1.0 - b);
-    double b2 = 2.0/(1.0 - b*1.0*b);
+cv::Rect sl::auto_roi(const cv::Mat & white_image, const cv::Mat & black_image, unsigned threshold, int margin)
+{
+    if (white_image.type()!=CV_8UC1 || black_image.type()!=CV_8UC1 || white_image.size()!=black_image.size())
+    {
+        return cv::Rect();
+    }
 
-    for (unsigned h=0; static_cast<int>(h)<size.height; h++)
+    int x0 = white_image.cols, x1 = -1, y0 = white_image.rows, y1 = -1;
+    for (int h=0; h<white_image.rows; h++)
     {
-        unsigned char const* row[COUNT];
-        for (unsigned i=0; i<count; i++)
+        const unsigned char * row1 = white_image.ptr<unsigned char>(h);
+        const unsigned char * row2 = black_image.ptr<unsigned char>(h);
+        for (int w=0; w<white_image.cols; w++)
         {
-            row[i] = images.at(i).ptr<unsigned char>(h);
+            if (static_cast<unsigned>(row1[w]>row2[w] ? row1[w]-row2[w] : row2[w]-row1[w])>=threshold)
+            {
+                x0 = std::min(x0, w);
+                x1 = std::max(x1, w);
+                y0 = std::min(y0, h);
+                y1 = std::max(y1, h);
+            }
         }
-        cv::Vec2b * row_light = direct_light.ptr<cv::Vec2b>(h);
+    }
+    if (x1<0)
+    {   //nothing lit
+        return cv::Rect();
+    }
+    cv::Rect roi(x0-margin, y0-margin, x1-x0+1+2*margin, y1-y0+1+2*margin);
+    return roi & cv::Rect(0, 0, white_image.cols, white_image.rows);
+}
 
-        for (unsigned w=0; static_cast<int>(w)<size.width; w++)
+cv::Rect sl::pattern_roi(const cv::Mat & pattern_image)
+{
+    if (pattern_image.type()!=CV_32FC2)
+    {
+        return cv::Rect();
+    }
+
+    int x0 = pattern_image.cols, x1 = -1, y0 = pattern_image.rows, y1 = -1;
+    for (int h=0; h<pattern_image.rows; h++)
+    {
+        const cv::Vec2f * pattern_row = pattern_image.ptr<cv::Vec2f>(h);
+        for (int w=0; w<pattern_image.cols; w++)
         {
-            unsigned Lmax = row[0][w];
-            unsigned Lmin = row[0][w];
-            for (unsigned i=0; i<count; i++)
+            if (!INVALID(pattern_row[w][0]))
             {
-                if (Lmax<row[i][w]) Lmax = row[i][w];
-                if (Lmin>row[i][w]) Lmin = row[i][w];
+                x0 = std::min(x0, w);
+                x1 = std::max(x1, w);
+                y0 = std::min(y0, h);
+                y1 = std::max(y1, h);
             }
+        }
+    }
+    return (x1<0 ? cv::Rect() : cv::Rect(x0, y0, x1-x0+1, y1-y0+1));
+}
+
+cv::Mat sl::RetainFrameSource::get_gray_image(size_t index)
+{
+    std::map<size_t, cv::Mat>::iterator iter = _retained.find(index);
+    if (iter!=_retained.end())
+    {   //second use: hand it out and forget it
+        cv::Mat gray_image = iter->second;
+        _retained.erase(iter);
+        return gray_image;
+    }
+
+    cv::Mat gray_image = _source.get_gray_image(index);
+    if (gray_image.data && std::find(_frames.begin(), _frames.end(), index)!=_frames.end())
+    {
+        _retained[index] = gray_image;
+    }
+    return gray_image;
+}
+
+cv::Mat sl::FrameSource::get_gray_rows(size_t index, int row_start, int row_end)
+{
+    cv::Mat gray_image = get_gray_image(index);
+    if (gray_image.rows<row_end)
+    {
+        return cv::Mat();
+    }
+    return gray_image.rowRange(row_start, row_end).clone(); //release the rest of the frame
+}
+
+cv::Size sl::FrameSource::frame_size(void)
+{
+    return (size()>0 ? get_gray_image(0).size() : cv::Size());
+}
+
+cv::Mat sl::FileFrameSource::get_gray_image(size_t index)
+{
+    return sl::get_gray_image(_images.at(index));
+}
+
+namespace
+{
+    const char RAW_STACK_MAGIC[4] = {'S', 'L', 'R', 'S'};
+    const std::streamoff RAW_STACK_HEADER = 16;
+};
+
+sl::RawStackFrameSource::RawStackFrameSource(const std::string & filename) :
+    _filename(filename),
+    _size(),
+    _count(0)
+{
+    if (filename.empty())
+    {   //no stack
+        return;
+    }
+
+    std::ifstream file(filename.c_str(), std::ios::in|std::ios::binary);
+    char magic[4];
+    int header[3];
+    if (!file.read(magic, 4) || !file.read(reinterpret_cast<char *>(header), sizeof(header)) 
+        || !std::equal(magic, magic+4, RAW_STACK_MAGIC) || header[0]<1 || header[1]<1 || header[2]<1)
+    {
+        std::cout << "[RawStackFrameSource] ERROR: not a frame stack " << filename << std::endl;
+        return;
+    }
+    _size = cv::Size(header[0], header[1]);
+    _count = static_cast<size_t>(header[2]);
+}
+
+cv::Mat sl::RawStackFrameSource::get_gray_rows(size_t index, int row_start, int row_end)
+{
+    if (index>=_count || row_start<0 || row_end>_size.height || row_end<=row_start)
+    {
+        return cv::Mat();
+    }
+
+    instrument::ScopedTimer timer("image_load");
+    std::ifstream file(_filename.c_str(), std::ios::in|std::ios::binary);
+    std::streamoff offset = RAW_STACK_HEADER 
+                            + (static_cast<std::streamoff>(index)*_size.height + row_start)*_size.width;
+    cv::Mat gray_image(row_end-row_start, _size.width, CV_8UC1);
+    if (!file.seekg(offset) || !file.read(reinterpret_cast<char *>(gray_image.data), gray_image.total()))
+    {
+        std::cout << "[RawStackFrameSource] ERROR: cannot read frame " << index << " of " << _filename << std::endl;
+        return cv::Mat();
+    }
+    instrument::count("bytes_read", gray_image.total());
+    return gray_image;
+}
+
+bool sl::RawStackFrameSource::write(FrameSource & images, const std::string & filename)
+{
+    std::ofstream file(filename.c_str(), std::ios::out|std::ios::binary|std::ios::trunc);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    cv::Size size;
+    for (size_t i=0; i<images.size(); i++)
+    {
+        cv::Mat gray_image = images.get_gray_image(i);
+        if (i==0)
+        {
+            size = gray_image.size();
+            int header[3] = {size.width, size.height, static_cast<int>(images.size())};
+            file.write(RAW_STACK_MAGIC, 4);
+            file.write(reinterpret_cast<const char *>(header), sizeof(header));
+        }
+        if (gray_image.size()!=size || size.width<1 || gray_image.type()!=CV_8UC1)
+        {
+            std::cout << "[RawStackFrameSource] ERROR: frame " << i << " has a different size or type" << std::endl;
+            return false;
+        }
+        for (int h=0; h<gray_image.rows; h++)
+        {
+            file.write(reinterpret_cast<const char *>(gray_image.ptr<unsigned char>(h)), gray_image.cols);
+        }
+        instrument::count("bytes_written", gray_image.total());
+    }
+    return file.good() && images.size()>0;
+}
 
-            int Ld = static_cast<int>(b1*(Lmax - Lmin) + 0.5);
-            int Lg = static_cast<int>(b2*(Lmin - b*Lmax) + 0.5);
-            row_light[w][0] = (Lg>0 ? static_cast<unsigned>(Ld) : Lmax);
-            row_light[w][1] = (Lg>0 ? static_cast<unsigned>(Lg) : 0);
+sl::HdrFrameSource::HdrFrameSource(const std::vector<std::vector<std::string> > & exposures, unsigned saturation) :
+    _exposures(exposures),
+    _saturation(saturation),
+    _exposure_map(),
+    _masks()
+{
+}
+
+bool sl::HdrFrameSource::make_exposure_map(void)
+{
+    _exposure_map = cv::Mat();
+    _masks.clear();
+    if (_exposures.empty() || size()<2)
+    {
+        return false;
+    }
+
+    cv::Mat best_contrast, contrast, mask;
+    for (size_t e=0; e<_exposures.size(); e++)
+    {
+        if (_exposures[e].size()!=size())
+        {
+            std::cout << "[HdrFrameSource] ERROR: exposure " << e << " has " << _exposures[e].size() << " images, expected " << size() << std::endl;
+            return false;
+        }
+        cv::Mat white_image = sl::get_gray_image(_exposures[e][0]);
+        cv::Mat black_image = sl::get_gray_image(_exposures[e][1]);
+        if (!white_image.data || !black_image.data || white_image.size()!=black_image.size()
+            || (e>0 && white_image.size()!=_exposure_map.size()))
+        {
+            std::cout << "[HdrFrameSource] ERROR: cannot load white and black images of exposure " << e << std::endl;
+            _exposure_map = cv::Mat();
+            return false;
+        }
 
-            //std::cout << "Ld=" << (int)row_light[w][0] << " iTotal=" <<(int) row_light[w][1] << std::endl;
+        cv::subtract(white_image, black_image, contrast); //saturated: negative is 0
+        if (e==0)
+        {   //first exposure is the default, where it is saturated any other one is better
+            _exposure_map = cv::Mat::zeros(white_image.size(), CV_8UC1);
+            best_contrast = contrast.clone();
+            best_contrast.setTo(cv::Scalar(0.0), white_image>=static_cast<double>(_saturation));
+            continue;
         }
+
+        //better contrast and not saturated
+        cv::compare(contrast, best_contrast, mask, cv::CMP_GT);
+        cv::Mat unsaturated = (white_image<static_cast<double>(_saturation));
+        cv::bitwise_and(mask, unsaturated, mask);
+        contrast.copyTo(best_contrast, mask);
+        _exposure_map.setTo(cv::Scalar(static_cast<double>(e)), mask);
     }
 
-    std::cout << " --- estimate_direct_light END ---\n";
+    set_exposure_map(_exposure_map);
+    return true;
+}
 
-    return direct_light;
+void sl::HdrFrameSource::set_exposure_map(const cv::Mat & exposure_map)
+{
+    _exposure_map = exposure_map;
+    _masks.clear();
+    for (size_t e=1; e<_exposures.size(); e++)
+    {
+        _masks.push_back(exposure_map==static_cast<double>(e));
+    }
+}
+
+cv::Mat sl::HdrFrameSource::get_gray_image(size_t index)
+{
+    if (!_exposure_map.data && !make_exposure_map())
+    {
+        return cv::Mat();
+    }
+
+    cv::Mat fused = sl::get_gray_image(_exposures[0].at(index));
+    if (fused.size()!=_exposure_map.size())
+    {
+        return cv::Mat();
+    }
+    for (size_t e=1; e<_exposures.size(); e++)
+    {
+        cv::Mat gray_image = sl::get_gray_image(_exposures[e].at(index));
+        if (gray_image.size()!=fused.size())
+        {
+            std::cout << "[HdrFrameSource] ERROR: cannot load " << _exposures[e].at(index) << std::endl;
+            return cv::Mat();
+        }
+        gray_image.copyTo(fused, _masks[e-1]);
+    }
+    return fused;
 }
 
 cv::Mat sl::get_gray_image(const std::string & filename)
 {
     //load image
-    cv::Mat rgb_image = cv::imread(filename);
+    cv::Mat rgb_image;
+    {
+        instrument::ScopedTimer timer("image_load");
+        rgb_image = cv::imread(filename);
+    }
     if (rgb_image.rows>0 && rgb_image.cols>0)
     {
+        if (instrument::enabled())
+        {   //compressed size on disk
+            std::ifstream file(filename.c_str(), std::ios::in|std::ios::binary|std::ios::ate);
+            instrument::count("bytes_read", static_cast<cv::int64>(file.tellg()));
+            instrument::count("images_loaded", 1);
+        }
+
         //gray scale
+        instrument::ScopedTimer timer("gray_image");
         cv::Mat gray_image;
         cvtColor(rgb_image, gray_image, CV_BGR2GRAY);
         return gray_image;
@@ -28,6 +28,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef __STRUCTURED_LIGHT_HPP__
 #define __STRUCTURED_LIGHT_HPP__
 
+#include <map>
 #include <opencv2/core/core.hpp>
 
 #ifndef _MSC_VER
@@ -39,17 +40,205 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 namespace sl
 {
-    enum DecodeFlags {SimpleDecode = 0x00, GrayPatternDecode = 0x01, RobustDecode = 0x02};
+    //ThresholdDecode: one image per bit compared against the mean of white and black, no inverted images
+    //ColumnDecode: vertical patterns only, the row channel is left invalid
+    //RepairDecode: codes with a few uncertain bits are completed from their valid neighbors (with RobustDecode)
+    enum DecodeFlags {SimpleDecode = 0x00, GrayPatternDecode = 0x01, RobustDecode = 0x02, 
+                      ThresholdDecode = 0x04, ColumnDecode = 0x08, RepairDecode = 0x10};
 
     extern const float PIXEL_UNCERTAIN;
     extern const unsigned short BIT_UNCERTAIN;
 
+    //ordered gray images of a pattern sequence, loaded one at a time by the decoders
+    class FrameSource
+    {
+    public:
+        virtual ~FrameSource() {}
+        virtual size_t size(void) const = 0;
+        virtual cv::Mat get_gray_image(size_t index) = 0;
+
+        //rows [row_start, row_end) of a frame and the frame size: 
+        //by default the whole frame is loaded, seekable sources read only what is asked
+        virtual cv::Mat get_gray_rows(size_t index, int row_start, int row_end);
+        virtual cv::Size frame_size(void);
+    };
+
+    //a band of rows of every frame of another source
+    class BandFrameSource : public FrameSource
+    {
+    public:
+        BandFrameSource(FrameSource & source, int row_start, int row_end) : _source(source), _row_start(row_start), _row_end(row_end) {}
+        virtual size_t size(void) const {return _source.size();}
+        virtual cv::Mat get_gray_image(size_t index) {return _source.get_gray_rows(index, _row_start, _row_end);}
+
+    private:
+        FrameSource & _source;
+        int _row_start;
+        int _row_end;
+    };
+
+    //frames cropped to a region of interest, seekable sources read only its rows
+    class RoiFrameSource : public FrameSource
+    {
+    public:
+        RoiFrameSource(FrameSource & source, cv::Rect const& roi) : _source(source), _roi(roi) {}
+        virtual size_t size(void) const {return _source.size();}
+        virtual cv::Mat get_gray_image(size_t index) {return get_gray_rows(index, 0, _roi.height);}
+        virtual cv::Mat get_gray_rows(size_t index, int row_start, int row_end);
+        virtual cv::Size frame_size(void) {return _roi.size();}
+
+    private:
+        FrameSource & _source;
+        cv::Rect _roi;
+    };
+
+    //keeps the listed frames after they are first loaded and hands each out once more from memory, 
+    //e.g. the direct light frames, needed first for the direct light and again by the decoder
+    class RetainFrameSource : public FrameSource
+    {
+    public:
+        RetainFrameSource(FrameSource & source, const std::vector<size_t> & frames) : _source(source), _frames(frames), _retained() {}
+        virtual size_t size(void) const {return _source.size();}
+        virtual cv::Mat get_gray_image(size_t index);
+        virtual cv::Size frame_size(void) {return _source.frame_size();}
+
+    private:
+        FrameSource & _source;
+        std::vector<size_t> _frames;
+        std::map<size_t, cv::Mat> _retained;
+    };
+
+    //uncompressed 8-bit frames one after the other in a single file, after a header with
+    //the frame width, height, and count; bands of rows are read with a seek, without loading
+    //the whole frame, and each read opens the file so several threads can read at once
+    class RawStackFrameSource : public FrameSource
+    {
+    public:
+        RawStackFrameSource(const std::string & filename);
+        inline bool is_open(void) const {return _count>0;}
+        virtual size_t size(void) const {return _count;}
+        virtual cv::Mat get_gray_image(size_t index) {return get_gray_rows(index, 0, _size.height);}
+        virtual cv::Mat get_gray_rows(size_t index, int row_start, int row_end);
+        virtual cv::Size frame_size(void) {return _size;}
+
+        //copies every frame of a source, loading one frame at a time
+        static bool write(FrameSource & images, const std::string & filename);
+
+    private:
+        std::string _filename;
+        cv::Size _size;
+        size_t _count;
+    };
+
+    class FileFrameSource : public FrameSource
+    {
+    public:
+        FileFrameSource(const std::vector<std::string> & images) : _images(images) {}
+        virtual size_t size(void) const {return _images.size();}
+        virtual cv::Mat get_gray_image(size_t index);
+
+    private:
+        const std::vector<std::string> & _images;
+    };
+
+    //frames already in memory (8-bit gray), e.g. a live preview sequence
+    class MemoryFrameSource : public FrameSource
+    {
+    public:
+        MemoryFrameSource(const std::vector<cv::Mat> & images) : _images(images) {}
+        virtual size_t size(void) const {return _images.size();}
+        virtual cv::Mat get_gray_image(size_t index) {return _images.at(index);}
+
+    private:
+        const std::vector<cv::Mat> & _images;
+    };
+
+    //same sequence captured at several exposures: exposures[e][i] is frame i at exposure e
+    //each pixel takes every frame from the exposure with the largest white-black contrast 
+    //below saturation, chosen once from frames 0 (white) and 1 (black)
+    //only the images of the current frame are loaded, the fusion is a masked copy per exposure
+    class HdrFrameSource : public FrameSource
+    {
+    public:
+        HdrFrameSource(const std::vector<std::vector<std::string> > & exposures, unsigned saturation = 250);
+        virtual size_t size(void) const {return (_exposures.empty() ? 0 : _exposures.front().size());}
+        virtual cv::Mat get_gray_image(size_t index);
+
+        //CV_8UC1 exposure index of each pixel
+        bool make_exposure_map(void);
+        inline const cv::Mat & get_exposure_map(void) const {return _exposure_map;}
+        void set_exposure_map(const cv::Mat & exposure_map);
+
+    private:
+        const std::vector<std::vector<std::string> > & _exposures;
+        unsigned _saturation;
+        cv::Mat _exposure_map;
+        std::vector<cv::Mat> _masks;
+    };
+
+    //optional per-pixel quality maps, filled by decode_pattern in the same pass over the images
+    //margin: CV_8UC1 smallest |value1-value2| over every bit (distance to the threshold with ThresholdDecode)
+    //uncertain: CV_8UC1 number of bits the robust classifier could not decide
+    //direct_ratio: CV_32FC1 Ld/Lg, only with RobustDecode and a direct light image
+    //confidence: CV_32FC1 margin relative to the white-black contrast, from 0 to 1, 0 if the code is invalid
+    struct DecodeAux
+    {
+        cv::Mat margin;
+        cv::Mat uncertain;
+        cv::Mat direct_ratio;
+        cv::Mat confidence;
+    };
+
+    //shadow: if not 0, pixels whose white-black contrast is below it are left invalid without decoding them
     bool decode_pattern(const std::vector<std::string> & images, cv::Mat & pattern_image, cv::Mat & min_max_image, cv::Size const& projector_size,
-                        unsigned flags = SimpleDecode, const cv::Mat & direct_light = cv::Mat(), unsigned m = 5);
+                        unsigned flags = SimpleDecode, const cv::Mat & direct_light = cv::Mat(), unsigned m = 5, DecodeAux * aux = NULL, 
+                        unsigned shadow = 0);
+    bool decode_pattern(FrameSource & images, cv::Mat & pattern_image, cv::Mat & min_max_image, cv::Size const& projector_size,
+                        unsigned flags = SimpleDecode, const cv::Mat & direct_light = cv::Mat(), unsigned m = 5, DecodeAux * aux = NULL, 
+                        unsigned shadow = 0);
+
+    //decode_pattern in bands of band_rows rows, in parallel, each band reading only its rows of every frame 
+    //(with a margin for RepairDecode) and estimating its own direct light from direct_frames (RobustDecode);
+    //besides the results, memory is bounded by the bands in flight times the band size times the frames held
+    bool decode_pattern_tiled(FrameSource & images, cv::Mat & pattern_image, cv::Mat & min_max_image, cv::Size const& projector_size,
+                              unsigned flags, const std::vector<size_t> & direct_frames, float b, unsigned m, int band_rows, DecodeAux * aux = NULL, 
+                              unsigned shadow = 0);
+
+    //rejects (sets invalid) the pattern pixels whose confidence is below min_confidence, returns how many
+    size_t reject_low_confidence(cv::Mat & pattern_image, const cv::Mat & confidence, float min_confidence);
+    bool decode_phase(const std::vector<std::string> & images, cv::Mat & pattern_image, unsigned steps, float period, float min_amplitude = 5.f);
+    bool decode_phase(FrameSource & images, cv::Mat & pattern_image, unsigned steps, float period, float min_amplitude = 5.f);
     unsigned short get_robust_bit(unsigned value1, unsigned value2, unsigned Ld, unsigned Lg, unsigned m);
     void convert_pattern(cv::Mat & pattern_image, cv::Size const& projector_size, const int offset[2], bool binary);
     cv::Mat estimate_direct_light(const std::vector<cv::Mat> & images, float b);
 
+    //direct/global light separation from any number of high frequency frames: running minimum and 
+    //maximum images updated as each frame arrives, Ld and Lg computed in parallel by finish()
+    class DirectLightAccumulator
+    {
+    public:
+        DirectLightAccumulator(float b) : _b(b), _min(), _max(), _count(0) {}
+        bool add(const cv::Mat & gray_image);
+        inline size_t count(void) const {return _count;}
+        cv::Mat finish(void) const; //CV_8UC2 Ld, Lg
+
+    private:
+        float _b;
+        cv::Mat _min;
+        cv::Mat _max;
+        size_t _count;
+    };
+
+    //frame indices of the pattern pairs used to estimate the direct light: 4 of each direction, 
+    //next to the 4 finest ones; direction_images counts the images of one direction
+    //empty if there are too few images
+    std::vector<size_t> direct_light_frames(int direction_images, int directions);
+
+    //bounding box of the pixels with at least 'threshold' white-black contrast, grown by 'margin', empty if none
+    cv::Rect auto_roi(const cv::Mat & white_image, const cv::Mat & black_image, unsigned threshold, int margin = 8);
+    //bounding box of the valid pattern pixels, empty if none
+    cv::Rect pattern_roi(const cv::Mat & pattern_image);
+
     cv::Mat get_gray_image(const std::string & filename);
     static inline bool INVALID(float value) {return _isnan(value)>0;}
     static inline bool INVALID(const cv::Vec2f & pt) {return _isnan(pt[0]) || _isnan(pt[1]);}